@@ -0,0 +1,245 @@
+/* Macro benchmark of the uthreads library: an echo server over local
+socketpairs. For every pair of threads, a client thread sends timestamped
+requests and waits for their echo, and a server thread echoes them back after
+a short busy computation. Sockets are non-blocking, and a thread waiting for
+its socket yields.
+Each configuration (quantum length and number of pairs) runs in its own
+process, as uthread_init may only be called once, and prints its throughput
+and latency percentiles as a single JSON object line.
+Usage: bench_echo [total_requests] [server_work_iterations] */
+
+#include "uthreads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define DEFAULT_TOTAL_REQUESTS 200000
+#define DEFAULT_SERVER_WORK 200
+#define RESERVED_FDS 16 // descriptors not used by socketpairs (stdio etc.)
+
+/* A request, echoed back as is */
+struct Message
+{
+	double sentNanos;
+	long sequence;
+};
+
+static int pairs;
+static int requestsPerClient;
+static int serverWork;
+static int* clientFds;
+static int* serverFds;
+static double* latencies;
+static volatile int nextClient;
+static volatile int nextServer;
+static volatile int clientsDone;
+
+
+/* Returns the monotonic clock in nano-seconds */
+static double nowNanos()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/* Sends the message, yielding while the socket is full */
+static void sendMessage(int fd, Message* message)
+{
+	while(send(fd, message, sizeof(Message), 0) < 0)
+	{
+		if(errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			perror("send");
+			exit(1);
+		}
+		uthread_yield();
+	}
+}
+
+/* Receives a message, yielding while the socket is empty. Returns false if
+the other end was closed */
+static bool receiveMessage(int fd, Message* message)
+{
+	ssize_t received;
+	while((received = recv(fd, message, sizeof(Message), 0)) < 0)
+	{
+		if(errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			perror("recv");
+			exit(1);
+		}
+		uthread_yield();
+	}
+	return received > 0;
+}
+
+
+/* Sends requests one at a time, and records the round trip of each */
+static void client()
+{
+	int index = nextClient++;
+	int fd = clientFds[index];
+	double* myLatencies = latencies + (long)index * requestsPerClient;
+	Message message;
+
+	for(int i = 0; i < requestsPerClient; i++)
+	{
+		message.sentNanos = nowNanos();
+		message.sequence = i;
+		sendMessage(fd, &message);
+		receiveMessage(fd, &message);
+		myLatencies[i] = nowNanos() - message.sentNanos;
+	}
+
+	close(fd);
+	clientsDone++;
+	uthread_block(uthread_get_tid());
+}
+
+/* Echoes requests until the client closes its socket */
+static void server()
+{
+	int fd = serverFds[nextServer++];
+	Message message;
+
+	while(receiveMessage(fd, &message))
+	{
+		for(volatile int i = 0; i < serverWork; i++)
+		{
+		}
+		sendMessage(fd, &message);
+	}
+
+	close(fd);
+	uthread_block(uthread_get_tid());
+}
+
+
+/* Runs a single configuration and prints its results. Called in a child
+process */
+static void runConfiguration(int quantumUsecs, int totalRequests)
+{
+	requestsPerClient = totalRequests / pairs;
+	clientFds = new int[pairs];
+	serverFds = new int[pairs];
+	latencies = new double[(long)pairs * requestsPerClient];
+
+	for(int i = 0; i < pairs; i++)
+	{
+		int fds[2];
+		if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds) < 0)
+		{
+			perror("socketpair");
+			exit(1);
+		}
+		clientFds[i] = fds[0];
+		serverFds[i] = fds[1];
+	}
+
+	uthread_init(quantumUsecs);
+
+	double start = nowNanos();
+	for(int i = 0; i < pairs; i++)
+	{
+		uthread_spawn(server);
+		uthread_spawn(client);
+	}
+	while(clientsDone < pairs)
+	{
+		uthread_yield();
+	}
+	double elapsed = nowNanos() - start;
+
+	long count = (long)pairs * requestsPerClient;
+	std::sort(latencies, latencies + count);
+	uthread_global_stats stats;
+	uthread_get_global_stats(&stats);
+
+	printf("{\"benchmark\":\"echo\",\"quantum_usecs\":%d,\"pairs\":%d,"\
+	"\"threads\":%d,\"requests\":%ld,\"requests_per_sec\":%.0f,"\
+	"\"p50_ns\":%.0f,\"p99_ns\":%.0f,\"p999_ns\":%.0f,\"max_ns\":%.0f,"\
+	"\"involuntary_switches\":%llu,\"voluntary_switches\":%llu}\n",
+	quantumUsecs, pairs, 2 * pairs + 1, count, count / (elapsed / 1e9),
+	latencies[count / 2], latencies[count * 99 / 100],
+	latencies[count * 999 / 1000], latencies[count - 1],
+	stats.involuntary_switches, stats.voluntary_switches);
+	fflush(stdout);
+
+	uthread_terminate(0);
+}
+
+
+/* Raises the limit of open files as far as allowed, and returns it */
+static int raiseFileLimit()
+{
+	struct rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+	getrlimit(RLIMIT_NOFILE, &limit);
+	return (int)std::min(limit.rlim_cur, (rlim_t)1 << 30);
+}
+
+
+int main(int argc, char** argv)
+{
+	int totalRequests = argc > 1 ? atoi(argv[1]) : DEFAULT_TOTAL_REQUESTS;
+	serverWork = argc > 2 ? atoi(argv[2]) : DEFAULT_SERVER_WORK;
+	if(totalRequests <= 0 || serverWork < 0)
+	{
+		fprintf(stderr, "usage: %s [total_requests] "\
+		"[server_work_iterations]\n", argv[0]);
+		return 1;
+	}
+
+	//Each pair takes two threads and two descriptors, the main thread one
+	int maxPairs = std::min((MAX_THREAD_NUM - 1) / 2,
+	                        (raiseFileLimit() - RESERVED_FDS) / 2);
+	const int quanta[] = {100, 1000, 10000};
+	const int fixedPairCounts[] = {1, 16, 64, 256, 1024};
+	std::vector<int> pairCounts;
+	for(int count : fixedPairCounts)
+	{
+		if(count < maxPairs && count <= totalRequests)
+		{
+			pairCounts.push_back(count);
+		}
+	}
+	pairCounts.push_back(std::min(maxPairs, totalRequests));
+
+	for(int quantum : quanta)
+	{
+		for(int count : pairCounts)
+		{
+			pairs = count;
+			pid_t child = fork();
+			if(child < 0)
+			{
+				perror("fork");
+				return 1;
+			}
+			if(child == 0)
+			{
+				runConfiguration(quantum, totalRequests);
+			}
+			int status;
+			waitpid(child, &status, 0);
+			if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			{
+				fprintf(stderr, "configuration quantum=%d pairs=%d failed\n",
+				        quantum, count);
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
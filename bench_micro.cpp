@@ -0,0 +1,627 @@
+/* Microbenchmarks of the uthreads library. Measures the latency of a yield,
+spawn+terminate throughput, block/resume round trips, fan-out of spawns and
+resumes one by one and in batches, thread-local reads, request-scoped 
+allocations from the thread's arena against malloc and free, items pulled 
+from a generator, the cost of a switch as a function of the number of 
+sleepers and of the ready queue's length (with plain, colored, huge page and
+shared stacks, and with integer contexts, the latter in runtimes of their 
+own) and while live stats are published, small jobs on the executor against a thread per job, and pthread and 
+raw swapcontext baselines for comparison.
+Every result is printed as a single JSON object per line, so that results of
+different releases can be compared by a script.
+Usage: bench_micro [iterations] */
+
+#include "uthreads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <ucontext.h>
+
+#define DEFAULT_ITERATIONS 100000
+#define QUANTUM_USECS 1000000 // long enough to never preempt a benchmark
+#define SLEEP_FOREVER (1 << 30)
+#define EXECUTOR_WORKERS 4
+#define EXECUTOR_CAPACITY 256
+#define COLOR_STRIDE 64 // a cache line per color
+#define REQUEST_OBJECTS 32 // allocated by each request-scoped thread
+#define REQUEST_OBJECT_SIZE 96
+#define STATS_SEGMENT "/uthread_bench_micro"
+#define STATS_WORKERS 64
+
+static int iterations;
+static volatile bool stopWorkers;
+static volatile int liveWorkers;
+static uthread_context yielderContext = UTHREAD_CONTEXT_FULL;
+static int yielderSharedStack = 0;
+
+
+/* Returns the monotonic clock in nano-seconds */
+static double nowNanos()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/* Prints a single result line */
+static void report(const char* benchmark, int param, long operations,
+                   double elapsedNanos)
+{
+	printf("{\"benchmark\":\"%s\",\"param\":%d,\"operations\":%ld,"\
+	"\"ns_per_op\":%.2f}\n", benchmark, param, operations,
+	elapsedNanos / operations);
+	fflush(stdout);
+}
+
+
+/* A worker that yields until told to stop, and then blocks itself so that
+it is terminated by the main thread */
+static void yieldingWorker()
+{
+	liveWorkers++;
+	while(!stopWorkers)
+	{
+		uthread_yield();
+	}
+	liveWorkers--;
+	uthread_block(uthread_get_tid());
+}
+
+/* Runs yieldingWorker, for uthread_spawn_attr */
+static void runYieldingWorker(void*)
+{
+	yieldingWorker();
+}
+
+/* A worker that blocks itself repeatedly, to be resumed by the main thread*/
+static void blockingWorker()
+{
+	while(true)
+	{
+		uthread_block(uthread_get_tid());
+	}
+}
+
+/* A worker that never runs past its first line */
+static void emptyWorker()
+{
+}
+
+/* A worker that sleeps for the rest of the benchmark */
+static void sleepingWorker()
+{
+	uthread_sleep(SLEEP_FOREVER);
+}
+
+
+/* Spawns the given number of yielding workers, and waits for them to start.
+Their ids are stored in tids */
+static void spawnYielders(int count, int* tids)
+{
+	stopWorkers = false;
+	for(int i = 0; i < count; i++)
+	{
+		uthread_attr attr;
+		uthread_attr_init(&attr);
+		attr.context = yielderContext;
+		attr.shared_stack = yielderSharedStack;
+		tids[i] = uthread_spawn_attr(runYieldingWorker, nullptr, &attr);
+	}
+	while(liveWorkers < count)
+	{
+		uthread_yield();
+	}
+}
+
+/* Stops and terminates the given yielding workers */
+static void stopYielders(int count, int* tids)
+{
+	stopWorkers = true;
+	while(liveWorkers > 0)
+	{
+		uthread_yield();
+	}
+	for(int i = 0; i < count; i++)
+	{
+		uthread_terminate(tids[i]);
+	}
+}
+
+
+/* Measures the cost of switching between the given number of yielding
+workers and the main thread. Every yield of the main thread passes through
+all workers, so the number of rounds is divided between them. The result is
+reported with the given parameter */
+static void benchYield(const char* name, int workers, int param)
+{
+	int* tids = new int[workers];
+	spawnYielders(workers, tids);
+
+	int rounds = iterations / (workers + 1) + 1;
+	double start = nowNanos();
+	for(int i = 0; i < rounds; i++)
+	{
+		uthread_yield();
+	}
+	double elapsed = nowNanos() - start;
+	report(name, param, (long)rounds * (workers + 1), elapsed);
+
+	stopYielders(workers, tids);
+	delete[] tids;
+}
+
+/* Measures the cost of switching between STATS_WORKERS yielding workers 
+while live stats are published every period scheduling decisions, to compare
+with switch_vs_ready_queue. The result is reported with the period */
+static void benchStatsPublished(int period)
+{
+	if(uthread_stats_publish(STATS_SEGMENT, period) != 0)
+	{
+		return;
+	}
+	benchYield("switch_stats_published", STATS_WORKERS, period);
+	uthread_stats_unpublish();
+}
+
+/* A runtime to measure switches in, on a kernel thread of its own */
+struct SwitchRuntime
+{
+	const char* name;
+	uthread_options options;
+};
+
+/* Initializes the given runtime on the calling kernel thread, and measures 
+the cost of a switch in it as the ready queue grows, to compare with 
+switch_vs_ready_queue. The workers get the main thread's context */
+static void* benchRuntimeSwitches(void* switchRuntime)
+{
+	SwitchRuntime* measured = (SwitchRuntime*)switchRuntime;
+	if(uthread_init_options(&measured -> options) != 0)
+	{
+		return nullptr;
+	}
+	
+	yielderContext = measured -> options.main_context;
+	for(int workers = 1; workers < MAX_THREAD_NUM; workers *= 2)
+	{
+		benchYield(measured -> name, workers, workers);
+	}
+	yielderContext = UTHREAD_CONTEXT_FULL;
+	return nullptr;
+}
+
+/* Runs benchRuntimeSwitches with the given stack options and thread context
+on a new kernel thread */
+static void benchRuntime(const char* name, uthread_stack_mode mode, 
+                         size_t colorStride, uthread_context context)
+{
+	SwitchRuntime measured;
+	measured.name = name;
+	uthread_default_options(&measured.options);
+	measured.options.quantum_usecs = QUANTUM_USECS;
+	measured.options.stack_mode = mode;
+	measured.options.stack_color_stride = colorStride;
+	measured.options.main_context = context;
+	
+	pthread_t kernelThread;
+	pthread_create(&kernelThread, nullptr, benchRuntimeSwitches, &measured);
+	pthread_join(kernelThread, nullptr);
+}
+
+/* Measures a uthread_spawn immediately followed by uthread_terminate */
+static void benchSpawnTerminate()
+{
+	double start = nowNanos();
+	for(int i = 0; i < iterations; i++)
+	{
+		uthread_terminate(uthread_spawn(emptyWorker));
+	}
+	report("spawn_terminate", 0, iterations, nowNanos() - start);
+}
+
+/* Measures the round trip of resuming a thread which then blocks itself */
+static void benchBlockResume()
+{
+	int tid = uthread_spawn(blockingWorker);
+	uthread_yield(); //letting the worker block itself
+
+	double start = nowNanos();
+	for(int i = 0; i < iterations; i++)
+	{
+		uthread_resume(tid);
+		uthread_yield();
+	}
+	report("block_resume_round_trip", 0, iterations, nowNanos() - start);
+
+	uthread_terminate(tid);
+}
+
+/* A generator producing numbers forever */
+static void countingGenerator(void* unused)
+{
+	for(long i = 0; ; i++)
+	{
+		uthread_generator_yield((void*)i);
+	}
+}
+
+/* Measures pulling an item from a generator, to be compared with the block
+and resume round trip of a producer thread */
+static void benchGenerator()
+{
+	uthread_generator* generator = 
+		uthread_generator_create(countingGenerator, nullptr);
+	void* item;
+	double start = nowNanos();
+	for(int i = 0; i < iterations; i++)
+	{
+		uthread_generator_next(generator, &item);
+	}
+	report("generator_next", 0, iterations, nowNanos() - start);
+	uthread_generator_destroy(generator);
+}
+
+/* A small job, counting its runs */
+static volatile long jobsRun;
+static void* countingJob(void* unused)
+{
+	jobsRun++;
+	return nullptr;
+}
+
+/* A thread running a single small job */
+static void countingThread()
+{
+	jobsRun++;
+}
+
+/* Measures running small jobs on the executor's workers, submitted by the
+main thread through a queue of the given capacity, against spawning a 
+thread per job. The executor can only be started once, and its workers keep
+their thread slots */
+static void benchExecutor(int workers, int capacity)
+{
+	uthread_executor_start(workers, capacity);
+	
+	jobsRun = 0;
+	double start = nowNanos();
+	for(int i = 0; i < iterations; i++)
+	{
+		uthread_future_release(uthread_executor_submit(countingJob, nullptr));
+	}
+	while(jobsRun < iterations)
+	{
+		uthread_yield();
+	}
+	report("executor_job", workers, iterations, nowNanos() - start);
+	
+	jobsRun = 0;
+	start = nowNanos();
+	for(int i = 0; i < iterations; i++)
+	{
+		//keeping as many threads as the executor's queue holds jobs
+		while(i - jobsRun >= capacity)
+		{
+			uthread_yield();
+		}
+		uthread_spawn(countingThread);
+	}
+	while(jobsRun < iterations)
+	{
+		uthread_yield();
+	}
+	report("spawn_per_job", 0, iterations, nowNanos() - start);
+}
+
+/* Measures reading a thread-local value, with the pthread key of the same
+value as a baseline */
+static void benchGetSpecific()
+{
+	int key = uthread_key_create(nullptr);
+	uthread_setspecific(key, &iterations);
+	pthread_key_t pthreadKey;
+	pthread_key_create(&pthreadKey, nullptr);
+	pthread_setspecific(pthreadKey, &iterations);
+	
+	volatile long sum = 0;
+	double start = nowNanos();
+	for(int i = 0; i < iterations; i++)
+	{
+		sum += *(int*)uthread_getspecific(key);
+	}
+	report("uthread_getspecific", 0, iterations, nowNanos() - start);
+	
+	start = nowNanos();
+	for(int i = 0; i < iterations; i++)
+	{
+		sum += *(int*)pthread_getspecific(pthreadKey);
+	}
+	report("pthread_getspecific", 0, iterations, nowNanos() - start);
+	pthread_key_delete(pthreadKey);
+}
+
+/* A request-scoped thread, allocating its objects from its arena, which is 
+released when it terminates */
+static void arenaRequest()
+{
+	for(int i = 0; i < REQUEST_OBJECTS; i++)
+	{
+		*(volatile char*)uthread_alloc(REQUEST_OBJECT_SIZE) = 0;
+	}
+}
+
+/* A request-scoped thread, allocating its objects with malloc and freeing
+them before it ends */
+static void mallocRequest()
+{
+	void* objects[REQUEST_OBJECTS];
+	for(int i = 0; i < REQUEST_OBJECTS; i++)
+	{
+		objects[i] = malloc(REQUEST_OBJECT_SIZE);
+		*(volatile char*)objects[i] = 0;
+	}
+	for(int i = 0; i < REQUEST_OBJECTS; i++)
+	{
+		free(objects[i]);
+	}
+}
+
+/* Measures threads which run a request each, allocating REQUEST_OBJECTS 
+objects, from the thread's arena or with malloc and free. Reports the cost
+per object, including the thread's spawn and termination */
+static void benchRequestAllocations()
+{
+	double start = nowNanos();
+	for(int i = 0; i < iterations; i++)
+	{
+		uthread_spawn(arenaRequest);
+		uthread_yield();
+	}
+	report("request_arena_alloc", REQUEST_OBJECTS, 
+	       (long)iterations * REQUEST_OBJECTS, nowNanos() - start);
+	
+	start = nowNanos();
+	for(int i = 0; i < iterations; i++)
+	{
+		uthread_spawn(mallocRequest);
+		uthread_yield();
+	}
+	report("request_malloc_free", REQUEST_OBJECTS, 
+	       (long)iterations * REQUEST_OBJECTS, nowNanos() - start);
+}
+
+/* Measures spawning a batch of threads, one by one or by a single call to
+uthread_spawn_many, and reports the cost per thread. The threads are 
+terminated (untimed) before they ever run */
+static void benchSpawnFanOut(int batch)
+{
+	int* tids = new int[batch];
+	int rounds = iterations / batch + 1;
+	double spawnOne = 0;
+	double spawnMany = 0;
+	
+	for(int round = 0; round < rounds; round++)
+	{
+		double start = nowNanos();
+		for(int i = 0; i < batch; i++)
+		{
+			tids[i] = uthread_spawn(emptyWorker);
+		}
+		spawnOne += nowNanos() - start;
+		for(int i = 0; i < batch; i++)
+		{
+			uthread_terminate(tids[i]);
+		}
+		
+		start = nowNanos();
+		uthread_spawn_many(emptyWorker, batch, tids);
+		spawnMany += nowNanos() - start;
+		for(int i = 0; i < batch; i++)
+		{
+			uthread_terminate(tids[i]);
+		}
+	}
+	
+	report("fan_out_spawn", batch, (long)rounds * batch, spawnOne);
+	report("fan_out_spawn_many", batch, (long)rounds * batch, spawnMany);
+	delete[] tids;
+}
+
+/* Measures resuming a batch of blocked threads, one by one or by a single 
+call to uthread_resume_many, and reports the cost per thread. The threads are
+blocked again (untimed) by uthread_block_many before they run */
+static void benchResumeFanOut(int batch)
+{
+	int* tids = new int[batch];
+	for(int i = 0; i < batch; i++)
+	{
+		tids[i] = uthread_spawn(blockingWorker);
+	}
+	uthread_yield(); //letting the workers block themselves
+	
+	int rounds = iterations / batch + 1;
+	double resumeOne = 0;
+	double resumeMany = 0;
+	for(int round = 0; round < rounds; round++)
+	{
+		double start = nowNanos();
+		for(int i = 0; i < batch; i++)
+		{
+			uthread_resume(tids[i]);
+		}
+		resumeOne += nowNanos() - start;
+		uthread_block_many(tids, batch);
+		
+		start = nowNanos();
+		uthread_resume_many(tids, batch);
+		resumeMany += nowNanos() - start;
+		uthread_block_many(tids, batch);
+	}
+	
+	report("fan_out_resume", batch, (long)rounds * batch, resumeOne);
+	report("fan_out_resume_many", batch, (long)rounds * batch, resumeMany);
+	for(int i = 0; i < batch; i++)
+	{
+		uthread_terminate(tids[i]);
+	}
+	delete[] tids;
+}
+
+/* Measures a switch between the main thread and a single worker, with
+growing numbers of sleeping threads which the scheduler ticks on every
+switch. The sleepers never wake up, so this must be the last benchmark */
+static void benchSleepers(int maxSleepers)
+{
+	int sleepers = 0;
+	int target = 0;
+	while(true)
+	{
+		for(; sleepers < target; sleepers++)
+		{
+			uthread_spawn(sleepingWorker);
+		}
+		uthread_yield(); //letting the new sleepers fall asleep
+		benchYield("switch_with_sleepers", 1, sleepers);
+		
+		if(target == maxSleepers)
+		{
+			break;
+		}
+		target = target == 0 ? 1 : target * 2;
+		if(target > maxSleepers)
+		{
+			target = maxSleepers;
+		}
+	}
+}
+
+
+static pthread_mutex_t pingMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pingCond = PTHREAD_COND_INITIALIZER;
+static int pingTurn;
+
+/* Passes the turn between two pthreads, the given number of times */
+static void* pthreadPingPong(void* arg)
+{
+	long me = (long)arg;
+	pthread_mutex_lock(&pingMutex);
+	for(int i = 0; i < iterations; i++)
+	{
+		while(pingTurn != me)
+		{
+			pthread_cond_wait(&pingCond, &pingMutex);
+		}
+		pingTurn = 1 - me;
+		pthread_cond_signal(&pingCond);
+	}
+	pthread_mutex_unlock(&pingMutex);
+	return NULL;
+}
+
+/* Measures a switch between two kernel threads using a condition variable*/
+static void benchPthreadBaseline()
+{
+	pthread_t other;
+	pingTurn = 0;
+	double start = nowNanos();
+	pthread_create(&other, NULL, pthreadPingPong, (void*)1);
+	pthreadPingPong((void*)0);
+	pthread_join(other, NULL);
+	report("pthread_condvar_switch", 0, 2L * iterations, nowNanos() - start);
+}
+
+
+static ucontext_t mainContext, otherContext;
+
+/* Switches back to the main context forever */
+static void swapcontextPingPong()
+{
+	while(true)
+	{
+		swapcontext(&otherContext, &mainContext);
+	}
+}
+
+/* Measures a switch between two contexts using swapcontext, which also
+saves and restores the signal mask */
+static void benchSwapcontextBaseline()
+{
+	static char stack[STACK_SIZE * 4];
+	getcontext(&otherContext);
+	otherContext.uc_stack.ss_sp = stack;
+	otherContext.uc_stack.ss_size = sizeof(stack);
+	otherContext.uc_link = NULL;
+	makecontext(&otherContext, swapcontextPingPong, 0);
+
+	double start = nowNanos();
+	for(int i = 0; i < iterations; i++)
+	{
+		swapcontext(&mainContext, &otherContext);
+	}
+	report("swapcontext_switch", 0, 2L * iterations, nowNanos() - start);
+}
+
+
+int main(int argc, char** argv)
+{
+	iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+	if(iterations <= 0)
+	{
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	printf("{\"benchmark\":\"config\",\"max_thread_num\":%d,"\
+	"\"stack_size\":%d,\"iterations\":%d}\n", MAX_THREAD_NUM, STACK_SIZE,
+	iterations);
+
+	benchPthreadBaseline();
+	benchSwapcontextBaseline();
+
+	uthread_init(QUANTUM_USECS);
+
+	benchYield("yield_switch", 1, 1);
+	benchSpawnTerminate();
+	benchBlockResume();
+	benchGenerator();
+	benchGetSpecific();
+	benchRequestAllocations();
+	
+	//Fan-out batches, leaving a slot for the main thread
+	for(int batch = 16; batch < MAX_THREAD_NUM; batch *= 16)
+	{
+		benchSpawnFanOut(batch);
+		benchResumeFanOut(batch);
+	}
+
+	//Scheduler cost as the ready queue grows. The main thread takes a slot
+	for(int workers = 1; workers < MAX_THREAD_NUM; workers *= 2)
+	{
+		benchYield("switch_vs_ready_queue", workers, workers);
+	}
+	benchYield("switch_vs_ready_queue", MAX_THREAD_NUM - 1, 
+	           MAX_THREAD_NUM - 1);
+	//Shared stack threads switching in turn, each copying frames both ways
+	yielderSharedStack = 1;
+	benchYield("switch_shared_stack", 64, 64);
+	yielderSharedStack = 0;
+	//Publishing scans every thread id, so it is measured at a high and at a
+	//low rate
+	benchStatsPublished(1);
+	benchStatsPublished(100);
+	benchRuntime("switch_colored", UTHREAD_STACK_MALLOC, COLOR_STRIDE, 
+	             UTHREAD_CONTEXT_FULL);
+	benchRuntime("switch_huge_pages", UTHREAD_STACK_HUGE, 0, 
+	             UTHREAD_CONTEXT_FULL);
+	benchRuntime("switch_integer", UTHREAD_STACK_MALLOC, 0, 
+	             UTHREAD_CONTEXT_INTEGER);
+
+	benchExecutor(EXECUTOR_WORKERS, EXECUTOR_CAPACITY);
+
+	//Leaving slots for the main thread, the executor's workers and the 
+	//yielding worker
+	benchSleepers(MAX_THREAD_NUM - 2 - EXECUTOR_WORKERS);
+
+	return 0;
+}
@@ -0,0 +1,34 @@
+/* The checks of the feature drivers. Each driver is a single translation
+unit, which counts its failed checks here and exits with the code of
+checksResult */
+
+#ifndef _DRIVER_CHECK_
+#define _DRIVER_CHECK_
+
+#include <stdio.h>
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+static int failures = 0;
+
+
+/* Counts a failure of the given check, printing a line of it */
+static inline void check(bool condition, const char* text, int line)
+{
+	if(!condition)
+	{
+		printf("FAIL (line %d): %s\n", line, text);
+		failures++;
+	}
+}
+
+/* Prints whether the driver of the given name passed, and returns its exit
+code: 0 if all of its checks passed, and 1 otherwise */
+static inline int checksResult(const char* driver)
+{
+	printf("%s: %s\n", driver, failures == 0 ? "passed" : "FAILED");
+	return failures == 0 ? 0 : 1;
+}
+
+
+#endif
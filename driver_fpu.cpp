@@ -0,0 +1,88 @@
+/* Driver of the floating point control state of thread contexts. A full
+thread sets rounding upward and blocks, leaving its state loaded, and an
+integer thread runs on it until the timer preempts it - so the integer
+thread's signal frame holds the upward rounding. The main thread (a full
+context) then sets rounding downward and yields to the integer thread,
+which resumes through the return from its signal handler and yields back.
+Each full thread must keep its own rounding mode throughout.
+Prints a line per failed check, and exits with 1 if any failed */
+
+#include "driver_check.h"
+#include "uthreads.h"
+#include <fenv.h>
+
+#define QUANTUM_USECS 10000 // short, as the integer thread waits for it
+
+static volatile bool downwardSet = false;
+static volatile bool integerDone = false;
+static volatile double dividend = 1;
+static volatile double divisor = 3;
+
+
+/* Returns whether the current rounding mode is the given one (upward or
+downward), both in the control state and in an SSE division */
+static bool roundsTo(int mode)
+{
+	double quotient = dividend / divisor;
+	fesetround(FE_UPWARD);
+	double upward = dividend / divisor;
+	fesetround(FE_DOWNWARD);
+	double downward = dividend / divisor;
+	fesetround(mode);
+	return quotient == (mode == FE_UPWARD ? upward : downward) && 
+	       upward != downward && fegetround() == mode;
+}
+
+/* Rounds upward, and checks the mode once resumed */
+static void roundUpward()
+{
+	fesetround(FE_UPWARD);
+	uthread_block(uthread_get_tid());
+	CHECK(roundsTo(FE_UPWARD));
+	for(;;)
+	{
+		uthread_yield();
+	}
+}
+
+/* Runs until the timer preempts it, then yields once the main thread set its
+rounding mode. Touches no floating point state */
+static void waitForDownward(void* unused)
+{
+	while(!downwardSet)
+	{
+	}
+	uthread_yield();
+	integerDone = true;
+	for(;;)
+	{
+		uthread_yield();
+	}
+}
+
+
+int main()
+{
+	uthread_init(QUANTUM_USECS);
+	int upward = uthread_spawn(roundUpward);
+	uthread_attr attr;
+	uthread_attr_init(&attr);
+	attr.context = UTHREAD_CONTEXT_INTEGER;
+	CHECK(uthread_spawn_attr(waitForDownward, nullptr, &attr) > 0);
+
+	//The upward thread blocks, and the integer thread is preempted
+	uthread_yield();
+	fesetround(FE_DOWNWARD);
+	downwardSet = true;
+	while(!integerDone)
+	{
+		uthread_yield();
+	}
+	CHECK(roundsTo(FE_DOWNWARD));
+
+	CHECK(uthread_resume(upward) == 0);
+	uthread_yield();
+	CHECK(roundsTo(FE_DOWNWARD));
+
+	return checksResult("driver_fpu");
+}
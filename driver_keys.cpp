@@ -0,0 +1,146 @@
+/* Driver of the thread-local keys. Checks that a thread's values are
+destroyed when it is terminated by another thread or returns from its entry
+function, that values set again by a destructor are destroyed in further
+rounds, that a failing uthread_terminate (of a sleeping thread) leaves the
+values and the thread as they are, and that a thread whose destructors run 
+(and yield) isn't scheduled meanwhile. Threads only switch by yielding and
+sleeping (the quantum never expires), so every run is the same.
+Prints a line per failed check, and exits with 1 if any failed */
+
+#include "driver_check.h"
+#include "uthreads.h"
+
+#define QUANTUM_USECS 1000000 // long enough to never preempt the driver
+#define SLEEP_FOREVER (1 << 30)
+
+static int key;
+static int rekey;
+static int yieldingKey;
+static int destroyed[4]; // the values destroyed, by value
+static int rounds; // destructor calls of rekey
+static int values[4] = {0, 1, 2, 3};
+static volatile bool sleeperWoke = false;
+static volatile bool destroying = false; // a yielding destructor runs
+static int runsWhileDestroyed = 0;
+
+
+/* Counts the destruction of a value of key */
+static void destroyValue(void* value)
+{
+	destroyed[*(int*)value]++;
+}
+
+/* Sets the value of rekey again, for the first rounds */
+static void destroyAndReset(void* value)
+{
+	rounds++;
+	if(rounds < 3)
+	{
+		uthread_setspecific(rekey, value);
+	}
+}
+
+/* Counts the destruction of a value, yielding to the other threads on the 
+way */
+static void destroyYielding(void* value)
+{
+	destroying = true;
+	for(int i = 0; i < 3; i++)
+	{
+		uthread_yield();
+	}
+	destroying = false;
+	destroyed[*(int*)value]++;
+}
+
+/* Sets a value of yieldingKey and waits to be terminated. Running while its
+value is destroyed is counted, and then it sleeps, which would make its 
+termination fail */
+static void holdThroughDestruction(void* value)
+{
+	uthread_setspecific(yieldingKey, value);
+	for(;;)
+	{
+		if(destroying)
+		{
+			runsWhileDestroyed++;
+			uthread_sleep(2);
+		}
+		uthread_yield();
+	}
+}
+
+/* Sets a value and waits to be terminated */
+static void holdValue(void* value)
+{
+	uthread_setspecific(key, value);
+	for(;;)
+	{
+		uthread_yield();
+	}
+}
+
+/* Sets values and returns. The destructors run in this thread, so the 
+value destroyAndReset sets again is its own */
+static void returnWithValue(void* value)
+{
+	uthread_setspecific(key, value);
+	uthread_setspecific(rekey, value);
+}
+
+/* Sets a value and sleeps, checking it on waking */
+static void sleepWithValue(void* value)
+{
+	uthread_setspecific(key, value);
+	uthread_sleep(2);
+	CHECK(uthread_getspecific(key) == value);
+	sleeperWoke = true;
+	for(;;)
+	{
+		uthread_yield();
+	}
+}
+
+
+int main()
+{
+	uthread_init(QUANTUM_USECS);
+	key = uthread_key_create(destroyValue);
+	rekey = uthread_key_create(destroyAndReset);
+	yieldingKey = uthread_key_create(destroyYielding);
+	CHECK(key >= 0 && rekey >= 0 && yieldingKey >= 0);
+
+	//Terminated by another thread
+	int holder = uthread_spawn_arg(holdValue, &values[1]);
+	uthread_yield();
+	CHECK(uthread_terminate(holder) == 0);
+	CHECK(destroyed[1] == 1);
+
+	//Returning from its entry function
+	uthread_spawn_arg(returnWithValue, &values[2]);
+	uthread_yield();
+	uthread_yield();
+	CHECK(destroyed[2] == 1);
+	CHECK(rounds == 3);
+
+	//A failing termination of a sleeping thread destroys nothing
+	int sleeper = uthread_spawn_arg(sleepWithValue, &values[3]);
+	uthread_yield();
+	CHECK(uthread_terminate(sleeper) == -1);
+	CHECK(destroyed[3] == 0);
+	while(!sleeperWoke)
+	{
+		uthread_yield();
+	}
+	CHECK(uthread_terminate(sleeper) == 0);
+	CHECK(destroyed[3] == 1);
+
+	//A thread isn't scheduled while its destructors run
+	int target = uthread_spawn_arg(holdThroughDestruction, &values[0]);
+	uthread_yield();
+	CHECK(uthread_terminate(target) == 0);
+	CHECK(runsWhileDestroyed == 0);
+	CHECK(destroyed[0] == 1);
+
+	return checksResult("driver_keys");
+}
@@ -0,0 +1,179 @@
+/* Driver of the remote queue. The queue's wakeups are first checked step by
+step: its eventfd is readable exactly while a push is pending, and a push 
+after the scheduler cleared it makes it readable again. Then a kernel thread
+resumes a blocked thread with
+uthread_resume_remote, then producer kernel threads keep submitting tasks 
+with uthread_submit_remote while the main thread waits for them in poll, on
+uthread_remote_fd - so that pushes race with the scheduler's draining. The 
+quantum timer doesn't run while the kernel thread sleeps, so a lost wakeup 
+shows up as a poll timing out with requests still unhandled. Every submitted
+task must run exactly once.
+Prints a line per failed check, and exits with 1 if any failed */
+
+#include "driver_check.h"
+#include "uthreads.h"
+#include "remote_queue.h"
+#include <atomic>
+#include <poll.h>
+#include <pthread.h>
+
+#define QUANTUM_USECS 1000000 // long enough to never preempt the driver
+#define PRODUCERS 2
+#define PRODUCER_TASKS 50000 // submitted by each producer
+#define PRODUCER_WINDOW 512 // unhandled tasks of all producers, far below
+                           // the queue's capacity
+#define POLL_TIMEOUT_MSECS 2000
+#define QUEUE_CAPACITY 4
+
+static volatile bool resumed = false;
+static volatile int tasksRun = 0; // only changed by library threads
+static std::atomic<int> submitted(0);
+
+
+/* Returns true if the given fd is readable */
+static bool readable(int fd)
+{
+	struct pollfd wait = {fd, POLLIN, 0};
+	return poll(&wait, 1, 0) == 1;
+}
+
+/* Checks the wakeups of a queue of its own, pushing and draining it as the
+producers and the scheduler do, one step at a time */
+static void checkQueueWakeups()
+{
+	RemoteQueue queue(QUEUE_CAPACITY);
+	RemoteRequest request = {nullptr, nullptr, 1};
+	RemoteRequest popped;
+	CHECK(!readable(queue.getFd()));
+
+	CHECK(queue.push(request));
+	CHECK(queue.push(request));
+	CHECK(readable(queue.getFd()));
+	queue.clearWakeup();
+	CHECK(!readable(queue.getFd()));
+	CHECK(queue.pop(&popped) && popped.tid == 1);
+	CHECK(queue.pop(&popped));
+	CHECK(!queue.pop(&popped));
+
+	//A push after the wakeup was cleared must write again
+	request.tid = 2;
+	CHECK(queue.push(request));
+	CHECK(readable(queue.getFd()));
+	queue.clearWakeup();
+	CHECK(queue.pop(&popped) && popped.tid == 2);
+	CHECK(!readable(queue.getFd()));
+
+	//A full queue refuses pushes, and drains in order
+	for(int i = 0; i < QUEUE_CAPACITY; i++)
+	{
+		request.tid = i;
+		CHECK(queue.push(request));
+	}
+	CHECK(!queue.push(request));
+	queue.clearWakeup();
+	for(int i = 0; i < QUEUE_CAPACITY; i++)
+	{
+		CHECK(queue.pop(&popped) && popped.tid == i);
+	}
+	CHECK(!readable(queue.getFd()));
+}
+
+/* A submitted task */
+static void countTask(void* unused)
+{
+	tasksRun++;
+}
+
+/* Blocks itself until resumed from the other kernel thread */
+static void blockSelf()
+{
+	uthread_block(uthread_get_tid());
+	resumed = true;
+	for(;;)
+	{
+		uthread_yield();
+	}
+}
+
+/* The first producer: resumes the given thread */
+static void* resumeRemotely(void* tid)
+{
+	while(uthread_resume_remote(*(int*)tid) != 0)
+	{
+	}
+	return nullptr;
+}
+
+/* A producer: submits its tasks, keeping the queue from filling up */
+static void* produce(void* unused)
+{
+	for(int i = 0; i < PRODUCER_TASKS; i++)
+	{
+		while(submitted - tasksRun >= PRODUCER_WINDOW)
+		{
+		}
+		submitted++;
+		if(uthread_submit_remote(countTask, nullptr) != 0)
+		{
+			submitted--;
+			i--;
+		}
+	}
+	return nullptr;
+}
+
+/* Waits for the remote fd to become readable, and lets the scheduler drain
+the queue. Returns false if the wait timed out */
+static bool waitForRequests()
+{
+	struct pollfd wait = {uthread_remote_fd(), POLLIN, 0};
+	if(poll(&wait, 1, POLL_TIMEOUT_MSECS) != 1)
+	{
+		return false;
+	}
+	uthread_yield();
+	return true;
+}
+
+
+int main()
+{
+	checkQueueWakeups();
+
+	uthread_options options;
+	uthread_default_options(&options);
+	options.quantum_usecs = QUANTUM_USECS;
+	options.remote_tasks = 1;
+	uthread_init_options(&options);
+	int blocked = uthread_spawn(blockSelf);
+	uthread_yield();
+
+	pthread_t resumer;
+	pthread_create(&resumer, nullptr, resumeRemotely, &blocked);
+	bool timedOut = false;
+	while(!resumed && !timedOut)
+	{
+		timedOut = !waitForRequests();
+	}
+	pthread_join(resumer, nullptr);
+	CHECK(!timedOut);
+	CHECK(resumed);
+
+	pthread_t producers[PRODUCERS];
+	for(int i = 0; i < PRODUCERS; i++)
+	{
+		pthread_create(&producers[i], nullptr, produce, nullptr);
+	}
+	while(!timedOut && tasksRun < PRODUCERS * PRODUCER_TASKS)
+	{
+		timedOut = !waitForRequests();
+	}
+	CHECK(!timedOut);
+	for(int i = 0; i < PRODUCERS; i++)
+	{
+		pthread_join(producers[i], nullptr);
+	}
+	CHECK(tasksRun == PRODUCERS * PRODUCER_TASKS);
+
+	return checksResult("driver_remote");
+}
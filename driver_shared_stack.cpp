@@ -0,0 +1,113 @@
+/* Driver of the shared run stack, on growable stacks committing a single
+page at first. Two shared threads in turn recurse far past the initial
+commit, filling a buffer in every frame with a pattern of their own, and
+yield to each other at their deepest frame - so each thread's frames are
+saved and restored over the other's. Every frame's buffer must be intact
+when the recursion unwinds, and both threads must see the pages committed by
+either of them. Threads only switch by yielding (the quantum never expires),
+so every run is the same.
+Prints a line per failed check, and exits with 1 if any failed */
+
+#include "driver_check.h"
+#include "uthreads.h"
+
+#define QUANTUM_USECS 1000000 // long enough to never preempt the driver
+#define PAGE 4096
+#define STACK_MAX (1024 * 1024)
+#define DEPTH 64
+#define FRAME_BYTES 256 // of each frame's buffer
+#define YIELDS 3 // at the deepest frame
+#define SHARED_THREADS 2
+
+static int corruptFrames[SHARED_THREADS];
+static int finished = 0;
+
+
+/* Returns the byte of the pattern of the given thread, depth and offset */
+static char patternByte(int thread, int depth, int offset)
+{
+	return (char)(thread * 97 + depth * 7 + offset);
+}
+
+/* Fills a buffer in this frame, recurses to the given depth (yielding
+there), and counts this frame as corrupt if its buffer changed meanwhile */
+static void recurse(int thread, int depth)
+{
+	volatile char buffer[FRAME_BYTES];
+	for(int i = 0; i < FRAME_BYTES; i++)
+	{
+		buffer[i] = patternByte(thread, depth, i);
+	}
+
+	if(depth < DEPTH)
+	{
+		recurse(thread, depth + 1);
+	}
+	else
+	{
+		for(int i = 0; i < YIELDS; i++)
+		{
+			uthread_yield();
+		}
+	}
+
+	for(int i = 0; i < FRAME_BYTES; i++)
+	{
+		if(buffer[i] != patternByte(thread, depth, i))
+		{
+			corruptFrames[thread]++;
+			return;
+		}
+	}
+}
+
+/* A shared thread, given its index */
+static void runShared(void* thread)
+{
+	recurse(*(int*)thread, 0);
+	finished++;
+}
+
+
+int main()
+{
+	uthread_options options;
+	uthread_default_options(&options);
+	options.quantum_usecs = QUANTUM_USECS;
+	options.stack_mode = UTHREAD_STACK_GROWABLE;
+	options.stack_commit = PAGE;
+	options.stack_max = STACK_MAX;
+	CHECK(uthread_init_options(&options) == 0);
+
+	uthread_attr attr;
+	uthread_attr_init(&attr);
+	attr.shared_stack = 1;
+	int indices[SHARED_THREADS] = {0, 1};
+	int tids[SHARED_THREADS];
+	for(int i = 0; i < SHARED_THREADS; i++)
+	{
+		tids[i] = uthread_spawn_attr(runShared, &indices[i], &attr);
+		CHECK(tids[i] > 0);
+	}
+
+	//The first thread grows the stack, then both are at their deepest frame
+	uthread_yield();
+	uthread_yield();
+	uthread_stats stats;
+	for(int i = 0; i < SHARED_THREADS; i++)
+	{
+		CHECK(uthread_get_stats(tids[i], &stats) == 0);
+		CHECK(stats.stack_committed > DEPTH * FRAME_BYTES);
+	}
+
+	while(finished < SHARED_THREADS)
+	{
+		uthread_yield();
+	}
+	for(int i = 0; i < SHARED_THREADS; i++)
+	{
+		CHECK(corruptFrames[i] == 0);
+	}
+
+	return checksResult("driver_shared_stack");
+}
@@ -0,0 +1,109 @@
+/* Driver of the simulation mode. Runs the same program of yielding,
+sleeping and preemption points in simulated runtimes (each on a kernel
+thread of its own), logging which thread passes each point, and checks that
+runs with the same seed make the same scheduling decisions, that another
+seed makes different ones, and that the workload completes in each.
+Prints a line per failed check, and exits with 1 if any failed */
+
+#include "driver_check.h"
+#include "uthreads.h"
+#include <pthread.h>
+#include <vector>
+
+#define WORKERS 4
+#define STEPS 200 // preemption points passed by each worker
+#define PREEMPT_ODDS 3
+
+
+/* The log of a run, and its number of unfinished workers */
+struct SimRun
+{
+	unsigned int seed;
+	std::vector<int> log;
+	int liveWorkers;
+	int totalQuantums;
+};
+
+static thread_local SimRun* run;
+
+
+/* Passes the worker's steps, logging each. Every few steps it sleeps or
+yields, otherwise it may be preempted */
+static void work(void* unused)
+{
+	for(int step = 0; step < STEPS; step++)
+	{
+		run -> log.push_back(uthread_get_tid());
+		if(step % 50 == 49)
+		{
+			uthread_sleep(2);
+		}
+		else if(step % 7 == 6)
+		{
+			uthread_yield();
+		}
+		else
+		{
+			uthread_sim_point();
+		}
+	}
+	run -> liveWorkers--;
+}
+
+/* Runs the program in a simulated runtime of the calling kernel thread */
+static void* simulate(void* simRun)
+{
+	run = (SimRun*)simRun;
+	uthread_options options;
+	uthread_default_options(&options);
+	options.sim_mode = 1;
+	options.sim_seed = run -> seed;
+	options.sim_preempt_odds = PREEMPT_ODDS;
+	if(uthread_init_options(&options) != 0)
+	{
+		return nullptr;
+	}
+
+	run -> liveWorkers = WORKERS;
+	for(int i = 0; i < WORKERS; i++)
+	{
+		uthread_spawn_arg(work, nullptr);
+	}
+	//The main thread ticks until the workers are done, so sleepers wake up
+	//even if all workers sleep
+	while(run -> liveWorkers > 0)
+	{
+		run -> log.push_back(uthread_get_tid());
+		uthread_sim_tick();
+	}
+	run -> totalQuantums = uthread_get_total_quantums();
+	return nullptr;
+}
+
+/* Runs the program with the given seed into run */
+static void simulateOnKernelThread(SimRun* simRun, unsigned int seed)
+{
+	simRun -> seed = seed;
+	simRun -> liveWorkers = -1;
+	pthread_t kernelThread;
+	pthread_create(&kernelThread, nullptr, simulate, simRun);
+	pthread_join(kernelThread, nullptr);
+}
+
+
+int main()
+{
+	SimRun first, replay, other;
+	simulateOnKernelThread(&first, 1);
+	simulateOnKernelThread(&replay, 1);
+	simulateOnKernelThread(&other, 2);
+
+	CHECK(first.liveWorkers == 0);
+	CHECK(first.log.size() >= WORKERS * STEPS);
+	CHECK(first.log == replay.log);
+	CHECK(first.totalQuantums == replay.totalQuantums);
+	CHECK(other.liveWorkers == 0);
+	CHECK(first.log != other.log);
+
+	return checksResult("driver_sim");
+}
@@ -0,0 +1,137 @@
+/* implemenation of the remote_queue header */
+
+#include "remote_queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+
+/* Creates a queue of at least capacity requests, and its eventfd. Exits the
+process if the eventfd can't be created. Throws exception if the slots can't
+be allocated */
+RemoteQueue::RemoteQueue(int capacity)
+{
+	uint64_t size = 1;
+	while(size < (uint64_t)capacity)
+	{
+		size <<= 1;
+	}
+	
+	_slots = new(std::nothrow) RemoteSlot[size];
+	if(_slots == nullptr)
+	{
+		throw "can't allocate remote queue";
+	}
+	for(uint64_t i = 0; i < size; i++)
+	{
+		_slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	_mask = size - 1;
+	_head = 0;
+	_tail.store(0, std::memory_order_relaxed);
+	_wakeupPending.store(false, std::memory_order_relaxed);
+	
+	_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(_fd == FUNCTION_FAIL)
+	{
+		fprintf(stderr, "system error: Can't create eventfd\n");
+		exit(1);
+	}
+}
+
+
+RemoteQueue::~RemoteQueue()
+{
+	close(_fd);
+	delete[] _slots;
+}
+
+
+/* Adds a request to the queue, and wakes up the eventfd if it was drained.
+Returns false if the queue is full. May be called by any kernel thread and
+by signal handlers */
+bool RemoteQueue::push(const RemoteRequest& request)
+{
+	uint64_t tail = _tail.load(std::memory_order_relaxed);
+	RemoteSlot* slot;
+	while(true)
+	{
+		slot = &_slots[tail & _mask];
+		uint64_t sequence = slot -> sequence.load(std::memory_order_acquire);
+		int64_t lag = (int64_t)(sequence - tail);
+		if(lag == 0)
+		{
+			//the slot is free - claiming it, unless another producer did
+			if(_tail.compare_exchange_weak(tail, tail + 1, 
+			                               std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if(lag < 0)
+		{
+			return false; //the slot still holds a request of the last round
+		}
+		else
+		{
+			tail = _tail.load(std::memory_order_relaxed);
+		}
+	}
+	
+	slot -> request = request;
+	slot -> sequence.store(tail + 1, std::memory_order_release);
+	
+	if(!_wakeupPending.exchange(true, std::memory_order_acq_rel))
+	{
+		//A failed write means the counter is full, which can't lose a 
+		//request, as the scheduler drains the queue anyway
+		uint64_t one = 1;
+		ssize_t written = write(_fd, &one, sizeof(one));
+		(void)written;
+	}
+	return true;
+}
+
+
+/* Removes the next published request into request. Returns false if there
+is none. A request still being filled by its producer ends the drain, and 
+is popped by the next one. Must only be called by the scheduler */
+bool RemoteQueue::pop(RemoteRequest* request)
+{
+	RemoteSlot* slot = &_slots[_head & _mask];
+	if(slot -> sequence.load(std::memory_order_acquire) != _head + 1)
+	{
+		return false;
+	}
+	
+	*request = slot -> request;
+	slot -> sequence.store(_head + _mask + 1, std::memory_order_release);
+	_head++;
+	return true;
+}
+
+
+/* Resets the eventfd before the queue is drained, so that a request pushed
+from now on wakes it up again. Must only be called by the scheduler */
+void RemoteQueue::clearWakeup()
+{
+	if(!_wakeupPending.load(std::memory_order_relaxed))
+	{
+		return;
+	}
+	
+	//The eventfd is read before the flag is cleared. A producer pushing in
+	//between sees the flag still set and doesn't write, but its request is
+	//published before its exchange, which the exchange below synchronizes 
+	//with, so the drain that follows pops it. Clearing first would let such
+	//a producer's write be swallowed by the read, leaving the flag set with 
+	//nothing to read, and no later push would write again. A producer which
+	//set the flag may not have written yet, in which case there is nothing 
+	//to read, and the eventfd is woken up spuriously later
+	uint64_t count;
+	ssize_t bytesRead = read(_fd, &count, sizeof(count));
+	(void)bytesRead;
+	_wakeupPending.exchange(false, std::memory_order_acq_rel);
+}
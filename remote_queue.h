@@ -0,0 +1,61 @@
+/*This module holds the queue of requests made to the uthreads library from
+outside of its threads - by other kernel threads, or by signal handlers */
+
+#ifndef _REMOTE_QUEUE_
+#define _REMOTE_QUEUE_
+
+#include <atomic>
+#include <stdint.h>
+
+#include "uthreads.h"
+#include "general_macros.h"
+
+
+/* A single remote request: a task to post (if fn isn't null), or otherwise
+the id of a thread to resume */
+struct RemoteRequest
+{
+	void (*fn)(void*);
+	void* arg;
+	int tid;
+};
+
+/* A slot of the queue. Its sequence number tells the producers and the 
+consumer whose turn it is to use the slot */
+struct RemoteSlot
+{
+	std::atomic<uint64_t> sequence;
+	RemoteRequest request;
+};
+
+
+/* This class is a bounded lock-free queue of remote requests, with many 
+producers and a single consumer (the scheduler). A producer claims a slot by
+a compare and swap on the tail, fills it, and publishes it by advancing the
+slot's sequence number, so pushing never blocks and never allocates memory,
+and is safe in signal handlers. The capacity is rounded up to a power of two
+so that a slot is found by masking.
+The queue also holds an eventfd, which becomes readable when requests are 
+pushed, so that a thread waiting for I/O can wait for requests too. Only the
+first push after the consumer drained the queue writes to it. */
+class RemoteQueue
+{
+public:
+	RemoteQueue(int capacity);
+	~RemoteQueue();
+	bool push(const RemoteRequest& request);
+	bool pop(RemoteRequest* request);
+	void clearWakeup();
+	int getFd(){ return _fd; }
+	
+private:
+	RemoteSlot* _slots;
+	uint64_t _mask;
+	int _fd;
+	uint64_t _head; // only used by the consumer
+	std::atomic<bool> _wakeupPending;
+	char _padding[64]; // keeping the producers' tail off the consumer's line
+	std::atomic<uint64_t> _tail;
+};
+
+#endif
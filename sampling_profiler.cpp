@@ -0,0 +1,258 @@
+/* implementation of the sampling_profiler header */
+
+#include "sampling_profiler.h"
+#include "general_macros.h"
+#include <assert.h>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <map>
+#include <new>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+/* Older C libraries only name the thread id of SIGEV_THREAD_ID through the
+sigevent's union */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+using namespace std;
+
+
+/* Returns the address of the instruction the signal of the given context
+interrupted */
+static void* interruptedPc(void* context)
+{
+	ucontext_t* interrupted = (ucontext_t*)context;
+#ifdef __x86_64__
+	return (void*)interrupted -> uc_mcontext.gregs[REG_RIP];
+#else
+	return (void*)interrupted -> uc_mcontext.gregs[REG_EIP];
+#endif
+}
+
+
+/* Creates a profiler holding at least capacity samples, and starts its
+timer, which sends SIGPROF every usecs micro-seconds of the calling kernel
+thread's CPU time. Throws exception if the ring can't be allocated or the
+timer can't be created */
+Profiler::Profiler(int usecs, int capacity)
+{
+	assert(usecs > 0 && capacity > 0);
+
+	uint64_t size = 1;
+	while(size < (uint64_t)capacity)
+	{
+		size <<= 1;
+	}
+
+	_samples = new(std::nothrow) ProfileSample[size];
+	if(_samples == nullptr)
+	{
+		fprintf(stderr, "system error: Can't allocate profile samples\n");
+		throw "can't allocate profile samples";
+	}
+	_mask = size - 1;
+	_head = 0;
+
+	//The first backtrace loads the unwinder, which mustn't happen in the
+	//signal handler
+	void* first;
+	backtrace(&first, 1);
+
+	struct sigevent event = {};
+	event.sigev_notify = SIGEV_THREAD_ID;
+	event.sigev_signo = SIGPROF;
+	event.sigev_notify_thread_id = syscall(SYS_gettid);
+
+	struct itimerspec interval = {};
+	interval.it_value.tv_sec = usecs / 1000000;
+	interval.it_value.tv_nsec = (usecs % 1000000) * 1000;
+	interval.it_interval = interval.it_value;
+
+	if(timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &_timer) != 0)
+	{
+		delete[] _samples;
+		fprintf(stderr, "system error: Can't create profiling timer\n");
+		throw "can't create profiling timer";
+	}
+	if(timer_settime(_timer, 0, &interval, NULL) != 0)
+	{
+		timer_delete(_timer);
+		delete[] _samples;
+		fprintf(stderr, "system error: Can't set profiling timer\n");
+		throw "can't set profiling timer";
+	}
+	_timing = true;
+}
+
+
+/* Stops the timer and frees the samples */
+Profiler::~Profiler()
+{
+	stop();
+	delete[] _samples;
+}
+
+
+/* Stops the timer. The samples are kept for dumping */
+void Profiler::stop()
+{
+	if(_timing)
+	{
+		timer_delete(_timer);
+		_timing = false;
+	}
+}
+
+
+/* Records a sample of the given thread, from the context of the SIGPROF
+signal which interrupted it. Runs in the signal handler, so it only fills a
+preallocated slot. The frames above the interrupted one (of the handler and
+the unwinder) are dropped. Code interrupted while SIGVTALRM was masked was
+inside the library's critical section, possibly in the middle of a switch
+between stacks, so it isn't unwound and the sample is recorded without
+frames */
+void Profiler::record(int tid, void* entry, void* context)
+{
+	ProfileSample& sample = _samples[_head & _mask];
+	_head++;
+	sample.tid = tid;
+	sample.entry = entry;
+	sample.depth = 0;
+	if(sigismember(&((ucontext_t*)context) -> uc_sigmask, SIGVTALRM) == 1)
+	{
+		return;
+	}
+
+	void* frames[PROFILE_HANDLER_FRAMES + PROFILE_MAX_DEPTH];
+	int depth = backtrace(frames, PROFILE_HANDLER_FRAMES + PROFILE_MAX_DEPTH);
+	void* pc = interruptedPc(context);
+	int first = 0;
+	while(first < depth && frames[first] != pc)
+	{
+		first++;
+	}
+
+	//Without the interrupted frame in the backtrace, only it is kept
+	if(first == depth)
+	{
+		sample.frames[0] = pc;
+		sample.depth = 1;
+		return;
+	}
+	sample.depth = min(depth - first, PROFILE_MAX_DEPTH);
+	memcpy(sample.frames, frames + first, sample.depth * sizeof(void*));
+}
+
+
+/* Writes the recorded samples to the given file as folded stacks: a line
+per distinct stack, its frames from the outermost separated by semicolons,
+followed by the number of samples taken in it. Each stack is rooted at the
+thread it was sampled in ("uthread <id>"), or at the entry function the
+thread was spawned with, as set by group. Samples taken inside the library's
+critical section end at a "[uthread library]" frame. Returns 0 on success,
+-1 on a write error */
+int Profiler::dumpFolded(FILE* out, uthread_profile_group group)
+{
+	uint64_t first = _head > _mask + 1 ? _head - (_mask + 1) : 0;
+	map<string, long> stacks;
+	string stack;
+
+	for(uint64_t i = first; i < _head; i++)
+	{
+		const ProfileSample& sample = _samples[i & _mask];
+		if(group == UTHREAD_PROFILE_BY_THREAD)
+		{
+			stack = "uthread " + to_string(sample.tid);
+		}
+		else
+		{
+			stack = sample.entry == nullptr ? "main thread" :
+			                                  nameOf(sample.entry);
+		}
+
+		if(sample.depth == 0)
+		{
+			stack += ";[uthread library]";
+		}
+		for(int j = sample.depth - 1; j >= 0; j--)
+		{
+			//A return address is past its call, which may end its function
+			void* address = sample.frames[j];
+			if(j > 0)
+			{
+				address = (char*)address - 1;
+			}
+			stack += ';';
+			stack += nameOf(address);
+		}
+		stacks[stack]++;
+	}
+
+	for(const auto& counted : stacks)
+	{
+		fprintf(out, "%s %ld\n", counted.first.c_str(), counted.second);
+	}
+
+	if(ferror(out))
+	{
+		return FUNCTION_FAIL;
+	}
+	return FUNCTION_SUCCESS;
+}
+
+
+/* Returns the name of the function holding the given code address: its
+demangled symbol, if the dynamic symbol table has it (executables export
+their functions when linked with -rdynamic), and otherwise the file it is
+in with its offset. Semicolons, which separate folded frames, are replaced.
+Names are cached by address */
+const string& Profiler::nameOf(void* address)
+{
+	auto found = _names.find(address);
+	if(found != _names.end())
+	{
+		return found -> second;
+	}
+
+	string name;
+	Dl_info info;
+	if(dladdr(address, &info) != 0 && info.dli_sname != nullptr)
+	{
+		int status;
+		char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr,
+		                                      nullptr, &status);
+		name = status == 0 ? demangled : info.dli_sname;
+		free(demangled);
+	}
+	else
+	{
+		char offset[2 * sizeof(void*) + 4];
+		const char* file = "";
+		char* base = nullptr;
+		if(dladdr(address, &info) != 0 && info.dli_fname != nullptr)
+		{
+			const char* slash = strrchr(info.dli_fname, '/');
+			file = slash == nullptr ? info.dli_fname : slash + 1;
+			base = (char*)info.dli_fbase;
+		}
+		snprintf(offset, sizeof(offset), "+0x%lx",
+		         (unsigned long)((char*)address - base));
+		name = string(file) + offset;
+	}
+
+	for(char& c : name)
+	{
+		if(c == ';')
+		{
+			c = ':';
+		}
+	}
+	return _names[address] = name;
+}
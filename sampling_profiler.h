@@ -0,0 +1,68 @@
+/* This module holds the library's sampling profiler: a CPU time timer of the
+runtime's kernel thread sends it SIGPROF, and the handler records the running
+uthread, the entry function it was spawned with and the backtrace of the
+interrupted code into a preallocated ring of samples, which can be dumped as
+folded stacks (the input of flamegraph.pl, speedscope and inferno) */
+
+#ifndef _SAMPLING_PROFILER_
+#define _SAMPLING_PROFILER_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <unordered_map>
+
+#include "uthreads.h"
+
+
+/* The deepest backtrace a sample keeps, counting from the interrupted
+frame */
+#define PROFILE_MAX_DEPTH 48
+
+/* The frames of the signal handler and of the unwinder above the
+interrupted frame, which a backtrace may take in addition to the kept ones */
+#define PROFILE_HANDLER_FRAMES 8
+
+
+/* A single sample: the running thread, its entry function (null for the
+main thread) and the return addresses of its backtrace, innermost first (the
+first is the interrupted instruction itself) */
+struct ProfileSample
+{
+	int32_t tid;
+	int32_t depth;
+	void* entry;
+	void* frames[PROFILE_MAX_DEPTH];
+};
+
+
+/* This class wraps the profiler's timer and its ring of samples. Samples
+are recorded by the SIGPROF handler of the runtime's kernel thread, so the
+ring needs no locks as long as the signal is blocked while it is dumped. The
+capacity is rounded up to a power of two, and once the ring is full the
+oldest samples are overwritten. The timer counts the CPU time of the kernel
+thread which created the profiler, as the quantum timer does. Throws
+exception if the ring can't be allocated */
+class Profiler
+{
+public:
+	Profiler(int usecs, int capacity);
+	~Profiler();
+	void record(int tid, void* entry, void* context);
+	void stop();
+	int dumpFolded(FILE* out, uthread_profile_group group);
+
+private:
+	ProfileSample* _samples;
+	uint64_t _mask;
+	uint64_t _head;
+	timer_t _timer;
+	bool _timing;
+	std::unordered_map<void*, std::string> _names; // symbols found by dumps
+
+	const std::string& nameOf(void* address);
+};
+
+
+#endif
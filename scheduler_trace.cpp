@@ -0,0 +1,136 @@
+/* implementation of the scheduler_trace header */
+
+#include "scheduler_trace.h"
+#include <assert.h>
+
+using namespace std;
+
+thread_local TraceBuffer* traceBuffer = nullptr;
+
+static const char* eventNames[] = {"spawn", "running", "running", "block",
+	"resume", "sleep", "wake", "terminate", "signal"};
+static const char* switchReasonNames[] = {"preempted", "blocked", "slept",
+	"terminated", "initialized", "yielded"};
+
+
+/* Creates a buffer holding at least capacity events. Throws exception if
+the buffer can't be allocated */
+TraceBuffer::TraceBuffer(int capacity)
+{
+	assert(capacity > 0);
+	
+	uint64_t size = 1;
+	while(size < (uint64_t)capacity)
+	{
+		size <<= 1;
+	}
+	
+	_events = new(std::nothrow) TraceEvent[size];
+	if(_events == nullptr)
+	{
+		fprintf(stderr, "system error: Can't allocate trace buffer\n");
+		throw "can't allocate trace buffer";
+	}
+	
+	_mask = size - 1;
+	_head.store(0);
+}
+
+
+/* Writes the recorded events, oldest first, as a Chrome trace JSON to the 
+given file. Each thread gets its own track, on which the time it spent 
+running is drawn as a slice (its end labeled with the reason of the switch),
+and the other events as instants. Timestamps are converted to micro-seconds
+using the given factor. Returns 0 on success, -1 on a write error. */
+int TraceBuffer::dumpChromeTrace(FILE* out, double cyclesPerUsec)
+{
+	uint64_t head = _head.load(std::memory_order_acquire);
+	uint64_t first = head > _mask + 1 ? head - (_mask + 1) : 0;
+	bool running[MAX_THREAD_NUM] = {false};
+	bool seen[MAX_THREAD_NUM] = {false};
+	uint64_t baseCycles = head > first ? _events[first & _mask].cycles : 0;
+	double lastTs = 0;
+	bool firstRecord = true;
+	
+	//Returns the text separating a record from the one before it
+	auto separator = [&firstRecord]()
+	{
+		const char* text = firstRecord ? "" : ",\n";
+		firstRecord = false;
+		return text;
+	};
+	
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	
+	for(uint64_t i = first; i < head; i++)
+	{
+		const TraceEvent& event = _events[i & _mask];
+		if(event.tid < 0 || event.tid >= MAX_THREAD_NUM)
+		{
+			continue;
+		}
+		
+		double ts = (event.cycles - baseCycles) / cyclesPerUsec;
+		lastTs = ts;
+		seen[event.tid] = true;
+		
+		switch(event.type)
+		{
+			case TRACE_SWITCH_IN:
+				running[event.tid] = true;
+				fprintf(out, "%s{\"name\":\"running\",\"ph\":\"B\",\"pid\":1,"\
+				"\"tid\":%d,\"ts\":%.3f}", separator(), event.tid, ts);
+				break;
+				
+			case TRACE_SWITCH_OUT:
+				//Events that started before the oldest kept event are dropped
+				if(!running[event.tid])
+				{
+					break;
+				}
+				running[event.tid] = false;
+				fprintf(out, "%s{\"name\":\"running\",\"ph\":\"E\",\"pid\":1,"\
+				"\"tid\":%d,\"ts\":%.3f,\"args\":{\"reason\":\"%s\"}}", 
+				separator(), event.tid, ts, switchReasonNames[event.arg]);
+				break;
+				
+			default:
+				//A thread terminating itself ends its running slice
+				if(event.type == TRACE_TERMINATE && running[event.tid])
+				{
+					running[event.tid] = false;
+					fprintf(out, "%s{\"name\":\"running\",\"ph\":\"E\","\
+					"\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"reason\":"\
+					"\"terminated\"}}", separator(), event.tid, ts);
+				}
+				fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\","\
+				"\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"arg\":%d}}",
+				separator(), eventNames[event.type], event.tid, ts, event.arg);
+				break;
+		}
+	}
+	
+	//Closing slices of threads that are still running, and naming tracks
+	for(int tid = 0; tid < MAX_THREAD_NUM; tid++)
+	{
+		if(running[tid])
+		{
+			fprintf(out, "%s{\"name\":\"running\",\"ph\":\"E\",\"pid\":1,"\
+			"\"tid\":%d,\"ts\":%.3f}", separator(), tid, lastTs);
+		}
+		if(seen[tid])
+		{
+			fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"\
+			"\"tid\":%d,\"args\":{\"name\":\"uthread %d\"}}", separator(), 
+			tid, tid);
+		}
+	}
+	
+	fprintf(out, "\n]}\n");
+	
+	if(ferror(out))
+	{
+		return FUNCTION_FAIL;
+	}
+	return FUNCTION_SUCCESS;
+}
@@ -0,0 +1,73 @@
+/* This module holds the scheduler's event trace: a fixed-size binary ring
+buffer of scheduling events, which can be dumped on demand in the Chrome trace
+JSON format (which is also read by the Perfetto UI) */
+
+#ifndef _SCHEDULER_TRACE_
+#define _SCHEDULER_TRACE_
+
+#include <atomic>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "thread_classes.h"
+
+
+enum TraceEventType{TRACE_SPAWN,TRACE_SWITCH_IN,TRACE_SWITCH_OUT,TRACE_BLOCK,
+	TRACE_RESUME,TRACE_SLEEP,TRACE_WAKE,TRACE_TERMINATE,TRACE_SIGNAL};
+
+/* A single recorded event. The argument's meaning depends on the type - the
+switch reason for TRACE_SWITCH_OUT, the signal number for TRACE_SIGNAL and 
+the number of quantums for TRACE_SLEEP */
+struct TraceEvent
+{
+	uint64_t cycles;
+	int32_t tid;
+	uint16_t type;
+	uint16_t arg;
+};
+
+
+/* This class wraps the ring buffer of trace events. Recording is lock free:
+each writer claims a slot with a single atomic increment, and once the buffer
+is full the oldest events are overwritten. The capacity is rounded up to a 
+power of two so that a slot is found by masking. */
+class TraceBuffer
+{
+public:
+	TraceBuffer(int capacity);
+	~TraceBuffer(){delete[] _events;}
+	void record(TraceEventType type, int tid, int arg)
+	{
+		uint64_t slot = _head.fetch_add(1, std::memory_order_relaxed);
+		TraceEvent& event = _events[slot & _mask];
+		event.cycles = readCycles();
+		event.tid = tid;
+		event.type = type;
+		event.arg = arg;
+	}
+	int dumpChromeTrace(FILE* out, double cyclesPerUsec);
+	
+private:
+	TraceEvent* _events;
+	uint64_t _mask;
+	std::atomic<uint64_t> _head;
+};
+
+
+/* The active trace buffer of the calling kernel thread's runtime, or null 
+when tracing is off */
+extern thread_local TraceBuffer* traceBuffer;
+
+
+/* Records an event in the active trace buffer, if tracing is on */
+inline void traceEvent(TraceEventType type, int tid, int arg=0)
+{
+	TraceBuffer* buffer = traceBuffer;
+	if(buffer != nullptr)
+	{
+		buffer -> record(type, tid, arg);
+	}
+}
+
+
+#endif
@@ -0,0 +1,91 @@
+/* implementation of the stats_segment header */
+
+#include "stats_segment.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+/* Creates the shared memory object of the given name (replacing one of the
+same name, which readers may still have mapped), sized for maxThreads
+records, and maps it. The records are all free and the totals are zero until
+the first publication. Throws exception if the object can't be created,
+sized or mapped */
+StatsSegment::StatsSegment(const char* name, int maxThreads,
+                           double cyclesPerUsec):_name(name)
+{
+	_size = statsSegmentSize(maxThreads);
+
+	shm_unlink(name);
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if(fd == -1)
+	{
+		throw "can't create stats segment";
+	}
+	if(ftruncate(fd, _size) != 0)
+	{
+		close(fd);
+		shm_unlink(name);
+		throw "can't size stats segment";
+	}
+	void* segment = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                     fd, 0);
+	close(fd);
+	if(segment == MAP_FAILED)
+	{
+		shm_unlink(name);
+		throw "can't map stats segment";
+	}
+
+	_header = (StatsHeader*)segment;
+	_records = statsRecords(segment);
+	for(int tid = 0; tid < maxThreads; tid++)
+	{
+		_records[tid].data.tid = STATS_NO_THREAD;
+	}
+	_header -> pid = getpid();
+	_header -> maxThreads = maxThreads;
+	_header -> cyclesPerUsec = cyclesPerUsec;
+	_header -> version = STATS_SEGMENT_VERSION;
+	//Readers check the magic last, so a header they accept is complete
+	atomic_thread_fence(memory_order_release);
+	_header -> magic = STATS_SEGMENT_MAGIC;
+}
+
+
+/* Marks the totals closed, then unmaps and unlinks the segment */
+StatsSegment::~StatsSegment()
+{
+	beginTotals() -> closed = 1;
+	endTotals();
+	munmap(_header, _size);
+	shm_unlink(_name.c_str());
+}
+
+
+/* Starts writing the totals, returning them to be filled in place until 
+endTotals is called */
+StatsTotals* StatsSegment::beginTotals()
+{
+	seqlockBegin(_header -> seq);
+	return &_header -> totals;
+}
+
+
+/* Starts writing the record of the given thread id, returning its stats to
+be filled in place until endThread is called */
+StatsThreadData* StatsSegment::beginThread(int tid)
+{
+	seqlockBegin(_records[tid].seq);
+	return &_records[tid].data;
+}
+
+
+/* Frees the record of the given thread id */
+void StatsSegment::clearThread(int tid)
+{
+	beginThread(tid) -> tid = STATS_NO_THREAD;
+	endThread(tid);
+}
@@ -0,0 +1,155 @@
+/* This module holds the live stats segment: a POSIX shared memory object to
+which a runtime publishes its totals and a record per thread id, so that
+another process (uthread-top) can watch it without stopping, signalling or
+tracing it. Every record is guarded by a sequence lock - the single writer
+makes its sequence odd while it writes, and a reader copies the record and
+retries if the sequence was odd or changed meanwhile - so the writer never
+waits for readers, and readers never see a torn record */
+
+#ifndef _STATS_SEGMENT_
+#define _STATS_SEGMENT_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+
+/* Identifies a segment of this layout, and its version */
+#define STATS_SEGMENT_MAGIC 0x706f7475 // "utop"
+#define STATS_SEGMENT_VERSION 1
+
+/* The thread id of a record of an id which isn't in use */
+#define STATS_NO_THREAD -1
+
+/* The names of the states published in the records, indexed by the State
+enum of thread_classes.h */
+static const char* const STATS_STATE_NAMES[] = {"SLEEPING", "READY",
+                                                "RUNNING", "BLOCKED"};
+#define NUM_STATS_STATES 4
+
+
+/* The totals of the runtime, as of its last publication */
+struct StatsTotals
+{
+	int32_t liveThreads; // including the main thread
+	int32_t readyLength;
+	int32_t sleepers;
+	int32_t runningTid;
+	int64_t totalQuantums;
+	uint64_t voluntarySwitches;
+	uint64_t involuntarySwitches;
+	uint64_t threadsSpawned;
+	uint64_t threadsTerminated;
+	uint64_t publishedNsecs; // CLOCK_MONOTONIC time of the publication
+	int32_t closed; // set once the runtime stops publishing
+	int32_t padding;
+};
+
+/* The published stats of a single thread */
+struct StatsThreadData
+{
+	int32_t tid; // STATS_NO_THREAD if the id isn't in use
+	int32_t state;
+	int32_t quantums;
+	int32_t padding;
+	uint64_t voluntarySwitches;
+	uint64_t involuntarySwitches;
+	uint64_t runCycles;
+};
+
+/* The start of the segment, written once when it is created, followed by
+the totals */
+struct StatsHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	int32_t pid;
+	int32_t maxThreads; // the number of records following the header
+	double cyclesPerUsec; // of the cycle counter the run cycles are taken of
+	std::atomic<uint32_t> seq;
+	StatsTotals totals;
+};
+
+/* A thread's record, at the index of its id */
+struct StatsRecord
+{
+	std::atomic<uint32_t> seq;
+	StatsThreadData data;
+};
+
+
+/* Returns the size of a segment holding the given number of records */
+inline size_t statsSegmentSize(int maxThreads)
+{
+	return sizeof(StatsHeader) + maxThreads * sizeof(StatsRecord);
+}
+
+/* Returns the records of the segment at the given address */
+inline StatsRecord* statsRecords(void* segment)
+{
+	return (StatsRecord*)((char*)segment + sizeof(StatsHeader));
+}
+
+/* Starts a write under the sequence lock seq, making it odd. There must be
+a single writer */
+inline void seqlockBegin(std::atomic<uint32_t>& seq)
+{
+	seq.store(seq.load(std::memory_order_relaxed) + 1, 
+	          std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+/* Ends a write started by seqlockBegin, making seq even again */
+inline void seqlockEnd(std::atomic<uint32_t>& seq)
+{
+	seq.store(seq.load(std::memory_order_relaxed) + 1, 
+	          std::memory_order_release);
+}
+
+/* Copies source, guarded by the sequence lock seq, to copy, retrying until
+the copy wasn't written meanwhile */
+template<typename T>
+inline void seqlockRead(const std::atomic<uint32_t>& seq, const T* source,
+                        T* copy)
+{
+	uint32_t start;
+	do
+	{
+		start = seq.load(std::memory_order_acquire);
+		memcpy(copy, source, sizeof(T));
+		std::atomic_thread_fence(std::memory_order_acquire);
+	}
+	while((start & 1) != 0 || seq.load(std::memory_order_relaxed) != start);
+}
+
+
+/* This class wraps a live stats segment, as the runtime publishing to it
+holds it. The segment is created (replacing any object of the same name)
+with all records free, and is unlinked when the object is deleted, after
+the totals are marked closed - readers which mapped it keep their mapping.
+The totals and the records are written in place, between a begin and an end
+call, as publishing runs in the scheduler, on the stack of the thread being
+switched out. Throws exception if the segment can't be created or mapped */
+class StatsSegment
+{
+public:
+	StatsSegment(const char* name, int maxThreads, double cyclesPerUsec);
+	~StatsSegment();
+	StatsTotals* beginTotals();
+	void endTotals(){ seqlockEnd(_header -> seq); }
+	StatsThreadData* beginThread(int tid);
+	void endThread(int tid){ seqlockEnd(_records[tid].seq); }
+	void clearThread(int tid);
+	bool holds(int tid){ return _records[tid].data.tid != STATS_NO_THREAD; }
+
+private:
+	std::string _name;
+	StatsHeader* _header;
+	StatsRecord* _records;
+	size_t _size;
+};
+
+
+#endif
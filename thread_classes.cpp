@@ -1,7 +1,19 @@
 /* implemenation of the thread_classes header */
 
 #include "thread_classes.h"
+#include "scheduler_trace.h"
 #include <assert.h>
+#include <algorithm>
+#include <new>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <string.h>
+
+/* Older C libraries only name the thread id of SIGEV_THREAD_ID through the
+sigevent's union */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
 
 #define NDEBUG
 
@@ -48,18 +60,46 @@ address_t translate_address(address_t addr)
 #endif
 
 
-/*Thread constructor for main thread. Throws exception if stack can't be 
+/* Allocates a zeroed thread table aligned to a cache line. Throws exception
+if the memory can't be allocated */
+void* ThreadTable::operator new(size_t size)
+{
+	void* table;
+	if(posix_memalign(&table, CACHE_LINE_SIZE, size) != 0)
+	{
+		throw "Can't allocate thread table";
+	}
+	memset(table, 0, size);
+	return table;
+}
+
+
+/*Thread constructor for main thread. Throws exception if stack can't be
 allocated*/
 
-Thread::Thread(int id)
+Thread::Thread(int id, ThreadTable* table, StackAllocator* stacks)
 {
+	_stacks = stacks;
+	_table = table;
 	_id = id;
-	_quantumsTillWakeup = NOT_SLEEPING;
-	_quantumRuntime = 0;
-	_state = READY;
+	_table -> quantumsTillWakeup[_id] = NOT_SLEEPING;
+	_table -> quantumRuntime[_id] = 0;
+	_table -> states[_id] = READY;
+	_context = UTHREAD_CONTEXT_FULL;
+	saveFpuControl(&_fpuControl);
+	_entry = nullptr;
+	_arg = nullptr;
+	_next = nullptr;
+	_prev = nullptr;
+	_list = nullptr;
+	initStats();
+	clearSlots();
+	clearArena();
+	_generator = nullptr;
+	initFrames(nullptr);
 	try
 	{
-		_SP = getNewStack();	
+		_stack = _stacks -> allocate();	
 	}
 	catch(const char* e)
 	{
@@ -71,25 +111,142 @@ Thread::Thread(int id)
 /*Thread constructor for new threads. Throws exception if stack can't be 
 allocated*/
 
-Thread::Thread(int id, void (*f)(void))
+Thread::Thread(int id, ThreadTable* table, StackAllocator* stacks, 
+               void (*entry)(void*), void* arg, size_t storageSize)
 {
-	_id = id;
-	_quantumsTillWakeup = NOT_SLEEPING;
-	_quantumRuntime = 0;
-	_state = READY;
+	_stacks = stacks;
+	_table = table;
+	_next = nullptr;
+	_prev = nullptr;
+	_list = nullptr;
+	initFrames(nullptr);
 	
 	try
 	{
-		_SP = getNewStack();	
+		_stack = _stacks -> allocate();	
 	}
 	catch(const char* e)
 	{
 		throw e;		
 	}
 
-	//setting up first thread environment
-	address_t sp = (address_t)_SP + STACK_SIZE - sizeof(address_t);
-	address_t pc = (address_t)f;
+	reset(id, entry, arg, storageSize);
+}
+
+
+/*Constructor of an unused thread object (for the thread pool), which takes 
+an already allocated stack*/
+
+Thread::Thread(ThreadTable* table, StackAllocator* stacks, Stack stack)
+{
+	_stacks = stacks;
+	_table = table;
+	_stack = stack;
+	_next = nullptr;
+	_prev = nullptr;
+	_list = nullptr;
+	initFrames(nullptr);
+	
+	reset(NO_THREAD_ID, nullptr, nullptr, 0);
+}
+
+
+/*Constructor of a new shared thread, running on the given shared stack. 
+Throws exception if its initial frames can't be allocated*/
+
+Thread::Thread(SharedStack* shared, int id, ThreadTable* table, 
+               StackAllocator* stacks, void (*entry)(void*), void* arg)
+{
+	_stacks = stacks;
+	_table = table;
+	_stack = Stack();
+	_next = nullptr;
+	_prev = nullptr;
+	_list = nullptr;
+	initFrames(shared);
+	
+	reset(id, entry, arg, 0);
+	
+	//the initial frames are the zeroed return slot (and the color offset)
+	_framesSize = _runStack -> top() - _framesBottom;
+	_frames = (char*)calloc(1, _framesSize);
+	if(_frames == nullptr)
+	{
+		throw "Can't allocate the frames of a new thread";
+	}
+	_framesCapacity = _framesSize;
+}
+
+
+/* Releases the thread's stack, unless it is shared, and the copy of its 
+frames */
+Thread::~Thread()
+{
+	if(_shared == nullptr)
+	{
+		_stacks -> release(&_stack);
+	}
+	free(_frames);
+}
+
+
+/* Sets the thread up as a new thread with the given id, entry function and
+argument, reusing its stack (repainted, if stacks are painted). If 
+storageSize is positive, that many bytes are reserved at the top of the 
+stack (aligned to STACK_STORAGE_ALIGNMENT), and the argument is set to point
+to them. The stack starts below the color 
+offset of the id (see StackAllocator). An unused object is reset with
+NO_THREAD_ID, which leaves the thread table as it is. The thread must not be
+held by a list */
+void Thread::reset(int id, void (*entry)(void*), void* arg, 
+                   size_t storageSize)
+{
+	assert(_list == nullptr);
+	
+	if(_shared == nullptr)
+	{
+		_stacks -> repaint(&_stack);
+	}
+	_id = id;
+	if(_id != NO_THREAD_ID)
+	{
+		_table -> quantumsTillWakeup[_id] = NOT_SLEEPING;
+		_table -> quantumRuntime[_id] = 0;
+		_table -> states[_id] = READY;
+	}
+	_context = UTHREAD_CONTEXT_FULL;
+	initFpuControl(&_fpuControl);
+	_preempted = false;
+	_terminating = false;
+	_entry = entry;
+	_arg = arg;
+	initStats();
+	clearSlots();
+	clearArena();
+	_generator = nullptr;
+	
+	//reserving the storage below the colored top of the stack
+	address_t top = (address_t)_runStack -> top() - 
+	                _stacks -> colorOffset(_id);
+	if(storageSize > 0)
+	{
+		top = (top - storageSize) & ~(address_t)(STACK_STORAGE_ALIGNMENT - 1);
+		_arg = (void*)top;
+	}
+	
+	//setting up first thread environment. The return slot of the first 
+	//frame holds 0, where unwinders stop. A shared thread's slot is in its 
+	//initial frames, as the shared stack is in use
+	address_t sp = top - sizeof(address_t);
+	address_t pc = (address_t)threadTrampoline;
+	if(_shared == nullptr)
+	{
+		*(address_t*)sp = 0;
+	}
+	else
+	{
+		_framesBottom = (char*)sp;
+	}
 	
 	sigsetjmp(_env,1);
 	(_env->__jmpbuf)[JB_SP] = translate_address(sp);
@@ -99,18 +256,211 @@ Thread::Thread(int id, void (*f)(void))
 }
 
 
+/* Sets the thread's context. A new thread's context must be set before it
+first runs, as it sets whether its first switch restores the empty signal 
+mask set by reset (an integer context thread unmasks the library's signal 
+itself) */
+void Thread::setContext(uthread_context context)
+{
+	_context = context;
+	_env -> __mask_was_saved = context == UTHREAD_CONTEXT_FULL;
+}
+
+
+/* Zeroes the thread's statistics and starts accounting its current state */
+void Thread::initStats()
+{
+	_stateSince = readCycles();
+	for(int i = 0; i < NUM_STATES; i++)
+	{
+		_cyclesInState[i] = 0;
+	}
+	_voluntarySwitches = 0;
+	_involuntarySwitches = 0;
+}
+
+
+/* Resets the thread's values of all thread-local keys to null */
+void Thread::clearSlots()
+{
+	for(int i = 0; i < UTHREAD_KEYS_MAX; i++)
+	{
+		_slots[i] = nullptr;
+	}
+}
+
+
+/* Commits the uncommitted page of the thread's stack, or of the stack of 
+the generator it runs, holding the fault address, if any. Returns whether
+the address was in either stack */
+bool Thread::growStack(char* faultAddress)
+{
+	return _stacks -> grow(_runStack, faultAddress) || 
+	       (_generator != nullptr && _generator -> growStack(faultAddress));
+}
+
+
+/* Returns whether the fault address is in the guard page of the thread's 
+stack, or of the stack of the generator it runs */
+bool Thread::stackOverflowedAt(char* faultAddress)
+{
+	return _stacks -> inGuardPage(_runStack, faultAddress) || 
+	       (_generator != nullptr && 
+	        _generator -> stackOverflowedAt(faultAddress));
+}
+
+
+/* Abandons the generators the thread runs (when it terminates), which can't
+be resumed as their contexts were never saved */
+void Thread::abandonGenerators()
+{
+	while(_generator != nullptr)
+	{
+		Generator* generator = _generator;
+		_generator = generator -> getOuter();
+		generator -> abandon();
+	}
+}
+
+
+/* Records the bottom of the frames the running shared thread leaves on the
+shared stack, from the stack pointer of the calling function (with the red 
+zone below it). While the thread runs a generator, whose stack the pointer
+is in, the whole committed stack is kept */
+void Thread::markSharedFrames()
+{
+	char* bottom = readStackPointer() - STACK_RED_ZONE;
+	if(bottom < _runStack -> committedBottom || bottom >= _runStack -> top())
+	{
+		bottom = _runStack -> committedBottom;
+	}
+	_framesBottom = bottom;
+}
+
+
+/* Copies the shared thread's frames out of the shared stack, into a buffer
+of their size (reallocated if they outgrew it, or shrank to less than half 
+of it). Throws exception if the buffer can't be allocated */
+void Thread::saveFrames()
+{
+	_framesSize = _runStack -> top() - _framesBottom;
+	if(_framesSize > _framesCapacity || _framesSize < _framesCapacity / 2)
+	{
+		free(_frames);
+		_frames = (char*)malloc(_framesSize);
+		_framesCapacity = _framesSize;
+		if(_frames == nullptr)
+		{
+			_framesCapacity = 0;
+			throw "Can't allocate the copy of a thread's frames";
+		}
+	}
+	memcpy(_frames, _framesBottom, _framesSize);
+}
+
+
+/* Copies the shared thread's saved frames back to the shared stack */
+void Thread::restoreFrames()
+{
+	memcpy(_runStack -> top() - _framesSize, _frames, _framesSize);
+}
+
+
+/* Sets whether the thread runs on a shared stack (or on its own), without 
+saved frames */
+void Thread::initFrames(SharedStack* shared)
+{
+	_shared = shared;
+	_runStack = shared == nullptr ? &_stack : shared -> getStack();
+	_framesBottom = nullptr;
+	_frames = nullptr;
+	_framesSize = 0;
+	_framesCapacity = 0;
+}
+
+
+/* Makes the given region the one the thread allocates from, linking it to
+the regions it used before */
+void Thread::addRegion(ArenaRegion* region)
+{
+	region -> next = _arena;
+	_arena = region;
+	_arenaNext = region -> memory();
+	_arenaEnd = region -> end();
+}
+
+
+/* Takes away the thread's chain of arena regions, which invalidates all the
+memory it allocated, and returns it (null if it allocated nothing) */
+ArenaRegion* Thread::takeArena()
+{
+	ArenaRegion* chain = _arena;
+	clearArena();
+	return chain;
+}
+
+
+/* Leaves the thread without arena regions */
+void Thread::clearArena()
+{
+	_arena = nullptr;
+	_arenaNext = nullptr;
+	_arenaEnd = nullptr;
+}
+
+
+/* Sets the state of the thread. The time spent in the previous state is
+added to its total */
+void Thread::setState(State state)
+{
+	uint64_t now = readCycles();
+	_cyclesInState[_table -> states[_id]] += now - _stateSince;
+	_stateSince = now;
+	_table -> states[_id] = state;
+}
+
+
+/* Returns the total cycles spent in the given state, including the time 
+spent in it so far if it is the current state */
+uint64_t Thread::getCyclesInState(State state)
+{
+	uint64_t cycles = _cyclesInState[state];
+	if(state == getState())
+	{
+		cycles += readCycles() - _stateSince;
+	}
+	return cycles;
+}
+
+
+/* Counts a context switch away from this thread for the given reason, and
+keeps whether it was preempted */
+void Thread::countSwitch(SwitchReason reason)
+{
+	_preempted = reason == PREEMPTED;
+	if(reason == PREEMPTED)
+	{
+		_involuntarySwitches++;
+	}
+	else
+	{
+		_voluntarySwitches++;
+	}
+}
+
+
 /* Decrements _quantumsTillWakeup by one */
 void Thread::decrementQuantumsTillWakeup()
 {
-	_quantumsTillWakeup --;
-	assert(_quantumsTillWakeup >= 0);
+	_table -> quantumsTillWakeup[_id] --;
+	assert(_table -> quantumsTillWakeup[_id] >= 0);
 }
 
 
 /* increments _quantumRuntime by one. */
 void Thread::incrementQuantumRuntime()
 {
-	_quantumRuntime ++;
+	_table -> quantumRuntime[_id] ++;
 }
 
 
@@ -123,63 +473,197 @@ int Thread::setQuantumsTillWakeup(int quantumsTillWakeup)
 		return FUNCTION_FAIL;
 	}
 	
-	_quantumsTillWakeup = quantumsTillWakeup;
+	_table -> quantumsTillWakeup[_id] = quantumsTillWakeup;
 	return FUNCTION_SUCCESS;
 }
 
 
 
+/* Adds the thread to the back of the list */
+void ThreadList::pushBack(Thread* thread)
+{
+	assert(thread != nullptr && thread -> _list == nullptr);
+	
+	thread -> _list = this;
+	thread -> _next = nullptr;
+	thread -> _prev = _tail;
+	if(_tail != nullptr)
+	{
+		_tail -> _next = thread;
+	}
+	else
+	{
+		_head = thread;
+	}
+	_tail = thread;
+	_size++;
+}
+
+
+/* Moves all threads of the other list to the back of this list, keeping
+their order */
+void ThreadList::splice(ThreadList* other)
+{
+	if(other -> empty())
+	{
+		return;
+	}
+	
+	for(Thread* thread = other -> _head; thread != nullptr; 
+	    thread = thread -> _next)
+	{
+		thread -> _list = this;
+	}
+	
+	other -> _head -> _prev = _tail;
+	if(_tail != nullptr)
+	{
+		_tail -> _next = other -> _head;
+	}
+	else
+	{
+		_head = other -> _head;
+	}
+	_tail = other -> _tail;
+	_size += other -> _size;
+	
+	other -> _head = nullptr;
+	other -> _tail = nullptr;
+	other -> _size = 0;
+}
+
+
+/* Removes and returns the thread at the front of the list. Expects the list
+to be non empty */
+Thread* ThreadList::popFront()
+{
+	assert(_head != nullptr);
+	
+	Thread* thread = _head;
+	remove(thread);
+	return thread;
+}
+
+
+/* Removes the thread from the list. If the thread isn't in the list, does
+nothing. */
+void ThreadList::remove(Thread* thread)
+{
+	if(thread -> _list != this)
+	{
+		return;
+	}
+	
+	if(thread -> _prev != nullptr)
+	{
+		thread -> _prev -> _next = thread -> _next;
+	}
+	else
+	{
+		_head = thread -> _next;
+	}
+	
+	if(thread -> _next != nullptr)
+	{
+		thread -> _next -> _prev = thread -> _prev;
+	}
+	else
+	{
+		_tail = thread -> _prev;
+	}
+	
+	thread -> _next = nullptr;
+	thread -> _prev = nullptr;
+	thread -> _list = nullptr;
+	_size--;
+}
+
+
+ThreadCollection::ThreadCollection()
+{
+	for(int i = 0; i < MAX_THREAD_NUM; i++)
+	{
+		_threads[i] = nullptr;
+	}
+	_size = 0;
+}
+
+
 /* Receives a thread to add to the collection */
 void ThreadCollection::add(Thread *thread)
 {
 	assert(thread != nullptr && thread !=NULL);
-			
-	std::pair<int,Thread*> newItem (thread -> getId(),thread);
+	assert(_threads[thread -> getId()] == nullptr);
 	
-	assert(std::get<1>(_threadMap.insert(newItem)));
+	_threads[thread -> getId()] = thread;
 	_size++;
 }
 
 
-/* Deletes the thread  pointer with given id, if the thread exists. 
-Throws an exception on failure. */
+/* Deletes the thread  pointer with given id, if the thread exists. */
 void ThreadCollection::remove(int threadId)
 {
-	_threadMap.erase(threadId);
+	assert(get(threadId) != nullptr);
+	_threads[threadId] = nullptr;
 	_size--;
 }
 
 
 /* Retrives the thread with given id, if the thread exists. 
-Throws an exception on failure */
+Throws an std::out_of_range exception on failure */
 Thread* ThreadCollection::get(int threadId)
 {
-	return _threadMap.at(threadId); 
+	if(threadId < 0 || threadId >= MAX_THREAD_NUM || 
+	   _threads[threadId] == nullptr)
+	{
+		throw std::out_of_range("no thread with given id");
+	}
+	return _threads[threadId]; 
 }
 
 
 /*Deletes all thread objects who's pointers are stored in the collection */
 void ThreadCollection::deleteAllThreads()
 {
-	for(auto iter = _threadMap.begin(); iter != _threadMap.end(); ++iter)
+	for(int i = 0; i < MAX_THREAD_NUM; i++)
 	{
-		delete iter -> second;
+		delete _threads[i];
+		_threads[i] = nullptr;
 	}
-	
+	_size = 0;
 }
 
 
-/* Sets and starts a ITIMER_VIRTUAL timer according to the given usecs.
- In case of an error in the system call, an error is printed and the 
- entire process is exited */
+/* Creates a timer counting the calling kernel thread's CPU time, and sends
+SIGVTALRM to it, and starts it. In case of an error in the system call, an 
+error is printed and the entire process is exited */
+Timer::Timer(int usecs)
+{
+	_usecs = usecs;
+	
+	struct sigevent event = {};
+	event.sigev_notify = SIGEV_THREAD_ID;
+	event.sigev_signo = SIGVTALRM;
+	event.sigev_notify_thread_id = syscall(SYS_gettid);
+	
+	if(timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &_timer))
+	{
+		fprintf(stderr, "system error: Can't create timer\n");
+		exit(1);
+	}
+	setTimer(_usecs);
+}
+
+/* Sets and starts the timer according to the given usecs. In case of an 
+error in the system call, an error is printed and the entire process is 
+exited */
 void Timer::setTimer(int usecs)
 {
-	_itimerval.it_value.tv_sec = (int)usecs/1000000;
-	_itimerval.it_value.tv_usec = usecs%1000000;
-	_itimerval.it_interval.tv_sec = (int)usecs/1000000;
-	_itimerval.it_interval.tv_usec = usecs%1000000;
+	_itimerspec.it_value.tv_sec = (int)usecs/1000000;
+	_itimerspec.it_value.tv_nsec = (usecs%1000000) * 1000;
+	_itimerspec.it_interval = _itimerspec.it_value;
 	
-	if(setitimer(ITIMER_VIRTUAL, &_itimerval, NULL))
+	if(timer_settime(_timer, 0, &_itimerspec, NULL))
 	{
 		fprintf(stderr, "system error: Can't set timer\n");
 		exit(1);
@@ -191,124 +675,684 @@ void Timer::setTimer(int usecs)
 void ReadyQueue::add(Thread* thread)
 {
 	assert(thread != nullptr && thread !=NULL);
-	_list.push_front(thread);
+	_list.pushBack(thread);
 }
 
 
 
+/* Moves all threads of the given list to the end of the queue, keeping
+their order */
+void ReadyQueue::addAll(ThreadList* threads)
+{
+	_list.splice(threads);
+}
+
+
 /* Pops and returns thread that was inserted first. Expects queue to be
 non empty. */
 Thread* ReadyQueue::pop()
 {
-
 	assert(!_list.empty());
-	Thread* thread = _list.back();
-	_list.pop_back();
-
-	return thread;
-	
+	return _list.popFront();
 }
 
 
-/* Removes thread with given id number from queue. If thread doesn't exist,
+/* Removes thread pointer from queue. If thread doesn't exist,
 does nothing. */
-void ReadyQueue::remove(int id)
+void ReadyQueue::remove(Thread* thread)
 {
-	std::list<Thread*>::iterator iter = _list.begin();
-	while(iter != _list.end())
+	_list.remove(thread);
+}
+
+/* Returns true if queue is non empty, and false otherwise. */
+bool ReadyQueue::notEmpty(){
+	return !_list.empty();	
+}
+
+/* Adds the id of a sleeping thread to the sleepers */
+void SleepManager::add(Thread* thread)
+{
+	assert(thread != nullptr && thread !=NULL);
+	assert(_size < MAX_THREAD_NUM);
+	_ids[_size++] = thread -> getId();
+}
+
+/*Decrements the sleep timer for all sleepers, in the thread table.
+threads who reached the end of thier sleep time are removed from
+the sleepers at least every quantum, so there can be no negative timer 
+values */
+void SleepManager::decrementThreads()
+{
+	int32_t* quantumsTillWakeup = _table -> quantumsTillWakeup;
+	for(int i = 0; i < _size; i++)
 	{
-		if((*iter) -> getId() == id)
+		quantumsTillWakeup[_ids[i]] --;
+		assert(quantumsTillWakeup[_ids[i]] >=0);
+	}
+	
+}
+
+/*Scans the sleepers, and checks which threads have 0 quantums left
+untill wakeup. Wakes thoes threads up by changing thier state, removing them
+from the sleepers (keeping the order of the rest) and adding them to the 
+ready list. Only the woken threads' objects are touched */
+void SleepManager::wakeUpSleepers(ReadyQueue* readyQueuePtr)
+{
+	int kept = 0;
+	for(int i = 0; i < _size; i++)
+	{
+		int id = _ids[i];
+		if(_table -> quantumsTillWakeup[id] != 0)
 		{
-			_list.erase(iter);
-			return;
+			_ids[kept++] = id;
+			continue;
 		}
-		iter++;
 		
+		Thread* thread = _collection -> get(id);
+		traceEvent(TRACE_WAKE, id);
+		thread -> setState(READY);
+		readyQueuePtr -> add(thread);
 	}
+	_size = kept;
+
 }
 
-/* Removes thread pointer from queue. If thread doesn't exist,
+
+/* Removes thread from the sleepers. If the thread isn't sleeping,
 does nothing. */
-void ReadyQueue::remove(Thread* thread)
+void SleepManager::remove(Thread* thread)
+{
+	if(thread -> getState() != SLEEPING)
+	{
+		return;
+	}
+	
+	int id = thread -> getId();
+	int i = 0;
+	while(i < _size && _ids[i] != id)
+	{
+		i++;
+	}
+	for(; i + 1 < _size; i++)
+	{
+		_ids[i] = _ids[i + 1];
+	}
+	if(i < _size)
+	{
+		_size--;
+	}
+}
+
+
+/* Creates the pool with warmSize ready thread objects. Throws exception if
+their stacks can't be allocated */
+ThreadPool::ThreadPool(int warmSize, int maxSize, ThreadTable* table, 
+                       StackAllocator* stacks)
+{
+	_maxSize = maxSize;
+	_table = table;
+	_stacks = stacks;
+	for(int i = 0; i < warmSize; i++)
+	{
+		_free.pushBack(new Thread(NO_THREAD_ID, _table, _stacks, nullptr, 
+		                          nullptr, 0));
+	}
+}
+
+
+/* Deletes all thread objects in the pool */
+ThreadPool::~ThreadPool()
+{
+	while(!_free.empty())
+	{
+		delete _free.popFront();
+	}
+}
+
+
+/* Returns a thread object set up as a new thread (see Thread::reset). 
+Allocates a new object only if the pool is empty, in which case an exception
+is thrown if its stack can't be allocated */
+Thread* ThreadPool::acquire(int id, void (*entry)(void*), void* arg,
+                            size_t storageSize)
+{
+	if(_free.empty())
+	{
+		return new Thread(id, _table, _stacks, entry, arg, storageSize);
+	}
+	
+	Thread* thread = _free.popFront();
+	thread -> reset(id, entry, arg, storageSize);
+	return thread;
+}
+
+
+/* Makes sure the pool holds at least count thread objects (even beyond its
+maximal size), allocating the missing objects' stacks together. Throws 
+exception if the stacks can't be allocated */
+void ThreadPool::reserve(int count)
+{
+	int missing = count - _free.size();
+	if(missing <= 0)
+	{
+		return;
+	}
+	
+	std::vector<Stack> stacks(missing);
+	_stacks -> allocateMany(stacks.data(), missing);
+	for(int i = 0; i < missing; i++)
+	{
+		_free.pushBack(new Thread(_table, _stacks, stacks[i]));
+	}
+}
+
+
+/* Returns a thread object that is no longer in use to the pool, or deletes
+it if the pool is full or the thread was shared */
+void ThreadPool::release(Thread* thread)
 {
-	std::list<Thread*>::iterator iter = _list.begin();
-	while(iter != _list.end())
+	if(_free.size() >= _maxSize || thread -> isShared())
 	{
-		if((*iter) == thread)
+		delete thread;
+		return;
+	}
+	_free.pushBack(thread);
+}
+
+
+/* Creates a reaper which releases threads to the given pool */
+ThreadReaper::ThreadReaper(ThreadPool* pool, StackAllocator* stacks,
+                           uthread_stack_release release)
+{
+	_pool = pool;
+	_stacks = stacks;
+	_release = release;
+}
+
+
+/* Deletes all thread objects waiting to be reaped */
+ThreadReaper::~ThreadReaper()
+{
+	while(!_dead.empty())
+	{
+		delete _dead.popFront();
+	}
+}
+
+
+/* Releases all waiting threads to the pool, after returning the pages of 
+the stacks the pool keeps to the system in a single batch */
+void ThreadReaper::reap()
+{
+	//the pool keeps the first threads released to it, up to its room
+	int room = _pool -> room();
+	_released.clear();
+	for(Thread* thread = _dead.front(); 
+	    thread != nullptr && (int)_released.size() < room; 
+	    thread = thread -> nextInList())
+	{
+		if(!thread -> isShared())
 		{
-			_list.erase(iter);
-			return;
+			_released.push_back(thread -> getStack());
 		}
-		iter++;
-		
 	}
+	_stacks -> releasePages(&_released, _release);
+	
+	while(!_dead.empty())
+	{
+		_pool -> release(_dead.popFront());
+	}
+}
 
+
+/* Adds a task to be run as soon as possible, after all previously posted 
+tasks */
+void TaskQueue::post(void (*fn)(void*), void* arg)
+{
+	PostedTask task = {fn, arg, 0};
+	_ready.push_back(task);
 }
 
-/* Returns true if queue is non empty, and false otherwise. */
-bool ReadyQueue::notEmpty(){
-	return !_list.empty();	
+
+/* Adds a task to be run once the given quantum starts */
+void TaskQueue::postAt(int64_t dueQuantum, void (*fn)(void*), void* arg)
+{
+	PostedTask task = {fn, arg, dueQuantum};
+	_delayed.push(task);
 }
 
-/* Adds a thread pointer to the sleepers list */
-void SleepManager::add(Thread* thread)
+
+/* Moves all delayed tasks which are due by the given quantum to the back of
+the FIFO queue, earliest first */
+void TaskQueue::moveDueTasks(int64_t currentQuantum)
 {
-	assert(thread != nullptr && thread !=NULL);
-	_list.push_front(thread);
+	while(!_delayed.empty() && _delayed.top().dueQuantum <= currentQuantum)
+	{
+		_ready.push_back(_delayed.top());
+		_delayed.pop();
+	}
 }
 
-/*Decrements the sleep timer for all threads in the list.
-threads who reached the end of thier sleep time are removed from
-list at least every quantum, so there can be no negative timer values */
-void SleepManager::decrementThreads()
+
+/* Removes and returns the task at the front of the FIFO queue. Expects the
+queue to be non empty */
+PostedTask TaskQueue::pop()
 {
+	assert(!_ready.empty());
+	PostedTask task = _ready.front();
+	_ready.pop_front();
+	return task;
+}
+
 
-	std::list<Thread*>::iterator iter = _list.begin();
-	while(iter != _list.end())
+/* Creates a new key with the given destructor, and returns it. Returns -1 
+if all keys were created */
+int ThreadKeys::create(void (*destructor)(void*))
+{
+	if(_size >= UTHREAD_KEYS_MAX)
 	{
-		(*iter) -> decrementQuantumsTillWakeup();
-		assert((*iter) -> getQuantumsTillWakeup() >=0);
-		iter++;
+		return FUNCTION_FAIL;
 	}
+	_destructors[_size] = destructor;
+	return _size++;
+}
+
+
+/* Creates a generator of the given function and argument, which starts at
+generatorTrampoline on a new stack when first resumed. Throws exception if 
+the stack can't be allocated */
+Generator::Generator(StackAllocator* stacks, void (*fn)(void*), void* arg)
+{
+	_stacks = stacks;
+	_stack = _stacks -> allocate();
+	_fn = fn;
+	_arg = arg;
+	_value = nullptr;
+	_consumer = nullptr;
+	_outer = nullptr;
+	_finished = false;
 	
+	address_t sp = (address_t)_stack.top() - sizeof(address_t);
+	address_t pc = (address_t)generatorTrampoline;
+	*(address_t*)sp = 0; // where unwinders stop
+	sigsetjmp(_env, 0);
+	(_env->__jmpbuf)[JB_SP] = translate_address(sp);
+	(_env->__jmpbuf)[JB_PC] = translate_address(pc);
 }
 
-/*Iterates the sleepers list, and checks which threads have 0 quantums left
-untill wakeup. Wakes thoes threads up by changing thier state, removing them
-from the sleepers list and adding them to the ready list */
-void SleepManager::wakeUpSleepers(ReadyQueue* readyQueuePtr)
+
+/* Runs the generator for the consumer until it yields a value or returns,
+and returns whether it yielded, storing the value. A finished generator 
+returns right away. The generator must not be running */
+bool Generator::next(Thread* consumer, void** value)
+{
+	if(!_finished)
+	{
+		_consumer = consumer;
+		_outer = consumer -> getGenerator();
+		consumer -> setGenerator(this);
+		if(sigsetjmp(_consumerEnv, 0) == 0)
+		{
+			siglongjmp(_env, 1);
+		}
+		_consumer -> setGenerator(_outer);
+		_consumer = nullptr;
+	}
+	*value = _value;
+	return !_finished;
+}
+
+
+/* Hands the value to the consumer, and returns when the generator is 
+resumed. Called by the generator's function, on its own stack */
+void Generator::yield(void* value)
+{
+	_value = value;
+	if(sigsetjmp(_env, 0) == 0)
+	{
+		siglongjmp(_consumerEnv, 1);
+	}
+}
+
+
+/* Runs the generator's function, and then switches to its consumer for 
+good. Called by generatorTrampoline, on the generator's own stack */
+void Generator::run()
+{
+	_fn(_arg);
+	_finished = true;
+	_value = nullptr;
+	siglongjmp(_consumerEnv, 1);
+}
+
+
+/* Marks the generator finished without switching to it, when its consumer
+is terminated while running it */
+void Generator::abandon()
+{
+	_finished = true;
+	_value = nullptr;
+	_consumer = nullptr;
+	_outer = nullptr;
+}
+
+
+/* Allocates the shared stack and the stack it is restored from, which 
+starts at sharedStackTrampoline whenever it is jumped to. Throws exception 
+if the shared stack can't be allocated */
+SharedStack::SharedStack(StackAllocator* stacks)
+{
+	_stacks = stacks;
+	_stack = _stacks -> allocate();
+	_restoreStack = new char[SHARED_RESTORE_STACK_SIZE];
+	_owner = nullptr;
+	_incoming = nullptr;
+	
+	address_t sp = (address_t)(_restoreStack + SHARED_RESTORE_STACK_SIZE) - 
+	               sizeof(address_t);
+	address_t pc = (address_t)sharedStackTrampoline;
+	*(address_t*)sp = 0; // where unwinders stop
+	sigsetjmp(_restoreEnv, 0);
+	(_restoreEnv->__jmpbuf)[JB_SP] = translate_address(sp);
+	(_restoreEnv->__jmpbuf)[JB_PC] = translate_address(pc);
+}
+
+
+/* Frees both stacks */
+SharedStack::~SharedStack()
+{
+	_stacks -> release(&_stack);
+	delete[] _restoreStack;
+}
+
+
+/* Prepares the shared stack for the shared thread switching in. Returns 
+right away if its frames are on the stack, and otherwise jumps to the 
+restoring stack, which restores them and jumps to the thread. Expects 
+SIGVTALRM to be masked */
+void SharedStack::switchTo(Thread* thread)
+{
+	if(_owner == thread)
+	{
+		return;
+	}
+	_incoming = thread;
+	siglongjmp(_restoreEnv, 1);
+}
+
+
+/* Copies the frames on the stack out to their thread, and the frames of the
+thread switching in back to the stack, and returns the thread. Runs on the 
+restoring stack. Throws exception if the frames can't be saved */
+Thread* SharedStack::restore()
+{
+	if(_owner != nullptr)
+	{
+		_owner -> saveFrames();
+	}
+	_owner = _incoming;
+	_incoming = nullptr;
+	_owner -> restoreFrames();
+	return _owner;
+}
+
+
+/* Drops the frames of a terminated thread, which are never saved */
+void SharedStack::forget(Thread* thread)
+{
+	if(_owner == thread)
+	{
+		_owner = nullptr;
+	}
+}
+
+
+/* Frees all the regions in the pool */
+ArenaPool::~ArenaPool()
+{
+	while(_free != nullptr)
+	{
+		ArenaRegion* region = _free;
+		_free = region -> next;
+		free(region);
+	}
+}
+
+
+/* Returns a region with room for at least size bytes, taken from the pool
+if it fits in a pooled region. A size which doesn't fit gets a region of 
+its own. Throws exception if the region can't be allocated */
+ArenaRegion* ArenaPool::take(size_t size)
 {
-	std::list<Thread*>::iterator iter = _list.begin();
-	while(iter != _list.end())
+	size_t regionSize = _regionSize;
+	if(size > _regionSize - ARENA_HEADER_SIZE)
+	{
+		regionSize = (ARENA_HEADER_SIZE + size + ARENA_ALIGNMENT - 1) & 
+		             ~(size_t)(ARENA_ALIGNMENT - 1);
+	}
+	else if(_free != nullptr)
 	{
-		if((*iter) -> getQuantumsTillWakeup() ==0)
+		ArenaRegion* region = _free;
+		_free = region -> next;
+		_size--;
+		return region;
+	}
+	
+	void* memory;
+	if(posix_memalign(&memory, ARENA_ALIGNMENT, regionSize) != 0)
+	{
+		throw "Can't allocate arena region";
+	}
+	ArenaRegion* region = (ArenaRegion*)memory;
+	region -> next = nullptr;
+	region -> size = regionSize;
+	return region;
+}
+
+
+/* Releases a thread's chain of regions, keeping regular sized regions in 
+the pool while it isn't full and freeing the rest */
+void ArenaPool::release(ArenaRegion* chain)
+{
+	while(chain != nullptr)
+	{
+		ArenaRegion* region = chain;
+		chain = region -> next;
+		if(region -> size != _regionSize || _size >= _maxSize)
 		{
-			(*iter) -> setState(READY);
-			readyQueuePtr -> add(*iter);
-			iter = _list.erase(iter);
+			free(region);
 			continue;
 		}
-		
-		iter++;
+		region -> next = _free;
+		_free = region;
+		_size++;
 	}
+}
 
+
+/* Creates an executor with a ring of capacity jobs, reserving room for the
+given number of workers waiting on it */
+Executor::Executor(int capacity, int workers)
+{
+	_jobs.resize(capacity);
+	_head = 0;
+	_size = 0;
+	_workers.reserve(workers);
+	_idleWorkers.reserve(workers);
 }
 
 
-/* Removes thread pointer from sleepers list. If thread doesn't exist,
-does nothing. */
-void SleepManager::remove(Thread* thread)
+/* Frees the future objects of the free list and of the jobs left in the 
+ring. Futures held by the user are left to them */
+Executor::~Executor()
+{
+	for(size_t i = 0; i < _freeFutures.size(); i++)
+	{
+		delete _freeFutures[i];
+	}
+	ExecutorJob job;
+	while(pop(&job))
+	{
+		delete job.future;
+	}
+}
+
+
+/* Adds a job to the back of the ring. Returns false if the ring is full */
+bool Executor::push(const ExecutorJob& job)
+{
+	if(full())
+	{
+		return false;
+	}
+	_jobs[(_head + _size) % _jobs.size()] = job;
+	_size++;
+	return true;
+}
+
+
+/* Removes the job at the front of the ring into job. Returns false if the
+ring is empty */
+bool Executor::pop(ExecutorJob* job)
 {
-	std::list<Thread*>::iterator iter = _list.begin();
-	while(iter != _list.end())
+	if(_size == 0)
 	{
-		if((*iter) == thread)
+		return false;
+	}
+	*job = _jobs[_head];
+	_head = (_head + 1) % _jobs.size();
+	_size--;
+	return true;
+}
+
+
+/* Returns a future object which isn't done, from the free list if it isn't
+empty. Throws exception if a new object can't be allocated */
+uthread_future* Executor::newFuture()
+{
+	uthread_future* future;
+	if(_freeFutures.empty())
+	{
+		future = new(std::nothrow) uthread_future;
+		if(future == nullptr)
 		{
-			_list.erase(iter);
+			throw "can't allocate future";
+		}
+	}
+	else
+	{
+		future = _freeFutures.back();
+		_freeFutures.pop_back();
+	}
+	
+	future -> result = nullptr;
+	future -> done = false;
+	future -> released = false;
+	future -> waiter = nullptr;
+	future -> thenFn = nullptr;
+	future -> thenArg = nullptr;
+	return future;
+}
+
+
+/* Returns a future object to the free list */
+void Executor::freeFuture(uthread_future* future)
+{
+	_freeFutures.push_back(future);
+}
+
+
+/* Returns true if the given thread is one of the executor's workers */
+bool Executor::isWorker(Thread* thread)
+{
+	return std::find(_workers.begin(), _workers.end(), thread) != 
+	       _workers.end();
+}
+
+
+/* Sets the given thread as the one waiting for the future */
+void Executor::waitForFuture(uthread_future* future, Thread* waiter)
+{
+	future -> waiter = waiter;
+	_waitedFutures.push_back(future);
+}
+
+
+/* Removes and returns the thread waiting for the future, or null if there 
+is none */
+Thread* Executor::takeFutureWaiter(uthread_future* future)
+{
+	Thread* waiter = future -> waiter;
+	if(waiter != nullptr)
+	{
+		future -> waiter = nullptr;
+		_waitedFutures.erase(std::find(_waitedFutures.begin(), 
+		                               _waitedFutures.end(), future));
+	}
+	return waiter;
+}
+
+
+/* Removes the given thread from all waiting vectors, and from the future it
+waits for, if any. Called by a waiting thread when it runs again */
+void Executor::stopWaiting(Thread* thread)
+{
+	removeWaiter(&_idleWorkers, thread);
+	removeWaiter(&_submitters, thread);
+	for(size_t i = 0; i < _waitedFutures.size(); i++)
+	{
+		if(_waitedFutures[i] -> waiter == thread)
+		{
+			_waitedFutures[i] -> waiter = nullptr;
+			_waitedFutures.erase(_waitedFutures.begin() + i);
 			return;
 		}
-		iter++;
-		
+	}
+}
+
+
+/* Forgets a terminated thread, which may be a worker or a waiting thread */
+void Executor::forget(Thread* thread)
+{
+	stopWaiting(thread);
+	_workers.erase(std::remove(_workers.begin(), _workers.end(), thread),
+	               _workers.end());
+}
+
+
+/* Adds a thread to the given waiting vector, unless it is there already */
+void Executor::addWaiter(std::vector<Thread*>* waiters, Thread* thread)
+{
+	if(std::find(waiters -> begin(), waiters -> end(), thread) == 
+	   waiters -> end())
+	{
+		waiters -> push_back(thread);
+	}
+}
+
+
+/* Removes and returns the thread which waited longest in the given vector,
+or null if it is empty */
+Thread* Executor::takeWaiter(std::vector<Thread*>* waiters)
+{
+	if(waiters -> empty())
+	{
+		return nullptr;
+	}
+	Thread* thread = waiters -> front();
+	waiters -> erase(waiters -> begin());
+	return thread;
+}
+
+
+/* Removes a thread from the given waiting vector, if it is there */
+void Executor::removeWaiter(std::vector<Thread*>* waiters, Thread* thread)
+{
+	std::vector<Thread*>::iterator it = std::find(waiters -> begin(), 
+	                                              waiters -> end(), thread);
+	if(it != waiters -> end())
+	{
+		waiters -> erase(it);
 	}
 }
 
@@ -340,28 +1384,66 @@ void IdDistributor::freeId(int id)
 
 
 
-/* Allocates and returns a new stack with fixed size STACK_SIZE */
-char* getNewStack()
+SchedulerStats::SchedulerStats()
 {
-	char* newStack = (char*)malloc(STACK_SIZE*sizeof(char));
-	if(newStack == NULL)
+	_switchStart = 0;
+	_voluntarySwitches = 0;
+	_involuntarySwitches = 0;
+	_threadsSpawned = 0;
+	_threadsTerminated = 0;
+	for(int i = 0; i < UTHREAD_LATENCY_BUCKETS; i++)
 	{
-		fprintf(stderr, "system error: Can't allocate new thread's stack "\
-		"memory\n");
-		throw "can't allocate stack";
+		_latencyHistogram[i] = 0;
 	}
-	
-	return newStack;	
-	
+	_initCycles = readCycles();
+	clock_gettime(CLOCK_MONOTONIC, &_initTime);
 }
 
-/*  Frees the memory of given stack */
-void deleteStack(char* stackPtr)
+
+/* Records the latency of the switch that started with the last call to
+switchStarted, in the log2 bucket of its cycle count */
+void SchedulerStats::switchEnded()
 {
-	assert(stackPtr != nullptr && stackPtr !=NULL);
-	free(stackPtr);
-	
+	uint64_t latency = readCycles() - _switchStart;
+	int bucket = 0;
+	if(latency > 1)
+	{
+		bucket = 63 - __builtin_clzll(latency);
+	}
+	_latencyHistogram[bucket]++;
 }
 
 
+/* Counts a context switch caused by the given reason. Switches that 
+don't switch out a live thread (initialization and termination) are not
+counted */
+void SchedulerStats::countSwitch(SwitchReason reason)
+{
+	if(reason == PREEMPTED)
+	{
+		_involuntarySwitches++;
+	}
+	else if(reason != TERMINATED && reason != INITIALIZED)
+	{
+		_voluntarySwitches++;
+	}
+}
+
 
+/* Returns the number of cycles per micro-second, calibrated against the 
+monotonic clock over the time since the object was created. Waits for a 
+millisecond to pass since creation, to allow a meaningful calibration */
+double SchedulerStats::cyclesPerUsec()
+{
+	struct timespec now;
+	double elapsedUsecs;
+	do
+	{
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsedUsecs = (now.tv_sec - _initTime.tv_sec) * 1000000.0 + 
+		               (now.tv_nsec - _initTime.tv_nsec) / 1000.0;
+	}
+	while(elapsedUsecs < 1000);
+	
+	return (readCycles() - _initCycles) / elapsedUsecs;
+}
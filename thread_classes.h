@@ -4,64 +4,356 @@ functions) used by the uthreads library */
 #ifndef _THREADS_CLASSES_
 #define _THREADS_CLASSES_
 
-#include <unordered_map>
-#include <list>
 #include <bitset>
+#include <deque>
+#include <queue>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+#include <stdint.h>
+#include <stdlib.h>
 
 #define NOT_SLEEPING -1
 
 #include <sys/time.h>
+#include <time.h>
 
 #include <setjmp.h>
 #include <signal.h>
 
 
 #include "uthreads.h"
+#include "thread_stacks.h"
 #include "general_macros.h" 
 
 
 enum State{SLEEPING,READY,RUNNING,BLOCKED};
+#define NUM_STATES 4
 
+/* The reasons for which the scheduler may be called. Used to tell voluntary
+context switches from preemptions */
+enum SwitchReason{PREEMPTED,BLOCKED_SELF,SLEPT,TERMINATED,INITIALIZED,
+	YIELDED};
 
-/* helper functions to allow threads to allocate and free stacks */ 
-char* getNewStack();
-void deleteStack(char* stackPtr);
+
+/* Reads the cycle counter used for all of the library's time measurements.
+On Intel archs this is the TSC, elsewhere it falls back to a nanosecond 
+monotonic clock */
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+inline uint64_t readCycles(){ return __rdtsc(); }
+#else
+inline uint64_t readCycles()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+#endif
+
+
+/* The floating point control state of a thread: its x87 control word and 
+MXCSR (or its whole floating point environment, on other archs) */
+#if defined(__x86_64__) || defined(__i386__)
+struct FpuControl
+{
+	uint32_t mxcsr;
+	uint16_t x87;
+};
+#define DEFAULT_MXCSR 0x1F80 // all exceptions masked, round to nearest
+#define DEFAULT_X87_CONTROL 0x037F // the same, in extended precision
+
+inline void saveFpuControl(FpuControl* control)
+{
+	control -> mxcsr = _mm_getcsr();
+	__asm__ volatile("fnstcw %0" : "=m"(control -> x87));
+}
+
+inline void loadFpuControl(FpuControl* control)
+{
+	_mm_setcsr(control -> mxcsr);
+	__asm__ volatile("fldcw %0" : : "m"(control -> x87));
+}
+
+inline void initFpuControl(FpuControl* control)
+{
+	control -> mxcsr = DEFAULT_MXCSR;
+	control -> x87 = DEFAULT_X87_CONTROL;
+}
+#else
+#include <fenv.h>
+struct FpuControl
+{
+	fenv_t env;
+};
+
+inline void saveFpuControl(FpuControl* control){ fegetenv(&control -> env); }
+inline void loadFpuControl(FpuControl* control){ fesetenv(&control -> env); }
+inline void initFpuControl(FpuControl* control)
+{ 
+	control -> env = *FE_DFL_ENV; 
+}
+#endif
+
+
+/* Returns the stack pointer, as the calling function left it */
+inline char* readStackPointer()
+{
+	char* sp;
+#ifdef __x86_64__
+	__asm__ volatile("mov %%rsp, %0" : "=r"(sp));
+#else
+	__asm__ volatile("mov %%esp, %0" : "=r"(sp));
+#endif
+	return sp;
+}
+
+
+class ThreadList;
+class Generator;
+class SharedStack;
+
+/* The entry point of all new threads, defined by the library. Runs the 
+thread's entry function with its argument, and terminates the thread when it 
+returns */
+void threadTrampoline();
+
+/* The entry point of all generators, defined by the library. Runs the 
+running thread's innermost generator */
+void generatorTrampoline();
+
+/* The entry point of the shared run stack's restoring, defined by the 
+library. Restores the frames of the shared thread switching in, and jumps to
+it */
+void sharedStackTrampoline();
+
+/* The bytes below a shared thread's stack pointer saved with its frames, 
+as the ABI lets functions keep data there (the x86-64 red zone) */
+#define STACK_RED_ZONE 128
+
+/* The size of the stack the shared run stack is restored from */
+#define SHARED_RESTORE_STACK_SIZE 8192
+
+/* The alignment of the storage reserved at the top of a new thread's 
+stack */
+#define STACK_STORAGE_ALIGNMENT 16
+
+/* The alignment of the memory allocated from the threads' arenas */
+#define ARENA_ALIGNMENT 16
+
+struct ArenaRegion;
+#define ARENA_HEADER_SIZE ((sizeof(ArenaRegion) + ARENA_ALIGNMENT - 1) & \
+                           ~(size_t)(ARENA_ALIGNMENT - 1))
+
+/* The header of a region of a thread's arena (see uthread_alloc). The 
+region's memory follows it, from the header's size rounded up to 
+ARENA_ALIGNMENT */
+struct ArenaRegion
+{
+	ArenaRegion* next; // the region the thread used before this one
+	size_t size; // of the whole region, including the header
+	
+	char* memory(){ return (char*)this + ARENA_HEADER_SIZE; }
+	char* end(){ return (char*)this + size; }
+};
+
+
+/* The size of a cache line, to which the thread table is aligned */
+#define CACHE_LINE_SIZE 64
+
+/* The number of entries in each array of the thread table - MAX_THREAD_NUM
+rounded up to whole cache lines of one byte entries, so that every array 
+starts on a cache line */
+#define THREAD_TABLE_LENGTH ((MAX_THREAD_NUM + CACHE_LINE_SIZE - 1) / \
+                             CACHE_LINE_SIZE * CACHE_LINE_SIZE)
+
+/* This struct holds the fields of all threads that the scheduler touches 
+on every tick - their states, quantums until wakeup and quantums run - in 
+arrays indexed by thread id (struct of arrays). Ticking or scanning thousands
+of threads so reads a few contiguous cache lines, rather than the much larger
+thread objects, which hold their saved context and the colder data. 
+Allocated aligned to a cache line, and zeroed */
+struct ThreadTable
+{
+	int32_t quantumsTillWakeup[THREAD_TABLE_LENGTH];
+	int32_t quantumRuntime[THREAD_TABLE_LENGTH];
+	uint8_t states[THREAD_TABLE_LENGTH];
+	
+	static void* operator new(size_t size);
+	static void operator delete(void* table){ free(table); }
+};
+
+/* The id of an unused thread object, whose fields in the thread table are 
+not its own */
+#define NO_THREAD_ID -1
 
 
 /* This class holds information about a certain thread - 
 its id, state, time until it wakes up, and actual running time so far.
+The state and quantum data are kept in the thread table, in the thread's 
+entries, while the object holds the colder data.
+It also accounts the cycles the thread spent in each state, which is updated
+on every state change, and counts its context switches. Its stack is taken 
+from (and returned to) the given stack allocator, and it holds a slot for its
+value of each thread-local key.
+A new thread starts at threadTrampoline, which calls its entry function with
+its argument. Storage may be reserved at the top of the new thread's stack,
+in which case the entry function's argument points to it.
+It allocates the memory given by uthread_alloc from its own chain of arena 
+regions, which the library takes away from it when it terminates.
+While the thread runs a generator it keeps the innermost one, whose stack 
+it runs on (see Generator).
+A shared thread runs on the runtime's shared run stack rather than a stack of
+its own (see SharedStack), and keeps a copy of its frames while another 
+shared thread uses it, in a buffer of their size. It refers to the shared
+stack's single descriptor, so a page committed by one shared thread is seen
+as committed by all of them.
+A thread's context (see uthread_context) sets whether its switches save its
+signal mask and its floating point control state, which it keeps here.
+A thread object may be reused for a new thread by resetting it, which keeps
+its stack. Each thread also holds the links of the single ThreadList it may
+be in at any time.
 */
 class Thread
 {
 public:
-	Thread(int id);
-	Thread(int id, void (*f)(void));
-	~Thread(){deleteStack(_SP);}
+	Thread(int id, ThreadTable* table, StackAllocator* stacks);
+	Thread(int id, ThreadTable* table, StackAllocator* stacks, 
+	       void (*entry)(void*), void* arg, size_t storageSize);
+	Thread(ThreadTable* table, StackAllocator* stacks, Stack stack);
+	Thread(SharedStack* shared, int id, ThreadTable* table, 
+	       StackAllocator* stacks, void (*entry)(void*), void* arg);
+	~Thread();
+	void reset(int id, void (*entry)(void*), void* arg, size_t storageSize);
+	void (*getEntry())(void*){ return _entry; }
+	void* getArg(){ return _arg; }
 	int getId(){ return _id; }
-	int getQuantumsTillWakeup(){ return _quantumsTillWakeup; }
-	int getQuantumRuntime(){ return _quantumRuntime; }
-	enum State getState(){ return _state; }
+	int getQuantumsTillWakeup(){ return _table -> quantumsTillWakeup[_id]; }
+	int getQuantumRuntime(){ return _table -> quantumRuntime[_id]; }
+	enum State getState(){ return (State)_table -> states[_id]; }
 	void decrementQuantumsTillWakeup();
 	void incrementQuantumRuntime();
 	int setQuantumsTillWakeup(int quantumsTillWakeup);
-	void setState(State state){_state = state;}
+	void setState(State state);
 	sigjmp_buf* getEnv(){return &_env;}
+	uthread_context getContext(){ return _context; }
+	void setContext(uthread_context context);
+	void saveFpu(){ saveFpuControl(&_fpuControl); }
+	void loadFpu(){ loadFpuControl(&_fpuControl); }
+	bool wasPreempted(){ return _preempted; }
+	void markTerminating(){ _terminating = true; }
+	bool isTerminating(){ return _terminating; }
+	/* whether the thread is BLOCKED, and may be made READY */
+	bool isResumable(){ return getState() == BLOCKED && !_terminating; }
+	/* bump allocates from the current region, or returns null if the size 
+	(rounded up to ARENA_ALIGNMENT) doesn't fit in it */
+	void* allocate(size_t size)
+	{
+		size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+		if(size > (size_t)(_arenaEnd - _arenaNext))
+		{
+			return nullptr;
+		}
+		void* memory = _arenaNext;
+		_arenaNext += size;
+		return memory;
+	}
+	void addRegion(ArenaRegion* region);
+	ArenaRegion* takeArena();
+	uint64_t getCyclesInState(State state);
+	uint64_t getVoluntarySwitches(){ return _voluntarySwitches; }
+	uint64_t getInvoluntarySwitches(){ return _involuntarySwitches; }
+	void countSwitch(SwitchReason reason);
+	Thread* nextInList(){ return _next; }
+	bool growStack(char* faultAddress);
+	bool stackOverflowedAt(char* faultAddress);
+	Generator* getGenerator(){ return _generator; }
+	void setGenerator(Generator* generator){ _generator = generator; }
+	void abandonGenerators();
+	bool isShared(){ return _shared != nullptr; }
+	void markSharedFrames();
+	void saveFrames();
+	void restoreFrames();
+	size_t getSavedFramesSize(){ return _framesSize; }
+	void** getSlots(){ return _slots; }
+	Stack* getStack(){ return _runStack; }
+	size_t measureStackUsage(){ return _stacks -> measureUsage(_runStack); }
+	size_t getStackCommitted(){ 
+		return _runStack -> top() - _runStack -> committedBottom; }
 		
 	
 private:
+	friend class ThreadList;
+	
+	//the fields used on every switch come first, sharing a cache line
+	Thread* _next;
+	Thread* _prev;
+	ThreadList* _list; // the list holding the thread, if any
+	ThreadTable* _table; // holding the thread's state and quantum data
 	int _id;
-	int _quantumsTillWakeup; 
-	int _quantumRuntime;
-	enum State _state;
+	uthread_context _context;
+	FpuControl _fpuControl; // saved on voluntary switches of full contexts
+	bool _preempted; // whether the last switch away from it was preemptive
+	bool _terminating; // taken out of scheduling until it is terminated
 	sigjmp_buf _env;
-	char* _SP;
+	Stack* _runStack; // the thread's own stack, or the shared stack
+	Stack _stack; // the thread's own, unless it is shared
+	StackAllocator* _stacks;
+	void (*_entry)(void*);
+	void* _arg;
+	uint64_t _stateSince; // cycle count of the last state change
+	uint64_t _cyclesInState[NUM_STATES];
+	uint64_t _voluntarySwitches;
+	uint64_t _involuntarySwitches;
+	void* _slots[UTHREAD_KEYS_MAX]; // the thread's values of the keys
+	ArenaRegion* _arena; // the region allocated from, linked to older ones
+	char* _arenaNext;
+	char* _arenaEnd;
+	Generator* _generator; // the innermost generator the thread runs
+	SharedStack* _shared; // whose stack the thread runs on, if shared
+	char* _framesBottom; // of the thread's frames on the shared stack
+	char* _frames; // their copy, while another thread uses the stack
+	size_t _framesSize;
+	size_t _framesCapacity;
+	
+	void initStats();
+	void clearSlots();
+	void clearArena();
+	void initFrames(SharedStack* shared);
 	
 };
 
+
+/* This class is a doubly linked list of threads, linked through the thread
+objects themselves, so adding and removing threads never allocates memory,
+and removing a thread from the middle of the list takes constant time. A 
+thread may be held by a single list at a time. Threads are added at the back
+and popped from the front. */
+class ThreadList
+{
+public:
+	ThreadList():_head(nullptr),_tail(nullptr),_size(0){}
+	void pushBack(Thread* thread);
+	void splice(ThreadList* other);
+	Thread* popFront();
+	void remove(Thread* thread);
+	bool contains(Thread* thread){ return thread -> _list == this; }
+	Thread* front(){ return _head; }
+	bool empty(){ return _head == nullptr; }
+	int size(){ return _size; }
+	
+private:
+	Thread* _head;
+	Thread* _tail;
+	int _size;
+};
+
 /* This class wraps a collection which holds all thread classes 
 that are in play. Enables retriving the reference to the thread of
-a given id, deleting the pointer of a thread with a given id, and adding a 
-thread to the collection. Implemented with a hash table. 
+a given id (find returns null for an id not in use, where get throws), 
+deleting the pointer of a thread with a given id, and adding a 
+thread to the collection. Implemented with an array indexed by the thread
+ids, which are all smaller than uthreads::MAX_THREAD_NUM. 
 The class perfoms sanity checks on the operations, to make sure the requested
 id exists, and that the number of threads does not exceed
 uthreads::MAX_THREAD_NUM*/
@@ -69,68 +361,349 @@ uthreads::MAX_THREAD_NUM*/
 class ThreadCollection
 {
 public:
+	ThreadCollection();
 	void add(Thread *thread);
 	void remove(int threadId);
 	Thread* get(int threadId);
+	Thread* find(int threadId){ return _threads[threadId]; }
 	int size(){return _size;}
 	void deleteAllThreads();
 	
 private:
-	std::unordered_map<int,Thread*> _threadMap;
+	Thread* _threads[MAX_THREAD_NUM];
 	int _size;
 	
 };
 
-/* This class wraps an itimerval timer, and supplies an interface for setting
-and resetting the timer with given usecs. */
+/* This class wraps a POSIX timer, and supplies an interface for setting
+and resetting the timer with given usecs. The timer counts the CPU time of 
+the kernel thread which created it, and sends SIGVTALRM to that thread only,
+so every kernel thread running the library has its own quantum timer */
 
 class Timer
 {
 public:
-	Timer(int usecs):_usecs(usecs){setTimer(_usecs);}
+	Timer(int usecs);
+	~Timer(){timer_delete(_timer);}
 	void reset(){setTimer(_usecs);}
 private:
 	void setTimer(int usecs);
 	int _usecs;
-	struct itimerval _itimerval;
+	timer_t _timer;
+	struct itimerspec _itimerspec;
 	
 };
 
 /* This class wraps a list which holds pointers to all threads currently 
-ready to be executed. Supplies an interface to add, pop, and remove from 
-middle of queue*/
+ready to be executed. Supplies an interface to add (a single thread, or a 
+whole list of threads at once), pop, and remove from middle of queue*/
 
 class ReadyQueue
 {
 public:
 	void add(Thread* thread);
+	void addAll(ThreadList* threads);
 	Thread* pop();
-	void remove(int id);
 	void remove(Thread* thread);
 	bool notEmpty();
+	int size(){ return _list.size(); }
 	
 private:
-	std::list<Thread*> _list;
+	ThreadList _list;
 	
 };
 
-/* This class wraps a list which holds pointer to all sleeping threads.
-The class supplies an interface to add threads to the list, decrement
-the sleep counter, wake up threads who's time is up, and delete threads
-from the list */
+/* This class holds the ids of all sleeping threads, in a dense array, and 
+counts their sleep down in the thread table, so a tick scans only contiguous
+memory. The class supplies an interface to add threads, decrement the sleep 
+counter, wake up threads who's time is up, and delete threads */
 class SleepManager
 {
 public:
+	SleepManager(ThreadTable* table, ThreadCollection* collection):
+		_table(table),_collection(collection),_size(0){}
 	void add(Thread* thread);
 	void decrementThreads();
 	void wakeUpSleepers(ReadyQueue* readyQueuePtr);
 	void remove(Thread* thread);
+	int size(){ return _size; }
+
+
+private:
+	ThreadTable* _table;
+	ThreadCollection* _collection;
+	int _ids[MAX_THREAD_NUM]; // the sleepers' ids, in the order they slept
+	int _size;
+};
+
+
+/* This class holds a pool of thread objects (each with its stack) which are
+not in use, so that spawning and terminating threads doesn't allocate or
+free memory. The pool is created with a number of ready objects, and keeps
+at most a given number of released objects - objects released beyond that
+are deleted. */
+class ThreadPool
+{
+public:
+	ThreadPool(int warmSize, int maxSize, ThreadTable* table, 
+	           StackAllocator* stacks);
+	~ThreadPool();
+	Thread* acquire(int id, void (*entry)(void*), void* arg, 
+	                size_t storageSize);
+	void release(Thread* thread);
+	void reserve(int count);
+	int size(){ return _free.size(); }
+	int room(){ return _maxSize - _free.size(); }
+	
+private:
+	ThreadList _free;
+	int _maxSize;
+	ThreadTable* _table;
+	StackAllocator* _stacks;
+};
+
+/* This class holds terminated thread objects until they are reaped - 
+released to the thread pool in a batch, with the pages of their stacks 
+returned to the system as set by the stack release option (objects the pool
+doesn't keep are deleted instead). Reaping is kept off the scheduling path,
+which only adds threads to the reaper, and batching lets adjacent stacks be
+released by a single system call. */
+class ThreadReaper
+{
+public:
+	ThreadReaper(ThreadPool* pool, StackAllocator* stacks,
+	             uthread_stack_release release);
+	~ThreadReaper();
+	void add(Thread* thread){ _dead.pushBack(thread); }
+	void reap();
+	int size(){ return _dead.size(); }
+	
+private:
+	ThreadList _dead;
+	ThreadPool* _pool;
+	StackAllocator* _stacks;
+	uthread_stack_release _release;
+	std::vector<Stack*> _released; // reused between batches
+};
+
+
+/* A function to run with its argument, posted to the library's task runner*/
+struct PostedTask
+{
+	void (*fn)(void*);
+	void* arg;
+	int64_t dueQuantum; // the quantum at which a delayed task is due
+	
+	bool operator>(const PostedTask& other) const
+	{
+		return dueQuantum > other.dueQuantum;
+	}
+};
+
+/* This class is a generator (see uthread_generator_create): a function 
+running on a stack of its own, which hands values to its consumer - the 
+thread calling next - one at a time. Control moves between the two directly,
+with a jump to the saved context of the other side, which saves no signal 
+mask and involves neither the scheduler nor the ready queue. The generator 
+runs as part of its consumer, which may be preempted or block on either 
+stack as usual. Generators may nest: one may consume another, and the 
+consumer keeps the innermost one, each keeping the one it runs inside of.
+Throws exception if the stack can't be allocated */
+class Generator
+{
+public:
+	Generator(StackAllocator* stacks, void (*fn)(void*), void* arg);
+	~Generator(){ _stacks -> release(&_stack); }
+	bool next(Thread* consumer, void** value);
+	void yield(void* value);
+	void run();
+	void abandon();
+	bool isRunning(){ return _consumer != nullptr; }
+	Generator* getOuter(){ return _outer; }
+	Stack* getStack(){ return &_stack; }
+	bool growStack(char* faultAddress){ 
+		return _stacks -> grow(&_stack, faultAddress); }
+	bool stackOverflowedAt(char* faultAddress){
+		return _stacks -> inGuardPage(&_stack, faultAddress); }
+	
+private:
+	sigjmp_buf _env; // where the generator continues
+	sigjmp_buf _consumerEnv; // where its consumer continues
+	void* _value; // the value yielded last
+	Thread* _consumer; // while the generator runs
+	Generator* _outer; // the generator its consumer ran while calling next
+	bool _finished;
+	void (*_fn)(void*);
+	void* _arg;
+	StackAllocator* _stacks;
+	Stack _stack;
+};
+
 
+/* This class is the run stack shared by the threads spawned with a shared
+stack (see uthread_attr), so that mostly idle threads only cost the memory 
+their frames take. The frames of the shared thread which ran on it last stay
+on it while other threads run, and are copied out (see Thread) only when 
+another shared thread switches in, whose frames are copied back first. The 
+copying runs on a small stack of the class's own, as the frames of the 
+thread switching out may be overwritten. Throws exception if the stack can't
+be allocated */
+class SharedStack
+{
+public:
+	SharedStack(StackAllocator* stacks);
+	~SharedStack();
+	Stack* getStack(){ return &_stack; }
+	void switchTo(Thread* thread);
+	Thread* restore();
+	void forget(Thread* thread);
+	
+private:
+	StackAllocator* _stacks;
+	Stack _stack;
+	char* _restoreStack;
+	sigjmp_buf _restoreEnv; // the start of sharedStackTrampoline
+	Thread* _owner; // whose frames are on the stack
+	Thread* _incoming; // switching in, while the stack is restored
+};
 
+
+/* This class holds the tasks posted to the library's task runner. Tasks 
+posted for immediate execution wait in a FIFO queue. Delayed tasks wait in a
+heap ordered by the quantum at which they are due, so that checking for due
+tasks on every scheduling decision takes constant time regardless of how many
+are waiting, and are moved to the FIFO queue once due. */
+class TaskQueue
+{
+public:
+	void post(void (*fn)(void*), void* arg);
+	void postAt(int64_t dueQuantum, void (*fn)(void*), void* arg);
+	void moveDueTasks(int64_t currentQuantum);
+	PostedTask pop();
+	bool notEmpty(){ return !_ready.empty(); }
+	
 private:
-	std::list<Thread*> _list;
+	std::deque<PostedTask> _ready;
+	std::priority_queue<PostedTask, std::vector<PostedTask>, 
+	                    std::greater<PostedTask> > _delayed;
 };
 
+/* This class holds the thread-local keys created so far, and the 
+destructor of each. Keys are numbered in order of creation, and index the 
+slots of the thread objects */
+class ThreadKeys
+{
+public:
+	ThreadKeys():_size(0){}
+	int create(void (*destructor)(void*));
+	void (*getDestructor(int key))(void*){ return _destructors[key]; }
+	int size(){ return _size; }
+	
+private:
+	void (*_destructors[UTHREAD_KEYS_MAX])(void*);
+	int _size;
+};
+
+
+/* This class holds the free regions of the threads' arenas, all of the same
+size, for reuse. A thread takes regions one at a time as it allocates, and 
+its whole chain of regions is released together when it terminates. Larger
+regions (taken by allocations which don't fit in a region) and regions 
+beyond the pool's maximal size are freed instead. Allocation failures are 
+reported by a thrown exception */
+class ArenaPool
+{
+public:
+	ArenaPool(size_t regionSize, int maxSize):
+		_regionSize(regionSize),_maxSize(maxSize),_free(nullptr),_size(0){}
+	~ArenaPool();
+	ArenaRegion* take(size_t size);
+	void release(ArenaRegion* chain);
+	int size(){ return _size; }
+	
+private:
+	size_t _regionSize;
+	int _maxSize;
+	ArenaRegion* _free;
+	int _size;
+};
+
+
+/* A generator, as its consumers hold it */
+struct uthread_generator : public Generator
+{
+	uthread_generator(StackAllocator* stacks, void (*fn)(void*), void* arg):
+		Generator(stacks, fn, arg){}
+};
+
+
+/* The state of a job submitted to the executor, which its submitter holds
+as a uthread_future */
+struct uthread_future
+{
+	void* result;
+	bool done;
+	bool released; // given up by its holder, so it is freed once done
+	Thread* waiter; // the thread BLOCKED until it is done, if any
+	void (*thenFn)(void*, void*); // the continuation, run once it is done
+	void* thenArg;
+};
+
+/* A job submitted to the executor: a function to run with its argument, 
+whose result is set in the future */
+struct ExecutorJob
+{
+	void* (*fn)(void*);
+	void* arg;
+	uthread_future* future;
+};
+
+/* This class holds the executor's bounded FIFO ring of jobs, its worker 
+threads, and the threads waiting on it - idle workers, submitters waiting 
+for room in the ring, and threads waiting for futures. Future objects are 
+kept in a free list, so that in steady state submitting a job doesn't 
+allocate memory.
+The waiting threads are BLOCKED, and are kept in vectors rather than thread
+lists, as the user may resume a BLOCKED thread. A waiting thread removes 
+itself when it runs again, so a thread taken from a vector is always still
+waiting */
+class Executor
+{
+public:
+	Executor(int capacity, int workers);
+	~Executor();
+	bool push(const ExecutorJob& job);
+	bool pop(ExecutorJob* job);
+	bool full(){ return _size == (int)_jobs.size(); }
+	uthread_future* newFuture();
+	void freeFuture(uthread_future* future);
+	void addWorker(Thread* worker){ _workers.push_back(worker); }
+	bool isWorker(Thread* thread);
+	void waitForJob(Thread* worker){ addWaiter(&_idleWorkers, worker); }
+	Thread* takeIdleWorker(){ return takeWaiter(&_idleWorkers); }
+	void waitForRoom(Thread* submitter){ addWaiter(&_submitters, submitter); }
+	Thread* takeSubmitter(){ return takeWaiter(&_submitters); }
+	void waitForFuture(uthread_future* future, Thread* waiter);
+	Thread* takeFutureWaiter(uthread_future* future);
+	void stopWaiting(Thread* thread);
+	void forget(Thread* thread);
+	
+private:
+	std::vector<ExecutorJob> _jobs;
+	int _head;
+	int _size;
+	std::vector<uthread_future*> _freeFutures;
+	std::vector<uthread_future*> _waitedFutures;
+	std::vector<Thread*> _workers;
+	std::vector<Thread*> _idleWorkers;
+	std::vector<Thread*> _submitters;
+	
+	static void addWaiter(std::vector<Thread*>* waiters, Thread* thread);
+	static Thread* takeWaiter(std::vector<Thread*>* waiters);
+	static void removeWaiter(std::vector<Thread*>* waiters, Thread* thread);
+};
+
+
 /* This class distributes id numbers for new threads, giving them the smallest
 id not already taken by an existing thread. Once an id is distrbuted, the 
 class assumes it is being used, until told otherwise. Internally implemented
@@ -150,6 +723,42 @@ private:
 	std::bitset<MAX_THREAD_NUM> _bitset;	
 };
 
+/* This class collects scheduler-wide statistics: context switch counts,
+thread spawn and termination counts and a histogram of context switch
+latencies (from the scheduler's entry until the next thread resumes).
+Bucket i of the histogram counts switches that took [2^i, 2^(i+1)) cycles.
+Cycles are converted to time using a calibration against the monotonic clock
+taken since the creation of the object. */
+class SchedulerStats
+{
+public:
+	SchedulerStats();
+	void switchStarted(){_switchStart = readCycles();}
+	void switchEnded();
+	void countSwitch(SwitchReason reason);
+	void countSpawn(){_threadsSpawned++;}
+	void countTermination(){_threadsTerminated++;}
+	uint64_t getTotalSwitches(){return _voluntarySwitches + 
+										_involuntarySwitches;}
+	uint64_t getVoluntarySwitches(){return _voluntarySwitches;}
+	uint64_t getInvoluntarySwitches(){return _involuntarySwitches;}
+	uint64_t getThreadsSpawned(){return _threadsSpawned;}
+	uint64_t getThreadsTerminated(){return _threadsTerminated;}
+	uint64_t getCyclesSinceInit(){return readCycles() - _initCycles;}
+	uint64_t getLatencyBucket(int bucket){return _latencyHistogram[bucket];}
+	double cyclesPerUsec();
+	
+private:
+	uint64_t _switchStart;
+	uint64_t _voluntarySwitches;
+	uint64_t _involuntarySwitches;
+	uint64_t _threadsSpawned;
+	uint64_t _threadsTerminated;
+	uint64_t _latencyHistogram[UTHREAD_LATENCY_BUCKETS];
+	uint64_t _initCycles;
+	struct timespec _initTime;
+};
+
 
 #endif
 
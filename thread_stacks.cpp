@@ -0,0 +1,451 @@
+/* implemenation of the thread_stacks header */
+
+#include "thread_stacks.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <algorithm>
+
+#define NDEBUG
+
+
+/* Creates an allocator of stacks of the given mode, which paints the stacks
+if paint is true. The sizes of growable stacks are rounded up to whole pages,
+and are ignored for fixed stacks */
+StackAllocator::StackAllocator(uthread_stack_mode mode, size_t maxSize,
+                               size_t initialCommit, bool paint, 
+                               size_t colorStride, int colors, bool guard)
+{
+	_mode = mode;
+	_paint = paint;
+	_colorStride = colorStride;
+	_colors = colors;
+	_guard = guard && mode != UTHREAD_STACK_GROWABLE;
+	_arenaNext = nullptr;
+	_arenaEnd = nullptr;
+	_pageSize = sysconf(_SC_PAGESIZE);
+	if(_mode == UTHREAD_STACK_GROWABLE)
+	{
+		_maxSize = roundToPages(maxSize);
+		_initialCommit = roundToPages(initialCommit);
+	}
+	else
+	{
+		_maxSize = STACK_SIZE;
+		_initialCommit = STACK_SIZE;
+	}
+}
+
+
+/* Rounds the given size up to a multiple of the page size */
+size_t StackAllocator::roundToPages(size_t size)
+{
+	return (size + _pageSize - 1) & ~(_pageSize - 1);
+}
+
+
+/* Allocates and returns a new stack. Throws exception if the memory can't
+be allocated */
+Stack StackAllocator::allocate()
+{
+	Stack stack;
+	allocateMany(&stack, 1);
+	return stack;
+}
+
+
+/* Allocates count new stacks into the given array. Growable stacks are 
+reserved by a single mapping, which is later unmapped stack by stack. Throws
+exception if the memory can't be allocated, in which case no stack is 
+allocated */
+void StackAllocator::allocateMany(Stack* stacks, int count)
+{
+	if(_mode == UTHREAD_STACK_MALLOC)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			//aligned to pages, so that its pages can be released
+			if(posix_memalign((void**)&stacks[i].base, _pageSize, 
+			                  STACK_SIZE*sizeof(char)) != FUNCTION_SUCCESS)
+			{
+				for(int j = 0; j < i; j++)
+				{
+					free(stacks[j].base);
+				}
+				fprintf(stderr, "system error: Can't allocate new thread's "\
+				"stack memory\n");
+				throw "can't allocate stack";
+			}
+			stacks[i].size = STACK_SIZE;
+			stacks[i].committedBottom = stacks[i].base;
+			paintRange(stacks[i].base, stacks[i].top());
+			paintGuard(&stacks[i]);
+		}
+		return;
+	}
+	
+	if(_mode == UTHREAD_STACK_HUGE)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			try
+			{
+				stacks[i].base = takeArenaStack();
+			}
+			catch(const char* e)
+			{
+				for(int j = 0; j < i; j++)
+				{
+					_arenaFree.push_back(stacks[j].base);
+				}
+				throw e;
+			}
+			stacks[i].size = STACK_SIZE;
+			stacks[i].committedBottom = stacks[i].base;
+			paintRange(stacks[i].base, stacks[i].top());
+			paintGuard(&stacks[i]);
+		}
+		return;
+	}
+
+	//reserving the stacks with their guard pages, and committing their tops
+	size_t slotSize = _maxSize + _pageSize;
+	char* mapping = (char*)mmap(NULL, slotSize * count, PROT_NONE,
+	                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, 
+	                            -1, 0);
+	if(mapping == MAP_FAILED)
+	{
+		fprintf(stderr, "system error: Can't reserve new thread's stack "\
+		"memory\n");
+		throw "can't reserve stack";
+	}
+
+	for(int i = 0; i < count; i++)
+	{
+		Stack* stack = &stacks[i];
+		stack -> base = mapping + slotSize * i + _pageSize;
+		stack -> size = _maxSize;
+		stack -> committedBottom = stack -> top() - _initialCommit;
+		if(mprotect(stack -> committedBottom, _initialCommit,
+		            PROT_READ | PROT_WRITE) != FUNCTION_SUCCESS)
+		{
+			munmap(mapping, slotSize * count);
+			fprintf(stderr, "system error: Can't commit new thread's stack "\
+			"memory\n");
+			throw "can't commit stack";
+		}
+		paintRange(stack -> committedBottom, stack -> top());
+	}
+}
+
+
+/* Frees the memory of the given stack */
+void StackAllocator::release(Stack* stack)
+{
+	assert(stack -> base != nullptr);
+
+	if(_mode == UTHREAD_STACK_MALLOC)
+	{
+		free(stack -> base);
+	}
+	else if(_mode == UTHREAD_STACK_HUGE)
+	{
+		_arenaFree.push_back(stack -> base);
+	}
+	else
+	{
+		munmap(stack -> base - _pageSize, stack -> size + _pageSize);
+	}
+	stack -> base = nullptr;
+}
+
+
+/* Returns the base of an unused huge page stack - a released one if there
+is any, and otherwise the next one in the arena, which grows by a chunk when
+it is used up. Throws exception if the chunk can't be mapped */
+char* StackAllocator::takeArenaStack()
+{
+	if(!_arenaFree.empty())
+	{
+		char* base = _arenaFree.back();
+		_arenaFree.pop_back();
+		return base;
+	}
+	
+	if(_arenaNext == _arenaEnd)
+	{
+		mapArenaChunk();
+	}
+	char* base = _arenaNext;
+	_arenaNext += STACK_SIZE;
+	return base;
+}
+
+
+/* Maps a new chunk of the arena, of as many huge pages as hold a stack. 
+Huge pages reserved by the system (MAP_HUGETLB) are used if there are any,
+and otherwise the chunk is aligned to a huge page and advised to be backed by
+transparent huge pages (which the kernel may still back by small pages). 
+Throws exception if the chunk can't be mapped */
+void StackAllocator::mapArenaChunk()
+{
+	size_t size = (STACK_SIZE + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * 
+	              HUGE_PAGE_SIZE;
+	char* chunk = (char*)MAP_FAILED;
+#ifdef MAP_HUGETLB
+	chunk = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, 
+	                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	if(chunk == MAP_FAILED)
+	{
+		//mapping a huge page more, to cut the aligned chunk out of it
+		char* mapping = (char*)mmap(NULL, size + HUGE_PAGE_SIZE, 
+		                            PROT_READ | PROT_WRITE, 
+		                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(mapping == MAP_FAILED)
+		{
+			fprintf(stderr, "system error: Can't map new thread's stack "\
+			"memory\n");
+			throw "can't map stack arena";
+		}
+		
+		chunk = (char*)(((uintptr_t)mapping + HUGE_PAGE_SIZE - 1) & 
+		                ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+		if(chunk > mapping)
+		{
+			munmap(mapping, chunk - mapping);
+		}
+		munmap(chunk + size, mapping + HUGE_PAGE_SIZE - chunk);
+#ifdef MADV_HUGEPAGE
+		madvise(chunk, size, MADV_HUGEPAGE);
+#endif
+	}
+	
+	_arenaNext = chunk;
+	_arenaEnd = chunk + size / STACK_SIZE * STACK_SIZE;
+}
+
+
+/* Fills the guard at the bottom of the given fixed stack with STACK_CANARY,
+if stack guards are on */
+void StackAllocator::paintGuard(Stack* stack)
+{
+	if(!_guard)
+	{
+		return;
+	}
+	
+	for(uint64_t* word = (uint64_t*)stack -> base; 
+	    word < (uint64_t*)(stack -> base + STACK_GUARD_SIZE); word++)
+	{
+		*word = STACK_CANARY;
+	}
+}
+
+
+/* Returns true if the guard at the bottom of the given fixed stack still 
+holds STACK_CANARY, that is, if its thread hasn't overflowed it */
+bool StackAllocator::guardIntact(Stack* stack)
+{
+	for(uint64_t* word = (uint64_t*)stack -> base; 
+	    word < (uint64_t*)(stack -> base + STACK_GUARD_SIZE); word++)
+	{
+		if(*word != STACK_CANARY)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/* Commits the part of a growable stack needed by an access to faultAddress,
+with STACK_GROWTH_HEADROOM below it, but never beyond the stack's maximal 
+size. A null faultAddress stands for an unknown address below the committed
+part (when the kernel fails to push a signal frame on the stack), in which 
+case the stack grows by STACK_GROWTH_HEADROOM. Only makes system calls which
+are safe to make from a signal handler.
+Returns true if the access may be retried, and false if the address isn't in
+the uncommitted part of the stack, or is past its maximal size (a stack
+overflow) */
+bool StackAllocator::grow(Stack* stack, char* faultAddress)
+{
+	if(faultAddress == nullptr)
+	{
+		faultAddress = stack -> committedBottom - 1;
+	}
+	if(_mode != UTHREAD_STACK_GROWABLE || faultAddress < stack -> base ||
+	   faultAddress >= stack -> committedBottom)
+	{
+		return false;
+	}
+
+	char* newBottom = stack -> base;
+	if(faultAddress - stack -> base > STACK_GROWTH_HEADROOM)
+	{
+		newBottom = (char*)((uintptr_t)(faultAddress - STACK_GROWTH_HEADROOM)
+		                    & ~(uintptr_t)(_pageSize - 1));
+	}
+
+	if(mprotect(newBottom, stack -> committedBottom - newBottom,
+	            PROT_READ | PROT_WRITE) != FUNCTION_SUCCESS)
+	{
+		return false;
+	}
+	paintRange(newBottom, stack -> committedBottom);
+	stack -> committedBottom = newBottom;
+	return true;
+}
+
+
+/* Returns true if the address is in the guard page below a growable stack,
+that is, if an access to it overflowed the stack */
+bool StackAllocator::inGuardPage(Stack* stack, char* address)
+{
+	return _mode == UTHREAD_STACK_GROWABLE && address < stack -> base &&
+	       address >= stack -> base - _pageSize;
+}
+
+
+/* Fills the stack memory between bottom and top with STACK_CANARY, if 
+painting is on. Safe to call from a signal handler */
+void StackAllocator::paintRange(char* bottom, char* top)
+{
+	if(!_paint)
+	{
+		return;
+	}
+	
+	for(uint64_t* word = (uint64_t*)bottom; word < (uint64_t*)top; word++)
+	{
+		*word = STACK_CANARY;
+	}
+}
+
+
+/* Returns the number of bytes from the top of the painted stack down to the
+deepest word written since it was painted. Returns 0 if painting is off */
+size_t StackAllocator::measureUsage(Stack* stack)
+{
+	if(!_paint)
+	{
+		return 0;
+	}
+	
+	uint64_t* word = (uint64_t*)stack -> committedBottom;
+	while(word < (uint64_t*)stack -> top() && *word == STACK_CANARY)
+	{
+		word++;
+	}
+	return stack -> top() - (char*)word;
+}
+
+
+/* Paints again the part of the stack used since it was last painted, so 
+that it may be measured afresh by a new thread */
+void StackAllocator::repaint(Stack* stack)
+{
+	paintRange(stack -> top() - measureUsage(stack), stack -> top());
+}
+
+
+/* Returns the committed pages of the given unused stacks to the system, as
+set by release. The stacks are sorted by address, and the pages of adjacent
+stacks are released by a single call (a growable stack's uncommitted part 
+and guard page hold no memory, so they may be included). Nothing is released
+while stacks are painted, as released pages lose their paint (or guard), nor
+from huge page stacks, as releasing a part of a huge page splits it */
+void StackAllocator::releasePages(std::vector<Stack*>* stacks, 
+                                  uthread_stack_release release)
+{
+	if(release == UTHREAD_STACK_KEEP || _paint || _guard || 
+	   _mode == UTHREAD_STACK_HUGE || stacks -> empty())
+	{
+		return;
+	}
+	
+	int advice = MADV_DONTNEED;
+#ifdef MADV_FREE
+	if(release == UTHREAD_STACK_FREE)
+	{
+		advice = MADV_FREE;
+	}
+#endif
+	
+	std::sort(stacks -> begin(), stacks -> end(), 
+	          [](Stack* first, Stack* second)
+	          { return first -> base < second -> base; });
+	
+	//the released range, [bottom, top), grows while stacks are adjacent
+	char* bottom = nullptr;
+	char* top = nullptr;
+	for(Stack* stack : *stacks)
+	{
+		char* stackBottom = stack -> committedBottom;
+		char* mappingBottom = stack -> base;
+		if(_mode == UTHREAD_STACK_GROWABLE)
+		{
+			mappingBottom -= _pageSize;
+		}
+		
+		if(top != nullptr && mappingBottom == top)
+		{
+			top = stack -> top();
+			continue;
+		}
+		if(top != nullptr)
+		{
+			adviseRange(bottom, top, advice);
+		}
+		bottom = stackBottom;
+		top = stack -> top();
+	}
+	adviseRange(bottom, top, advice);
+}
+
+
+/* Gives the advice on the whole pages between bottom (page aligned) and 
+top. The partial page below a top that isn't aligned is left, as it may hold
+other memory */
+void StackAllocator::adviseRange(char* bottom, char* top, int advice)
+{
+	top = (char*)((uintptr_t)top & ~(uintptr_t)(_pageSize - 1));
+	if(top > bottom)
+	{
+		madvise(bottom, top - bottom, advice);
+	}
+}
+
+/* Adds the stack usage of a terminated thread with the given entry 
+function */
+void StackUsageTable::record(void* entry, size_t usage)
+{
+	uthread_entry_stack_usage& entryUsage = _entries[entry];
+	entryUsage.entry = entry;
+	entryUsage.threads++;
+	entryUsage.total_bytes += usage;
+	if(usage > entryUsage.max_bytes)
+	{
+		entryUsage.max_bytes = usage;
+	}
+}
+
+
+/* Copies the usage of at most capacity entry functions to usages, and 
+returns the number of entry functions recorded */
+int StackUsageTable::report(uthread_entry_stack_usage* usages, int capacity)
+{
+	int count = 0;
+	for(auto& entry : _entries)
+	{
+		if(count < capacity)
+		{
+			usages[count] = entry.second;
+		}
+		count++;
+	}
+	return count;
+}
@@ -0,0 +1,129 @@
+/*This module holds the allocation of thread stacks used by the uthreads
+library */
+
+#ifndef _THREAD_STACKS_
+#define _THREAD_STACKS_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "uthreads.h"
+#include "general_macros.h"
+
+/* The space committed below the faulting address when a growable stack 
+grows, so that the signal frames pushed on top of the deepest frame (up to a
+few kilobytes with AVX-512 state) usually land in committed memory */
+#define STACK_GROWTH_HEADROOM (16 * 1024)
+
+/* The pattern painted over unused stack memory when stack painting is on. 
+Any word of the stack which doesn't hold it was written by the thread */
+#define STACK_CANARY 0x5AFEC0DE5AFEC0DEULL
+
+/* The bytes at the bottom of a fixed stack which hold STACK_CANARY when 
+stack guards are on. A thread which overwrote them overflowed its stack */
+#define STACK_GUARD_SIZE 64
+
+/* The size of the huge pages backing the arena of huge page stacks */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+
+/* The memory of a single thread stack: size usable bytes starting at base.
+In growable stacks only the top of it is committed, from committedBottom up,
+and the page below base is a guard page which is never committed */
+struct Stack
+{
+	char* base;
+	size_t size;
+	char* committedBottom;
+
+	char* top(){ return base + size; }
+};
+
+
+/* This class allocates and frees thread stacks according to the stack mode
+given to the library. Fixed stacks are STACK_SIZE bytes taken from the heap.
+Huge page stacks are STACK_SIZE bytes carved in turn out of chunks of huge 
+pages (the arena), and reused from a free list when released, so that many
+stacks share each TLB entry. The arena is never unmapped, as the stack a 
+thread calling exit runs on may be in it. 
+Growable stacks reserve maxSize bytes of address space (with MAP_NORESERVE, so
+they cost no memory until used), and commit only initialCommit bytes at their
+top. Further pages are committed by grow, called from the library's SIGSEGV
+handler when the thread touches the uncommitted part, so memory use follows
+the actual depth of each stack, up to maxSize.
+With painting, the committed memory of each stack is filled with 
+STACK_CANARY, so the deepest byte a thread touched can be found by scanning
+its stack up from the bottom for the first overwritten word. A reused stack 
+is repainted only down to the depth it was used to.
+The committed pages of unused stacks may be returned to the system in 
+batches, sorted by address so that adjacent stacks take a single call.
+As all stacks start at page boundaries, the allocator also colors them: each
+thread starts its stack a color offset (depending on its id) below the top,
+so that the top frames of threads switched in turn don't map to the same 
+cache sets. Fixed stacks, which have no guard page, may have a guard of 
+STACK_GUARD_SIZE bytes of STACK_CANARY at their bottom instead, checked by
+overflowed.
+Allocation failures are reported by a thrown exception */
+class StackAllocator
+{
+public:
+	StackAllocator(uthread_stack_mode mode, size_t maxSize,
+	               size_t initialCommit, bool paint, size_t colorStride, 
+	               int colors, bool guard);
+	Stack allocate();
+	void allocateMany(Stack* stacks, int count);
+	void release(Stack* stack);
+	bool grow(Stack* stack, char* faultAddress);
+	bool inGuardPage(Stack* stack, char* address);
+	size_t measureUsage(Stack* stack);
+	void repaint(Stack* stack);
+	void releasePages(std::vector<Stack*>* stacks, 
+	                  uthread_stack_release release);
+	bool isPainting(){ return _paint; }
+	uthread_stack_mode getMode(){ return _mode; }
+	size_t getInitialCommit(){ return _initialCommit; }
+	size_t colorOffset(int id){ 
+		return id < 0 ? 0 : (size_t)(id % _colors) * _colorStride; }
+	bool overflowed(Stack* stack){ 
+		return _guard && !guardIntact(stack); }
+
+private:
+	uthread_stack_mode _mode;
+	size_t _pageSize;
+	size_t _maxSize;
+	size_t _initialCommit;
+	bool _paint;
+	size_t _colorStride;
+	int _colors;
+	bool _guard;
+	std::vector<char*> _arenaFree; // bases of released huge page stacks
+	char* _arenaNext; // the next stack carved out of the arena's last chunk
+	char* _arenaEnd;
+
+	size_t roundToPages(size_t size);
+	void paintRange(char* bottom, char* top);
+	void adviseRange(char* bottom, char* top, int advice);
+	char* takeArenaStack();
+	void mapArenaChunk();
+	void paintGuard(Stack* stack);
+	bool guardIntact(Stack* stack);
+};
+
+
+/* This class aggregates the stack usage measured when threads terminate by 
+their entry function, so that stacks can be sized by the deepest usage seen
+for each kind of thread */
+class StackUsageTable
+{
+public:
+	void record(void* entry, size_t usage);
+	int report(uthread_entry_stack_usage* usages, int capacity);
+
+private:
+	std::unordered_map<void*, uthread_entry_stack_usage> _entries;
+};
+
+
+#endif
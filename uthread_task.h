@@ -0,0 +1,229 @@
+/* C++20 coroutine tasks for the uthreads library. A uthread::task<T> is a
+stackless coroutine, so millions of them may be in flight without a stack
+each. Tasks are resumed by the library's task runner thread (see
+uthread_post), so they share the scheduler and the quantum timer with the
+library's stackful threads, and the two may wait for each other:
+ * A task may co_await another task, uthread::task_yield() and
+   uthread::task_sleep(num_quantums).
+ * A stackful thread may start a task, and join it - waiting for its result
+   while BLOCKED, through uthread_wait_flag.
+Tasks must only be used after uthread_init, and must not call library
+functions that block or put the running thread to sleep, as they run on the
+shared task runner thread. */
+
+#ifndef _UTHREAD_TASK_H
+#define _UTHREAD_TASK_H
+
+#if __cplusplus < 202002L
+#error "uthread_task.h requires C++20"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "uthreads.h"
+
+namespace uthread
+{
+
+/* Resumes the coroutine with the given address. Posted to the task runner */
+inline void resumeCoroutine(void* address)
+{
+	std::coroutine_handle<>::from_address(address).resume();
+}
+
+
+/* Awaited to let the other posted tasks run before the awaiting task
+continues */
+struct TaskYieldAwaiter
+{
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> handle) const
+	{
+		uthread_post(resumeCoroutine, handle.address());
+	}
+	void await_resume() const noexcept {}
+};
+
+/* Awaited to suspend the awaiting task for a number of quantums, as
+uthread_sleep does for a thread */
+struct TaskSleepAwaiter
+{
+	int numQuantums;
+
+	bool await_ready() const noexcept { return numQuantums <= 0; }
+	void await_suspend(std::coroutine_handle<> handle) const
+	{
+		uthread_post_after(numQuantums, resumeCoroutine, handle.address());
+	}
+	void await_resume() const noexcept {}
+};
+
+/* Returns an awaitable that reposts the awaiting task to the back of the
+task runner's queue */
+inline TaskYieldAwaiter task_yield()
+{
+	return TaskYieldAwaiter();
+}
+
+/* Returns an awaitable that suspends the awaiting task for num_quantums
+quantums (not including the current quantum) */
+inline TaskSleepAwaiter task_sleep(int numQuantums)
+{
+	return TaskSleepAwaiter{numQuantums};
+}
+
+
+/* The state shared by all task promises: what to do once the task is done.
+A task awaited by another task resumes it directly; a task joined by a
+thread sets the done flag and resumes the thread */
+struct TaskPromiseBase
+{
+	std::coroutine_handle<> continuation;
+	std::exception_ptr error;
+	volatile int done = 0;
+	int waiterTid = -1;
+
+	/* Runs when the task's body completes */
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept { return false; }
+
+		template<typename Promise>
+		std::coroutine_handle<> await_suspend(
+			std::coroutine_handle<Promise> handle) const noexcept
+		{
+			TaskPromiseBase& promise = handle.promise();
+			promise.done = 1;
+			if(promise.continuation)
+			{
+				return promise.continuation;
+			}
+			if(promise.waiterTid >= 0)
+			{
+				uthread_resume(promise.waiterTid);
+			}
+			return std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+	std::suspend_always initial_suspend() const noexcept { return {}; }
+	FinalAwaiter final_suspend() const noexcept { return {}; }
+	void unhandled_exception() { error = std::current_exception(); }
+};
+
+
+/* Holds the value returned by a task */
+template<typename T>
+struct TaskPromise : TaskPromiseBase
+{
+	std::optional<T> value;
+
+	void return_value(T result) { value.emplace(std::move(result)); }
+
+	T takeResult()
+	{
+		if(error)
+		{
+			std::rethrow_exception(error);
+		}
+		return std::move(*value);
+	}
+};
+
+template<>
+struct TaskPromise<void> : TaskPromiseBase
+{
+	void return_void() {}
+
+	void takeResult()
+	{
+		if(error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+};
+
+
+/* A lazily started coroutine returning a T. The task object owns the
+coroutine's frame, so it must outlive the coroutine's completion. A task
+starts running when it is awaited by another task, or when started by
+start() or join(). */
+template<typename T = void>
+class task
+{
+public:
+	struct promise_type : TaskPromise<T>
+	{
+		task get_return_object()
+		{
+			return task(std::coroutine_handle<promise_type>::from_promise(
+			            *this));
+		}
+	};
+
+	task(task&& other) noexcept : 
+		_handle(std::exchange(other._handle, nullptr)),
+		_started(other._started) {}
+	task(const task&) = delete;
+	task& operator=(const task&) = delete;
+	~task()
+	{
+		if(_handle)
+		{
+			_handle.destroy();
+		}
+	}
+
+	/* Returns true if the task completed */
+	bool done() const { return _handle.promise().done != 0; }
+
+	/* Posts the task to the task runner. Has no effect if the task was
+	already started */
+	void start()
+	{
+		if(!_started)
+		{
+			_started = true;
+			uthread_post(resumeCoroutine, _handle.address());
+		}
+	}
+
+	/* Starts the task if needed, and makes the calling thread wait until it
+	completes. Returns the task's result, or rethrows its exception. Must be
+	called by a stackful thread, not by a task */
+	T join()
+	{
+		_handle.promise().waiterTid = uthread_get_tid();
+		start();
+		uthread_wait_flag(&_handle.promise().done);
+		return _handle.promise().takeResult();
+	}
+
+	/* Awaiting a task runs it, and continues the awaiting task (without
+	going through the task runner's queue) once it completes */
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting)
+	{
+		_started = true;
+		_handle.promise().continuation = awaiting;
+		return _handle;
+	}
+	T await_resume() { return _handle.promise().takeResult(); }
+
+private:
+	explicit task(std::coroutine_handle<promise_type> handle) :
+		_handle(handle) {}
+
+	std::coroutine_handle<promise_type> _handle;
+	bool _started = false;
+};
+
+}
+
+#endif
@@ -0,0 +1,244 @@
+/* uthread-top: shows the live stats a process publishes with
+uthread_stats_publish, refreshed every interval. The segment is mapped read
+only and read under its sequence locks, so watching a process costs it
+nothing - it is never signalled, stopped or waited for.
+
+Usage: uthread-top <segment name> [interval msecs] [iterations] */
+
+#include "stats_segment.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+#define DEFAULT_INTERVAL_MSECS 1000
+
+
+/* A copy of the segment's totals and records, read at one refresh */
+struct Snapshot
+{
+	StatsTotals totals;
+	vector<StatsThreadData> threads;
+};
+
+
+/* Maps the segment of the given name, and checks its header. Returns null
+(after printing why) if it can't be mapped or isn't a stats segment */
+static StatsHeader* mapSegment(const char* name)
+{
+	int fd = shm_open(name, O_RDONLY, 0);
+	if(fd == -1)
+	{
+		fprintf(stderr, "uthread-top: can't open %s\n", name);
+		return nullptr;
+	}
+	struct stat info;
+	if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(StatsHeader))
+	{
+		fprintf(stderr, "uthread-top: %s isn't a stats segment\n", name);
+		close(fd);
+		return nullptr;
+	}
+	void* segment = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(segment == MAP_FAILED)
+	{
+		fprintf(stderr, "uthread-top: can't map %s\n", name);
+		return nullptr;
+	}
+
+	StatsHeader* header = (StatsHeader*)segment;
+	uint32_t magic = header -> magic;
+	atomic_thread_fence(memory_order_acquire);
+	if(magic != STATS_SEGMENT_MAGIC ||
+	   header -> version != STATS_SEGMENT_VERSION ||
+	   header -> maxThreads <= 0 ||
+	   statsSegmentSize(header -> maxThreads) > (size_t)info.st_size)
+	{
+		fprintf(stderr, "uthread-top: %s isn't a stats segment of this "
+		        "version\n", name);
+		munmap(segment, info.st_size);
+		return nullptr;
+	}
+	return header;
+}
+
+
+/* Reads the totals and the records in use of the given segment */
+static void takeSnapshot(StatsHeader* header, Snapshot* snapshot)
+{
+	seqlockRead(header -> seq, &header -> totals, &snapshot -> totals);
+
+	StatsRecord* records = statsRecords(header);
+	snapshot -> threads.clear();
+	for(int tid = 0; tid < header -> maxThreads; tid++)
+	{
+		StatsThreadData data;
+		seqlockRead(records[tid].seq, &records[tid].data, &data);
+		if(data.tid != STATS_NO_THREAD)
+		{
+			snapshot -> threads.push_back(data);
+		}
+	}
+}
+
+
+/* Returns the per-second rate of a counter which grew from before to after
+over the given seconds */
+static double rate(uint64_t before, uint64_t after, double seconds)
+{
+	return seconds > 0 && after >= before ? (after - before) / seconds : 0;
+}
+
+
+/* Prints the snapshot now, with rates taken against the snapshot before
+(null before the first one). The threads of both snapshots are in order of
+their ids */
+static void printSnapshot(StatsHeader* header, const Snapshot& now,
+                          const Snapshot* before)
+{
+	const StatsTotals& totals = now.totals;
+	double seconds = 0;
+	if(before != nullptr)
+	{
+		seconds = (totals.publishedNsecs - before -> totals.publishedNsecs)
+		          / 1e9;
+	}
+
+	printf("uthread-top - pid %d, %d threads, %d ready, %d sleeping, "
+	       "running %d%s\n", header -> pid, totals.liveThreads,
+	       totals.readyLength, totals.sleepers, totals.runningTid,
+	       totals.closed ? " (closed)" : "");
+	printf("quantums %lld, spawned %llu, terminated %llu\n",
+	       (long long)totals.totalQuantums,
+	       (unsigned long long)totals.threadsSpawned,
+	       (unsigned long long)totals.threadsTerminated);
+	if(before != nullptr)
+	{
+		const StatsTotals& last = before -> totals;
+		printf("switches/s %.0f voluntary, %.0f involuntary\n",
+		       rate(last.voluntarySwitches, totals.voluntarySwitches,
+		            seconds),
+		       rate(last.involuntarySwitches, totals.involuntarySwitches,
+		            seconds));
+	}
+	printf("\n%6s %-9s %10s %10s %10s %6s\n", "TID", "STATE", "QUANTUMS",
+	       "VOL/s", "INVOL/s", "CPU%");
+
+	//Both lists are sorted by id, so they are walked together
+	size_t last = 0;
+	double cyclesPerSecond = header -> cyclesPerUsec * 1e6;
+	for(const StatsThreadData& thread : now.threads)
+	{
+		const StatsThreadData* previous = nullptr;
+		if(before != nullptr)
+		{
+			while(last < before -> threads.size() &&
+			      before -> threads[last].tid < thread.tid)
+			{
+				last++;
+			}
+			if(last < before -> threads.size() &&
+			   before -> threads[last].tid == thread.tid)
+			{
+				previous = &before -> threads[last];
+			}
+		}
+
+		const char* state = "?";
+		if(thread.state >= 0 && thread.state < NUM_STATS_STATES)
+		{
+			state = STATS_STATE_NAMES[thread.state];
+		}
+		printf("%6d %-9s %10d", thread.tid, state, thread.quantums);
+		if(previous != nullptr && seconds > 0)
+		{
+			printf(" %10.0f %10.0f %6.1f\n",
+			       rate(previous -> voluntarySwitches,
+			            thread.voluntarySwitches, seconds),
+			       rate(previous -> involuntarySwitches,
+			            thread.involuntarySwitches, seconds),
+			       100 * rate(previous -> runCycles, thread.runCycles,
+			                  seconds) / cyclesPerSecond);
+		}
+		else
+		{
+			printf(" %10s %10s %6s\n", "-", "-", "-");
+		}
+	}
+	fflush(stdout);
+}
+
+
+/* Refreshes the view of the given segment until the process closes it or
+exits, or for the given number of iterations if positive. Rates are taken
+between publications, so they are kept while no new one arrives */
+int main(int argc, char** argv)
+{
+	if(argc < 2 || argc > 4)
+	{
+		fprintf(stderr, "usage: %s <segment name> [interval msecs] "
+		        "[iterations]\n", argv[0]);
+		return 1;
+	}
+	int intervalMsecs = argc > 2 ? atoi(argv[2]) : DEFAULT_INTERVAL_MSECS;
+	int iterations = argc > 3 ? atoi(argv[3]) : 0;
+	if(intervalMsecs <= 0)
+	{
+		fprintf(stderr, "uthread-top: the interval must be positive\n");
+		return 1;
+	}
+
+	StatsHeader* header = mapSegment(argv[1]);
+	if(header == nullptr)
+	{
+		return 1;
+	}
+
+	bool clearScreen = isatty(STDOUT_FILENO);
+	Snapshot now = {}, before = {}, published = {};
+	struct timespec interval;
+	interval.tv_sec = intervalMsecs / 1000;
+	interval.tv_nsec = (intervalMsecs % 1000) * 1000000L;
+
+	for(int i = 0; iterations <= 0 || i < iterations; i++)
+	{
+		takeSnapshot(header, &now);
+		if(published.totals.publishedNsecs != 0 &&
+		   now.totals.publishedNsecs != published.totals.publishedNsecs)
+		{
+			before = published;
+		}
+		bool haveBefore = before.totals.publishedNsecs != 0;
+		published = now;
+
+		if(clearScreen)
+		{
+			printf("\033[H\033[J");
+		}
+		printSnapshot(header, now, haveBefore ? &before : nullptr);
+
+		if(now.totals.closed)
+		{
+			break;
+		}
+		if(kill(header -> pid, 0) != 0 && errno == ESRCH)
+		{
+			printf("uthread-top: process %d exited\n", header -> pid);
+			break;
+		}
+		if(iterations <= 0 || i + 1 < iterations)
+		{
+			nanosleep(&interval, NULL);
+		}
+	}
+	return 0;
+}
@@ -8,69 +8,225 @@ using any other service */
 #include <stdio.h>
 #include <signal.h>
 #include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <atomic>
 
 #include "thread_classes.h"
+#include "scheduler_trace.h"
+#include "remote_queue.h"
+#include "sampling_profiler.h"
+#include "stats_segment.h"
 #include "general_macros.h" 
 
 #define NEDBUG
 
 #define MAIN_ID 0
 #define JMP_VALUE 1
+#define FAULT_STACK_SIZE (64 * 1024) // room for the largest signal frames
+#define STACK_OVERFLOW_MESSAGE_SIZE 80
+#define SIM_SEED_MIX 0x9E3779B97F4A7C15ULL // keeps a zero seed's state nonzero
 
 using namespace std;
 
-Thread* runningThread = nullptr;
-ThreadCollection* collection = nullptr;
-Timer* timer = nullptr;
-ReadyQueue* readyQueue = nullptr;
-SleepManager* sleepManager = nullptr;
-IdDistributor* idDistributor = nullptr;
+/* The state of a runtime of the library. Every kernel thread calling 
+uthread_init runs its own runtime, reached through the thread-local pointer 
+runtime, so runtimes share nothing and need no locks. The library's signals
+are delivered to the kernel thread they concern (the quantum timer of a 
+runtime signals its own kernel thread), so the signal handlers find the 
+right runtime too */
+struct uthread_runtime
+{
+	Thread* runningThread = nullptr;
+	Thread* fpuLive = nullptr; // whose floating point control state is loaded
+	bool simulated = false; // see uthread_options.sim_mode
+	uint64_t simState = 0; // of the simulation's pseudo-random sequence
+	int simPreemptOdds = 0;
+	ThreadCollection* collection = nullptr;
+	ThreadTable* threadTable = nullptr;
+	Timer* timer = nullptr;
+	ReadyQueue* readyQueue = nullptr;
+	SleepManager* sleepManager = nullptr;
+	IdDistributor* idDistributor = nullptr;
+	ThreadPool* threadPool = nullptr;
+	SchedulerStats* schedulerStats = nullptr;
+	TraceBuffer* traceStorage = nullptr; //kept after tracing stops, for dumping
+	TaskQueue* taskQueue = nullptr;
+	Thread* taskRunner = nullptr; //created on demand, by the first posted task
+	StackAllocator* stackAllocator = nullptr;
+	char* faultStack = nullptr; //the alternate stack of the SIGSEGV handler
+	Thread* exitedThread = nullptr; //terminated itself, its stack in use
+	StackUsageTable* stackUsageTable = nullptr;
+	ThreadReaper* threadReaper = nullptr;
+	int reapBatch = UTHREAD_DEFAULT_REAP_BATCH;
+	bool reapPosted = false; //a reaping task waits for the task runner
+	ThreadKeys* threadKeys = nullptr;
+	ArenaPool* arenaPool = nullptr; //free regions of the threads' arenas
+	SharedStack* sharedStack = nullptr; //created by the first shared thread
+	Profiler* profiler = nullptr; //kept after profiling stops, for dumping
+	StatsSegment* statsSegment = nullptr; //set by uthread_stats_publish
+	int statsPeriod = 0; //scheduling decisions between publications
+	void** volatile runningSlots = nullptr; //the running thread's key values
+	RemoteQueue* remoteQueue = nullptr;
+	bool remoteTasks = false; //see uthread_options.remote_tasks
+	Executor* executor = nullptr; //created by uthread_executor_start
+	int totalQuantumCounter = 0;
+};
+
+thread_local uthread_runtime* runtime = nullptr;
+//the first runtime initialized, targeted by uthread_resume_remote
+std::atomic<uthread_runtime*> primaryRuntime(nullptr);
+
+/* Returns the set holding only SIGVTALRM */
+sigset_t makeAlarmSignalSet()
+{
+	sigset_t signalSet;
+	sigemptyset(&signalSet);
+	sigaddset(&signalSet, SIGVTALRM);
+	return signalSet;
+}
 
-sigset_t alarmSignalSet;
-int totalQuantumCounter = 0;
+const sigset_t alarmSignalSet = makeAlarmSignalSet();
 
-void scheduler(bool calledByQuantumManager);
+void scheduler(SwitchReason reason);
 void switchThreads(Thread* runnerUp);
 void quantumHandler(int sigNum);
 void installSIGVTALRMHandler();
+void stackFaultHandler(int sigNum, siginfo_t* info, void* context);
+void installStackFaultHandler();
+void installAlternateStack();
+void profileHandler(int sigNum, siginfo_t* info, void* context);
+void installProfileHandler();
+void* userEntryOf(Thread* thread);
 void maskSIGVRALRM();
 void unmaskSIGVRALRM();
 void ignorePendingSIGVTALRM();
 void cleanAndAbort(int exitSig);
+void createTaskRunner();
+void wakeTaskRunner();
+void runVoidFunction(void* f);
+void scheduleReap(bool mayReapNow);
+void runKeyDestructors(Thread* thread);
+Thread* findTerminable(int tid);
+void stopScheduling(Thread* thread);
+void drainRemoteRequests();
+void blockRunningThread();
+void wakeWaiter(Thread* thread);
+int spawnThread(void (*entry)(void*), void* arg, size_t storageSize,
+                void (*init)(void*, void*), void* ctx);
+Thread* createThread(void (*entry)(void*), void* arg, size_t storageSize,
+                     void (*init)(void*, void*), void* ctx);
+int spawnSharedThread(void (*entry)(void*), void* arg);
+bool checkThreadIds(const int* tids, int n, const char* action);
+bool validContext(uthread_context context);
+void publishStats(Thread* running);
+uint64_t nextSimRandom();
+void simulatePreemption();
 
 
 /* This function removes the next thread in the queue and activates it. 
 Additionally, it runs the sleeperManager's function which wakes up sleeping 
 threads. Also, If scheduler was called from the quantumManager (notified by
-parameter) moves runnin thread into the ready list. */
+the reason parameter) moves runnin thread into the ready list. */
 
-void scheduler(bool calledByQuantumManager=false)
+void scheduler(SwitchReason reason)
 {
+	runtime -> schedulerStats -> switchStarted();
+	
+	//A thread which wrote past the guard of its fixed stack (or of the stack
+	//of the generator it runs) has corrupted the memory below it. Reported 
+	//with a single write, as stdio's unbuffered stderr takes more of the 
+	//stack than is left
+	Generator* generator = runtime -> runningThread -> getGenerator();
+	if(reason != INITIALIZED && (runtime -> stackAllocator -> 
+	   overflowed(runtime -> runningThread -> getStack()) || 
+	   (generator != nullptr && 
+	    runtime -> stackAllocator -> overflowed(generator -> getStack()))))
+	{
+		char message[STACK_OVERFLOW_MESSAGE_SIZE];
+		int length = snprintf(message, sizeof(message), "thread library "\
+		                      "error: Thread %d overflowed its stack\n", 
+		                      runtime -> runningThread -> getId());
+		write(STDERR_FILENO, message, length);
+		cleanAndAbort(1);
+	}
+	
+	//A thread that terminated itself ran on its stack until it switched out,
+	//so it is only reaped by the next scheduling decision
+	if(runtime -> exitedThread != nullptr)
+	{
+		runtime -> threadReaper -> add(runtime -> exitedThread);
+		runtime -> exitedThread = nullptr;
+		scheduleReap(false);
+	}
+	if(reason == TERMINATED)
+	{
+		runtime -> exitedThread = runtime -> runningThread;
+	}
+	
+	//A full context's floating point control state is saved on a voluntary
+	//switch. A preempted thread's is saved in its signal frame, while the 
+	//handler runs with the default state
+	if(reason == PREEMPTED)
+	{
+		runtime -> fpuLive = nullptr;
+	}
+	else if(reason != TERMINATED && 
+	        runtime -> runningThread -> getContext() == UTHREAD_CONTEXT_FULL)
+	{
+		runtime -> runningThread -> saveFpu();
+	}
+	
+	runtime -> schedulerStats -> countSwitch(reason);
+	if(reason != TERMINATED && reason != INITIALIZED)
+	{
+		runtime -> runningThread -> countSwitch(reason);
+		traceEvent(TRACE_SWITCH_OUT, runtime -> runningThread -> getId(), 
+		           reason);
+	}
 	
-	totalQuantumCounter++;
+	runtime -> totalQuantumCounter++;
 	
 	
 	//Dealing with sleepers
-	sleepManager -> wakeUpSleepers(readyQueue);
+	runtime -> sleepManager -> wakeUpSleepers(runtime -> readyQueue);
+	
+	runtime -> sleepManager -> decrementThreads();
+	
+	//Dealing with requests from other kernel threads
+	drainRemoteRequests();
 	
-	sleepManager -> decrementThreads();
+	//Dealing with posted tasks which became due
+	runtime -> taskQueue -> moveDueTasks(runtime -> totalQuantumCounter);
+	if(runtime -> taskQueue -> notEmpty())
+	{
+		wakeTaskRunner();
+	}
 	
 	//If quantum manager called the scheduler, preempting the running thread
-	// and moving it to the ready list
-	if(calledByQuantumManager)
+	// and moving it to the ready list. A yielding thread is moved the same way
+	if(reason == PREEMPTED || reason == YIELDED)
 	{
-		runningThread -> setState(READY);
-		readyQueue -> add(runningThread);	
+		runtime -> runningThread -> setState(READY);
+		runtime -> readyQueue -> add(runtime -> runningThread);	
 	}
 	
 	
 	// Popping out next thread and running it
-	Thread* nextThread  = readyQueue -> pop();
+	Thread* nextThread  = runtime -> readyQueue -> pop();
 	assert(nextThread -> getState() == READY);
 	
 	nextThread -> setState(RUNNING);
 	nextThread -> incrementQuantumRuntime();
 	
+	if(runtime -> statsSegment != nullptr && 
+	   runtime -> totalQuantumCounter % runtime -> statsPeriod == 0)
+	{
+		publishStats(nextThread);
+	}
+	
 	switchThreads(nextThread);
 }
 
@@ -78,7 +234,10 @@ void scheduler(bool calledByQuantumManager=false)
 /* saves the environment of the current running thread, and runs the given
 thread. When a thread is resumed, it returns to action from this point.
 Before loading the new thread, the timer is reset, so it receives a single 
-quantum at most to run */
+quantum at most to run. The signal mask is saved only for full contexts, 
+and a full context's floating point control state is loaded only if it 
+isn't loaded already - integer contexts never touch it, but a preempted 
+thread of either context resumes with the state of its signal frame */
 
 void switchThreads(Thread* runnerUp)
 {
@@ -88,15 +247,44 @@ void switchThreads(Thread* runnerUp)
 							  // have occured during the context switch, 
 							  // allowing the next thread a full quantum
 							  
-	int retVal = sigsetjmp(*(runningThread -> getEnv()),1);
+	Thread* self = runtime -> runningThread;
+	int retVal = sigsetjmp(*(self -> getEnv()), 
+	                       self -> getContext() == UTHREAD_CONTEXT_FULL);
 	if(retVal == JMP_VALUE)
 	{
+		runtime -> schedulerStats -> switchEnded();
 		return;
 	}
+	if(self -> isShared())
+	{
+		self -> markSharedFrames();
+	}
+	
+	if(runnerUp -> getContext() == UTHREAD_CONTEXT_FULL && 
+	   runtime -> fpuLive != runnerUp)
+	{
+		runnerUp -> loadFpu();
+		runtime -> fpuLive = runnerUp;
+	}
+	//A preempted thread of either context resumes through the return from
+	//its signal handler, which loads the state saved in its signal frame
+	if(runnerUp -> wasPreempted())
+	{
+		runtime -> fpuLive = nullptr;
+	}
 
-	runningThread = runnerUp;
-	timer -> reset();
+	runtime -> runningThread = runnerUp;
+	runtime -> runningSlots = runnerUp -> getSlots();
+	if(runtime -> timer != nullptr)
+	{
+		runtime -> timer -> reset();
+	}
+	traceEvent(TRACE_SWITCH_IN, runnerUp -> getId());
 
+	if(runnerUp -> isShared())
+	{
+		runtime -> sharedStack -> switchTo(runnerUp);
+	}
 	siglongjmp(*(runnerUp -> getEnv()),JMP_VALUE);
 	
 }
@@ -111,19 +299,21 @@ in order to let the next thread run*/
 
 void quantumHandler(int sigNum)
 {
-	assert(runningThread -> getState() == RUNNING);
+	assert(runtime -> runningThread -> getState() == RUNNING);
+	traceEvent(TRACE_SIGNAL, runtime -> runningThread -> getId(), sigNum);
 	
 	//notifying scheduler that the quantum handler made the call
-	scheduler(true);
+	scheduler(PREEMPTED);
 }
 
 
 /*Installs the funtion quantumHandler as the handler for signal SIGVTALRM */
 void installSIGVTALRMHandler()
 {
-	struct sigaction signal;
+	struct sigaction signal = {};
 	
 	signal.sa_handler = &quantumHandler;
+	sigemptyset(&signal.sa_mask);
 	
 	if(sigaction(SIGVTALRM, &signal, NULL) == FUNCTION_FAIL)
 	{
@@ -132,11 +322,124 @@ void installSIGVTALRMHandler()
 	}
 }
 
+/* Handles a SIGSEGV while growable stacks are used. If the fault is in the
+uncommitted part of the running thread's stack, commits it and returns, so 
+the faulting access is retried. A SIGSEGV sent by the kernel (rather than 
+caused by an access) means it failed to push a signal frame on the running
+thread's stack, which is grown the same way - the signal whose frame failed
+is lost, which is harmless for the quantum timer. Any other fault, including
+a stack overflow beyond the stack's maximal size, gets the default action: 
+the handler is reset and the faulting access repeats. Runs on its own stack,
+with SIGVTALRM masked */
+void stackFaultHandler(int sigNum, siginfo_t* info, void* context)
+{
+	char* faultAddress = nullptr;
+	if(info -> si_code != SI_KERNEL)
+	{
+		faultAddress = (char*)info -> si_addr;
+	}
+	
+	if(runtime -> runningThread != nullptr && 
+	   runtime -> runningThread -> growStack(faultAddress))
+	{
+		return;
+	}
+	
+	//Reported with a single write, as stdio isn't safe in a signal handler
+	//and takes more of the alternate stack than it has
+	if(runtime -> runningThread != nullptr &&
+	   runtime -> runningThread -> stackOverflowedAt(faultAddress))
+	{
+		char message[STACK_OVERFLOW_MESSAGE_SIZE];
+		int length = snprintf(message, sizeof(message), "thread library "\
+		                      "error: Thread %d overflowed its stack\n", 
+		                      runtime -> runningThread -> getId());
+		write(STDERR_FILENO, message, length);
+	}
+	signal(SIGSEGV, SIG_DFL);
+}
+
+
+/* Installs stackFaultHandler as the handler of SIGSEGV, running on an 
+alternate signal stack, as the faulting thread's stack can't hold its 
+frame */
+void installStackFaultHandler()
+{
+	installAlternateStack();
+	
+	struct sigaction signal = {};
+	signal.sa_sigaction = &stackFaultHandler;
+	signal.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	sigemptyset(&signal.sa_mask);
+	sigaddset(&signal.sa_mask, SIGVTALRM);
+	
+	if(sigaction(SIGSEGV, &signal, NULL) == FUNCTION_FAIL)
+	{
+		fprintf(stderr, "system error: Can't install stack fault handler\n");
+		cleanAndAbort(1);
+	}
+}
+
+
+/* Installs the runtime's fault stack as the alternate signal stack of the 
+kernel thread, on which the SIGSEGV and SIGPROF handlers run */
+void installAlternateStack()
+{
+	stack_t alternateStack = {};
+	alternateStack.ss_sp = runtime -> faultStack;
+	alternateStack.ss_size = FAULT_STACK_SIZE;
+	
+	if(sigaltstack(&alternateStack, NULL) == FUNCTION_FAIL)
+	{
+		fprintf(stderr, "system error: Can't install alternate signal "\
+		"stack\n");
+		cleanAndAbort(1);
+	}
+}
+
+
+/* Handles a SIGPROF of the profiler's timer, recording a sample of the 
+running thread. Runs on the alternate signal stack, with SIGVTALRM masked so
+that the running thread isn't switched out while its sample is taken */
+void profileHandler(int sigNum, siginfo_t* info, void* context)
+{
+	uthread_runtime* self = runtime;
+	if(self == nullptr || self -> profiler == nullptr)
+	{
+		return;
+	}
+	
+	int savedErrno = errno;
+	Thread* thread = self -> runningThread;
+	self -> profiler -> record(thread -> getId(), 
+	                           thread -> getEntry() == nullptr ? nullptr : 
+	                           userEntryOf(thread), context);
+	errno = savedErrno;
+}
+
+
+/* Installs profileHandler as the handler of SIGPROF */
+void installProfileHandler()
+{
+	struct sigaction signal = {};
+	signal.sa_sigaction = &profileHandler;
+	signal.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+	sigemptyset(&signal.sa_mask);
+	sigaddset(&signal.sa_mask, SIGVTALRM);
+	
+	if(sigaction(SIGPROF, &signal, NULL) == FUNCTION_FAIL)
+	{
+		fprintf(stderr, "system error: Can't install profiling handler\n");
+		cleanAndAbort(1);
+	}
+}
+
+
 /*Masks the SIGVTALRM signal*/
 void maskSIGVRALRM()
 {
-	int retVal = sigprocmask(SIG_SETMASK, &alarmSignalSet, NULL);
-	if(retVal == FUNCTION_FAIL)
+	int retVal = pthread_sigmask(SIG_BLOCK, &alarmSignalSet, NULL);
+	if(retVal != 0)
 	{
 		fprintf(stderr, "system error: Can't mask signal SIGVTALRM\n");
 		cleanAndAbort(1);		
@@ -147,8 +450,8 @@ void maskSIGVRALRM()
 /*Removes the mask from SIGVTALRM */
 void unmaskSIGVRALRM()
 {
-	int retVal = sigprocmask(SIG_UNBLOCK, &alarmSignalSet, NULL);
-	if(retVal == FUNCTION_FAIL)
+	int retVal = pthread_sigmask(SIG_UNBLOCK, &alarmSignalSet, NULL);
+	if(retVal != 0)
 	{
 		fprintf(stderr, "system error: Can't unmask signal SIGVTALRM\n");
 		cleanAndAbort(1);		
@@ -176,455 +479,2709 @@ void ignorePendingSIGVTALRM()
 		cleanAndAbort(1);		
 	}
 	
-	//If SIGVTALRM is pending, ignore the signal
+	//If SIGVTALRM is pending, consume the signal. Unlike ignoring it, this
+	//doesn't drop signals sent to the other kernel threads' runtimes
 	if(retVal == 1)
 	{
-		struct sigaction ignoreAction;
-		ignoreAction.sa_handler = SIG_IGN;
-		
-		if(sigaction(SIGVTALRM, &ignoreAction, NULL) == FUNCTION_FAIL)
+		struct timespec noWait = {0, 0};
+		if(sigtimedwait(&alarmSignalSet, NULL, &noWait) == FUNCTION_FAIL &&
+		   errno != EAGAIN)
 		{
-			fprintf(stderr, "system error: can't install signal handler\n");
+			fprintf(stderr, "system error: Error on system call "\
+			"'sigtimedwait'\n");
 			cleanAndAbort(1);
 		}
-		
-		installSIGVTALRMHandler();	
 	}
 	
 }
 
 
-/* Frees all resources of program and aborts with given exit signal */
-void cleanAndAbort(int exitSig)
+/* Runs the posted tasks in the order they were posted. Blocks the task runner
+thread while there are no tasks to run */
+void runPostedTasks(void* unused)
+{
+	while(true)
+	{
+		maskSIGVRALRM();
+		if(!runtime -> taskQueue -> notEmpty())
+		{
+			traceEvent(TRACE_BLOCK, runtime -> runningThread -> getId());
+			runtime -> runningThread -> setState(BLOCKED);
+			scheduler(BLOCKED_SELF);
+			unmaskSIGVRALRM();
+			continue;
+		}
+		
+		PostedTask task = runtime -> taskQueue -> pop();
+		unmaskSIGVRALRM();
+		
+		task.fn(task.arg);
+	}
+}
+
+
+/* Creates the task runner thread if it doesn't exist yet. If the runner 
+can't be created as the maximal number of threads is reached, the tasks wait
+until a later post creates it. Allocates the thread, so it must not be 
+called by the scheduler, which may run in the signal handler. Expects 
+SIGVTALRM to be masked. */
+void createTaskRunner()
+{
+	if(runtime -> taskRunner != nullptr || 
+	   runtime -> collection -> size() >= MAX_THREAD_NUM)
+	{
+		return;
+	}
+	int tid = spawnThread(runPostedTasks, nullptr, 0, nullptr, nullptr);
+	runtime -> taskRunner = runtime -> collection -> get(tid);
+}
+
+
+/* Makes the task runner thread READY if it is blocked waiting for tasks. 
+Tasks posted while it doesn't exist wait for it to be created. Expects
+SIGVTALRM to be masked. */
+void wakeTaskRunner()
+{
+	if(runtime -> taskRunner != nullptr && 
+	   runtime -> taskRunner -> isResumable())
+	{
+		traceEvent(TRACE_RESUME, runtime -> taskRunner -> getId());
+		runtime -> taskRunner -> setState(READY);
+		runtime -> readyQueue -> add(runtime -> taskRunner);
+	}
+}
+
+
+/* Carries out the requests pushed to the remote queue: resumes the BLOCKED
+threads named by resume requests (ignoring threads which don't exist), and 
+posts submitted tasks. Expects SIGVTALRM to be masked */
+void drainRemoteRequests()
 {
-	delete readyQueue;
-	delete sleepManager;
-	collection -> deleteAllThreads();
-	delete collection;
-	delete timer;
-	delete idDistributor;
+	runtime -> remoteQueue -> clearWakeup();
 	
-	exit(exitSig);
+	RemoteRequest request;
+	while(runtime -> remoteQueue -> pop(&request))
+	{
+		if(request.fn != nullptr)
+		{
+			runtime -> taskQueue -> post(request.fn, request.arg);
+			continue;
+		}
+		
+		Thread* thread;
+		try
+		{
+			thread = runtime -> collection -> get(request.tid);
+		}
+		catch(const std::out_of_range&)
+		{
+			continue;
+		}
+		if(thread -> isResumable())
+		{
+			traceEvent(TRACE_RESUME, request.tid);
+			thread -> setState(READY);
+			runtime -> readyQueue -> add(thread);
+		}
+	}
 }
 
 
-/*
- * Description: This function initializes the thread library. 
- * You may assume that this function is called before any other thread library
- * function, and that it is called exactly once. The input to the function is
- * the length of a quantum in micro-seconds. It is an error to call this
- * function with non-positive quantum_usecs.
- * Return value: On success, return 0. On failure, return -1.
-*/
-int uthread_init(int quantumUsecs)
+/* Writes a library error from a function which may run in a signal handler,
+where stdio can't be used */
+void writeRemoteError(const char* message)
 {
-	maskSIGVRALRM();
-	if(quantumUsecs <= 0)
+	ssize_t written = write(STDERR_FILENO, message, strlen(message));
+	(void)written;
+}
+
+
+/* Blocks the RUNNING thread and makes a scheduling decision. Returns when
+the thread is resumed. Expects SIGVTALRM to be masked */
+void blockRunningThread()
+{
+	traceEvent(TRACE_BLOCK, runtime -> runningThread -> getId());
+	runtime -> runningThread -> setState(BLOCKED);
+	scheduler(BLOCKED_SELF);
+}
+
+
+/* Makes the given thread READY if it is BLOCKED. Does nothing for a null 
+thread. Expects SIGVTALRM to be masked */
+void wakeWaiter(Thread* thread)
+{
+	if(thread != nullptr && thread -> isResumable())
+	{
+		traceEvent(TRACE_RESUME, thread -> getId());
+		thread -> setState(READY);
+		runtime -> readyQueue -> add(thread);
+	}
+}
+
+
+/* The entry function of the executor's workers. Runs the submitted jobs in 
+the order they were submitted, and blocks the worker while there are none. 
+Once a job was run, its future is done, its waiter is woken up, and its 
+continuation is run */
+void runExecutorJobs(void* unused)
+{
+	while(true)
 	{
+		maskSIGVRALRM();
+		ExecutorJob job;
+		if(!runtime -> executor -> pop(&job))
+		{
+			runtime -> executor -> waitForJob(runtime -> runningThread);
+			blockRunningThread();
+			runtime -> executor -> stopWaiting(runtime -> runningThread);
+			unmaskSIGVRALRM();
+			continue;
+		}
+		//The job made room in the queue for a waiting submitter
+		wakeWaiter(runtime -> executor -> takeSubmitter());
 		unmaskSIGVRALRM();
-		fprintf(stderr,"thread library error: quantum usecs must be"\
-		" positive\n");
-		return FUNCTION_FAIL;
+		
+		void* result = job.fn(job.arg);
+		
+		maskSIGVRALRM();
+		uthread_future* future = job.future;
+		void (*thenFn)(void*, void*) = future -> thenFn;
+		void* thenArg = future -> thenArg;
+		future -> result = result;
+		future -> done = true;
+		wakeWaiter(runtime -> executor -> takeFutureWaiter(future));
+		if(future -> released)
+		{
+			runtime -> executor -> freeFuture(future);
+		}
+		unmaskSIGVRALRM();
+		
+		if(thenFn != nullptr)
+		{
+			thenFn(result, thenArg);
+		}
 	}
-	
-	installSIGVTALRMHandler();
-	
-	// Note -  creating timer encompases a system calls that might fail. 
-	// In case of failure the program will exit from within the timer
-	//constructor. No need to release resources, as nothing has been 
-	//allocated yet. 
-	
-	
-	//Creating neccesary objects.
+}
 
-	timer = new Timer(quantumUsecs);
-	// Note -  creating timer encompases a system calls that might fail. 
-	// In case of failure the program will exit from within the timer
-	//constructor. No need to release resources, as nothing has been 
-	//allocated yet. 
-	
-	collection = new ThreadCollection();
-	readyQueue = new ReadyQueue();
-	sleepManager = new SleepManager();
-	idDistributor = new IdDistributor();
+
+/* Submits a job to the executor, and returns its future. If the queue is 
+full, waits for room if mayWait is true, and fails otherwise. Returns null 
+on failure */
+uthread_future* submitJob(void* (*fn)(void*), void* arg, bool mayWait)
+{
+	if(runtime -> executor == nullptr || fn == nullptr)
+	{
+		fprintf(stderr, "thread library error: Executor isn't started, or "\
+		"null job\n");
+		return nullptr;
+	}
 	
-	//setting the set to hold only SIGVTALRM)
-	sigemptyset(&alarmSignalSet);	
-	sigaddset(&alarmSignalSet,SIGVTALRM);	
+	maskSIGVRALRM();
+	while(runtime -> executor -> full())
+	{
+		if(!mayWait || 
+		   runtime -> executor -> isWorker(runtime -> runningThread))
+		{
+			unmaskSIGVRALRM();
+			fprintf(stderr, "thread library error: Executor queue is full\n");
+			return nullptr;
+		}
+		if(runtime -> runningThread -> getId() == MAIN_ID)
+		{
+			scheduler(YIELDED);
+			continue;
+		}
+		runtime -> executor -> waitForRoom(runtime -> runningThread);
+		blockRunningThread();
+		runtime -> executor -> stopWaiting(runtime -> runningThread);
+	}
 	
-	//Creating main thread
-	Thread* mainThread;
-	// If memory for stack can't be allocated, abort program with exit code 1.
+	uthread_future* future;
+	// If memory for the future can't be allocated, abort program with exit 
+	// code 1.
 	try
 	{
-		mainThread = new Thread(idDistributor -> distribute()); 	
+		future = runtime -> executor -> newFuture();
 	}
 	catch(const char* e)
 	{
-		cleanAndAbort(1);		
+		cleanAndAbort(1);
 	}
 	
-	collection -> add(mainThread);
-	readyQueue -> add(mainThread);
-	
-	runningThread = mainThread;
-	scheduler();
-	
+	ExecutorJob job = {fn, arg, future};
+	runtime -> executor -> push(job);
+	wakeWaiter(runtime -> executor -> takeIdleWorker());
 	unmaskSIGVRALRM();
-	return FUNCTION_SUCCESS; 
+	return future;
 }
 
 
-/*
- * Description: This function creates a new thread, whose entry point is the
- * function f with the signature void f(void). The thread is added to the end
- * of the READY threads list. The uthread_spawn function should fail if it
- * would cause the number of concurrent threads to exceed the limit
- * (MAX_THREAD_NUM). Each thread should be allocated with a stack of size
- * STACK_SIZE bytes.
- * Return value: On success, return the ID of the created thread.
- * On failure, return -1.
-*/
-int uthread_spawn(void (*f)(void))
+/* Reaps the terminated threads. Posted to the task runner, so that reaping 
+runs on its stack rather than on the scheduling path */
+void reapTask(void* unused)
 {
-	
 	maskSIGVRALRM();
+	runtime -> reapPosted = false;
+	runtime -> threadReaper -> reap();
+	unmaskSIGVRALRM();
+}
+
 
-	if(collection -> size() >= MAX_THREAD_NUM)
+/* Reaps the terminated threads once their number reaches the reap batch.
+Reaping is posted to the task runner if it exists (it isn't created for 
+reaping, as it would take a thread from the user), and otherwise done at 
+once if mayReapNow is true - when not called on the scheduling path. 
+Expects SIGVTALRM to be masked */
+void scheduleReap(bool mayReapNow)
+{
+	if(runtime -> reapPosted || 
+	   runtime -> threadReaper -> size() < runtime -> reapBatch)
 	{
-		unmaskSIGVRALRM();
-		fprintf(stderr,"thread library error: you reached the max number "\
-		"of threads\n");
-		return FUNCTION_FAIL;
+		return;
 	}
 	
-	
-	Thread* newThread;
-	// If memory for stack can't be allocated, abort program with exit code 1.
-	try
+	if(runtime -> taskRunner != nullptr)
 	{
-		newThread = new Thread(idDistributor -> distribute(),f);
+		runtime -> reapPosted = true;
+		runtime -> taskQueue -> post(reapTask, nullptr);
+		wakeTaskRunner();
 	}
-	catch(const char* e)
+	else if(mayReapNow)
 	{
-		cleanAndAbort(1);		
+		runtime -> threadReaper -> reap();
+	}
+}
+
+
+/* Frees all resources of the calling kernel thread's runtime and aborts 
+with given exit signal */
+void cleanAndAbort(int exitSig)
+{
+	if(runtime == nullptr)
+	{
+		exit(exitSig);
 	}
 	
+	delete runtime -> readyQueue;
+	delete runtime -> sleepManager;
+	//The running thread's stack is left to the exit, as it may be in use
+	if(runtime -> runningThread != nullptr && 
+	   runtime -> runningThread != runtime -> exitedThread)
+	{
+		runtime -> collection -> remove(runtime -> runningThread -> getId());
+	}
+	runtime -> collection -> deleteAllThreads();
+	delete runtime -> collection;
+	delete runtime -> timer;
+	delete runtime -> idDistributor;
+	if(runtime -> exitedThread != runtime -> runningThread)
+	{
+		delete runtime -> exitedThread;
+	}
+	delete runtime -> threadReaper;
+	delete runtime -> threadPool;
+	delete runtime -> threadTable;
+	delete runtime -> stackAllocator;
+	delete[] runtime -> faultStack;
+	delete runtime -> stackUsageTable;
+	runtime -> runningSlots = nullptr;
+	delete runtime -> threadKeys;
+	delete runtime -> arenaPool;
+	Profiler* profiler = runtime -> profiler;
+	runtime -> profiler = nullptr;
+	delete profiler;
+	delete runtime -> statsSegment;
+	//The shared stack is left to the exit too, if the running thread is on it
+	if(runtime -> runningThread == nullptr || 
+	   !runtime -> runningThread -> isShared())
+	{
+		delete runtime -> sharedStack;
+	}
+	delete runtime -> remoteQueue;
+	delete runtime -> executor;
+	delete runtime -> schedulerStats;
+	delete runtime -> taskQueue;
+	traceBuffer = nullptr;
+	delete runtime -> traceStorage;
+	uthread_runtime* self = runtime;
+	primaryRuntime.compare_exchange_strong(self, nullptr);
+	delete runtime;
+	runtime = nullptr;
 	
-	collection -> add(newThread);
-	readyQueue -> add(newThread);
+	exit(exitSig);
+}
 
+
+/*
+ * Description: This function initializes the thread library for the 
+ * calling kernel thread, which becomes the main thread (ID 0) of a new 
+ * runtime, independent of the runtimes of other kernel threads (see 
+ * uthread_get_runtime). It must be called in a kernel thread before any 
+ * other thread library function, and at most once per kernel thread. The 
+ * input to the function is the length of a quantum in micro-seconds of the
+ * kernel thread's CPU time. It is an error to call this function with 
+ * non-positive quantum_usecs, or a second time in the same kernel thread.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_init(int quantumUsecs)
+{
+	uthread_options options;
+	uthread_default_options(&options);
+	options.quantum_usecs = quantumUsecs;
 	
-	
-	unmaskSIGVRALRM();
-	return newThread -> getId();
+	return uthread_init_options(&options);
 }
 
 
 /*
- * Description: This function terminates the thread with ID tid and deletes
- * it from all relevant control structures. All the resources allocated by
- * the library for this thread should be released. If no thread with ID tid
- * exists it is considered as an error. Terminating the main thread
- * (tid == 0) will result in the termination of the entire process using
- * exit(0) [after releasing the assigned library memory]. 
- * Return value: The function returns 0 if the thread was successfully
- * terminated and -1 otherwise. If a thread terminates itself or the main
- * thread is terminated, the function does not return.
+ * Description: This function fills options with the default options, which
+ * are the ones used by uthread_init (except for quantum_usecs, which is set
+ * to 0 and must be set by the caller).
 */
-int uthread_terminate(int tid)
+void uthread_default_options(uthread_options* options)
 {
+	options -> quantum_usecs = 0;
+	options -> pool_warm = 0;
+	options -> pool_max = UTHREAD_DEFAULT_POOL_MAX;
+	options -> stack_mode = UTHREAD_STACK_MALLOC;
+	options -> stack_max = UTHREAD_DEFAULT_STACK_MAX;
+	options -> stack_commit = UTHREAD_DEFAULT_STACK_COMMIT;
+	options -> stack_paint = 0;
+	options -> reap_batch = UTHREAD_DEFAULT_REAP_BATCH;
+	options -> stack_release = UTHREAD_STACK_KEEP;
+	options -> remote_capacity = UTHREAD_DEFAULT_REMOTE_CAPACITY;
+	options -> remote_tasks = 0;
+	options -> stack_color_stride = 0;
+	options -> stack_colors = UTHREAD_DEFAULT_STACK_COLORS;
+	options -> stack_guard = 0;
+	options -> main_context = UTHREAD_CONTEXT_FULL;
+	options -> sim_mode = 0;
+	options -> sim_seed = 0;
+	options -> sim_preempt_odds = 0;
+	options -> arena_region_size = UTHREAD_DEFAULT_ARENA_REGION_SIZE;
+	options -> arena_pool_max = UTHREAD_DEFAULT_ARENA_POOL_MAX;
+}
 
-	maskSIGVRALRM();
 
-	Thread* thread;
-	int runningThreadId = runningThread -> getId();
+/*
+ * Description: This function initializes the thread library with the given
+ * options. It replaces uthread_init, under the same conditions. It is an 
+ * error to call this function with non-positive quantum_usecs (outside of 
+ * simulation mode), with a 
+ * negative pool_warm or pool_max, with pool_warm larger than MAX_THREAD_NUM,
+ * with an unknown stack_mode, or (for growable stacks) with a zero 
+ * stack_commit or a stack_max smaller than stack_commit, with a 
+ * non-positive reap_batch, with an unknown stack_release, with a 
+ * non-positive remote_capacity, with a non-positive stack_colors or a 
+ * stack_color_stride which is misaligned or too large (see uthread_options),
+ * with an unknown main_context, with a negative sim_preempt_odds, or with 
+ * an arena_region_size below UTHREAD_MIN_ARENA_REGION_SIZE or a negative 
+ * arena_pool_max.
+ * Growable stacks are grown by the library's SIGSEGV handler, which runs on
+ * an alternate signal stack. The handler is only installed in this mode, and
+ * passes faults outside of the running thread's stack on to the default 
+ * action.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_init_options(const uthread_options* options)
+{
+	maskSIGVRALRM();
+	if(runtime != nullptr)
+	{
+		unmaskSIGVRALRM();
+		fprintf(stderr,"thread library error: the library is already "\
+		"initialized in this thread\n");
+		return FUNCTION_FAIL;
+	}
+	
+	int quantumUsecs = options -> quantum_usecs;
+	if(quantumUsecs <= 0 && options -> sim_mode == 0)
+	{
+		unmaskSIGVRALRM();
+		fprintf(stderr,"thread library error: quantum usecs must be"\
+		" positive\n");
+		return FUNCTION_FAIL;
+	}
+	
+	if(options -> pool_warm < 0 || options -> pool_max < 0 ||
+	   options -> pool_warm > MAX_THREAD_NUM)
+	{
+		unmaskSIGVRALRM();
+		fprintf(stderr,"thread library error: invalid thread pool size\n");
+		return FUNCTION_FAIL;
+	}
+	
+	uthread_stack_mode stackMode = options -> stack_mode;
+	if((stackMode != UTHREAD_STACK_MALLOC && 
+	    stackMode != UTHREAD_STACK_GROWABLE &&
+	    stackMode != UTHREAD_STACK_HUGE) ||
+	   (stackMode == UTHREAD_STACK_GROWABLE && 
+	    (options -> stack_commit == 0 || 
+	     options -> stack_max < options -> stack_commit)))
+	{
+		unmaskSIGVRALRM();
+		fprintf(stderr,"thread library error: invalid stack options\n");
+		return FUNCTION_FAIL;
+	}
+	
+	uthread_stack_release stackRelease = options -> stack_release;
+	if(options -> reap_batch <= 0 || 
+	   (stackRelease != UTHREAD_STACK_KEEP && 
+	    stackRelease != UTHREAD_STACK_DONTNEED &&
+	    stackRelease != UTHREAD_STACK_FREE))
+	{
+		unmaskSIGVRALRM();
+		fprintf(stderr,"thread library error: invalid reaping options\n");
+		return FUNCTION_FAIL;
+	}
+	
+	if(options -> remote_capacity <= 0)
+	{
+		unmaskSIGVRALRM();
+		fprintf(stderr,"thread library error: invalid remote queue "\
+		"capacity\n");
+		return FUNCTION_FAIL;
+	}
+	
+	size_t stackInitialSize = stackMode == UTHREAD_STACK_GROWABLE ? 
+	                          options -> stack_commit : STACK_SIZE;
+	if(options -> stack_colors <= 0 || 
+	   options -> stack_color_stride % STACK_STORAGE_ALIGNMENT != 0 ||
+	   options -> stack_color_stride * (options -> stack_colors - 1) > 
+	   stackInitialSize / 4)
+	{
+		unmaskSIGVRALRM();
+		fprintf(stderr,"thread library error: invalid stack coloring "\
+		"options\n");
+		return FUNCTION_FAIL;
+	}
+	
+	if(!validContext(options -> main_context))
+	{
+		unmaskSIGVRALRM();
+		fprintf(stderr,"thread library error: invalid main thread "\
+		"context\n");
+		return FUNCTION_FAIL;
+	}
+	
+	if(options -> sim_preempt_odds < 0)
+	{
+		unmaskSIGVRALRM();
+		fprintf(stderr,"thread library error: invalid simulation "\
+		"preemption odds\n");
+		return FUNCTION_FAIL;
+	}
+	
+	if(options -> arena_region_size < UTHREAD_MIN_ARENA_REGION_SIZE ||
+	   options -> arena_pool_max < 0)
+	{
+		unmaskSIGVRALRM();
+		fprintf(stderr,"thread library error: invalid arena options\n");
+		return FUNCTION_FAIL;
+	}
+	
+	installSIGVTALRMHandler();
+	
+	//Creating neccesary objects.
+
+	runtime = new uthread_runtime();
+	runtime -> reapBatch = options -> reap_batch;
+	if(options -> sim_mode != 0)
+	{
+		runtime -> simulated = true;
+		runtime -> simState = SIM_SEED_MIX ^ options -> sim_seed;
+		runtime -> simPreemptOdds = options -> sim_preempt_odds;
+	}
+	else
+	{
+		runtime -> timer = new Timer(quantumUsecs);
+	}
+	// Note -  creating timer encompases a system calls that might fail. 
+	// In case of failure the program will exit from within the timer
+	//constructor. No need to release resources, as nothing has been 
+	//allocated yet. 
+	
+	runtime -> collection = new ThreadCollection();
+	try
+	{
+		runtime -> threadTable = new ThreadTable();
+	}
+	catch(const char* e)
+	{
+		cleanAndAbort(1);
+	}
+	runtime -> readyQueue = new ReadyQueue();
+	runtime -> sleepManager = new SleepManager(runtime -> threadTable, 
+	                                           runtime -> collection);
+	runtime -> idDistributor = new IdDistributor();
+	runtime -> schedulerStats = new SchedulerStats();
+	runtime -> taskQueue = new TaskQueue();
+	runtime -> stackAllocator = 
+		new StackAllocator(stackMode, options -> stack_max,
+		                   options -> stack_commit, 
+		                   options -> stack_paint != 0,
+		                   options -> stack_color_stride, 
+		                   options -> stack_colors,
+		                   options -> stack_guard != 0);
+	runtime -> stackUsageTable = new StackUsageTable();
+	runtime -> threadKeys = new ThreadKeys();
+	runtime -> arenaPool = new ArenaPool(options -> arena_region_size,
+	                                     options -> arena_pool_max);
+	if(stackMode == UTHREAD_STACK_GROWABLE)
+	{
+		runtime -> faultStack = new char[FAULT_STACK_SIZE];
+		installStackFaultHandler();
+	}
+	
+	//Creating main thread and the pool of thread objects
+	Thread* mainThread;
+	// If memory for stack can't be allocated, abort program with exit code 1.
+	try
+	{
+		mainThread = new Thread(runtime -> idDistributor -> distribute(), 
+		                        runtime -> threadTable,
+		                        runtime -> stackAllocator); 	
+		runtime -> threadPool = new ThreadPool(options -> pool_warm, 
+		                                       options -> pool_max, 
+		                                       runtime -> threadTable,
+		                                       runtime -> stackAllocator);
+		runtime -> threadReaper = new ThreadReaper(runtime -> threadPool, 
+		                                           runtime -> stackAllocator, 
+		                                           stackRelease);
+		runtime -> remoteQueue = new RemoteQueue(options -> remote_capacity);
+	}
+	catch(const char* e)
+	{
+		cleanAndAbort(1);		
+	}
+	
+	mainThread -> setContext(options -> main_context);
+	runtime -> collection -> add(mainThread);
+	runtime -> readyQueue -> add(mainThread);
+	
+	runtime -> runningThread = mainThread;
+	runtime -> runningSlots = mainThread -> getSlots();
+	scheduler(INITIALIZED);
+	
+	//Tasks submitted remotely are posted by the scheduler, which may run in
+	//the signal handler and can't create threads, so the task runner is
+	//created before the runtime can be targeted
+	runtime -> remoteTasks = options -> remote_tasks != 0;
+	if(runtime -> remoteTasks)
+	{
+		createTaskRunner();
+	}
+	
+	uthread_runtime* noRuntime = nullptr;
+	primaryRuntime.compare_exchange_strong(noRuntime, runtime);
+	
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS; 
+}
+
+
+/* Runs a thread spawned by uthread_spawn, whose argument is its entry point
+function */
+void runVoidFunction(void* f)
+{
+	((void (*)(void))f)();
+}
+
+
+/* The entry point of all new threads. Runs the thread's entry function with 
+its argument, and terminates the thread when it returns. A thread of an 
+integer context starts with the signal mask of the switch, so it unmasks 
+SIGVTALRM itself */
+void threadTrampoline()
+{
+	Thread* self = runtime -> runningThread;
+	if(self -> getContext() == UTHREAD_CONTEXT_INTEGER)
+	{
+		unmaskSIGVRALRM();
+	}
+	(self -> getEntry())(self -> getArg());
+	uthread_terminate(self -> getId());
+}
+
+
+/* The entry point of the shared run stack's restoring, on the restoring 
+stack. If the frames of the thread switching out can't be saved, the 
+program is aborted with exit code 1 */
+void sharedStackTrampoline()
+{
+	Thread* thread;
+	try
+	{
+		thread = runtime -> sharedStack -> restore();
+	}
+	catch(const char* e)
+	{
+		cleanAndAbort(1);
+	}
+	siglongjmp(*(thread -> getEnv()), JMP_VALUE);
+}
+
+
+/* The entry point of all generators, on the generator's own stack */
+void generatorTrampoline()
+{
+	runtime -> runningThread -> getGenerator() -> run();
+}
+
+
+/* Returns the entry function the user gave to the thread's spawn function,
+which is its argument for threads spawned by uthread_spawn */
+void* userEntryOf(Thread* thread)
+{
+	if(thread -> getEntry() == runVoidFunction)
+	{
+		return thread -> getArg();
+	}
+	return (void*)thread -> getEntry();
+}
+
+
+/* Creates a new thread with the given entry function and argument, and adds
+it to the end of the READY threads list. If storageSize is positive, storage
+is reserved at the top of the thread's stack, passed to the entry function 
+as its argument, and initialized by init(storage, ctx) before the thread is
+made READY. Expects SIGVTALRM to be masked.
+Returns the new thread's id, or -1 on failure */
+int spawnThread(void (*entry)(void*), void* arg, size_t storageSize,
+                void (*init)(void*, void*), void* ctx)
+{
+	if(runtime -> collection -> size() >= MAX_THREAD_NUM)
+	{
+		fprintf(stderr,"thread library error: you reached the max number "\
+		"of threads\n");
+		return FUNCTION_FAIL;
+	}
+	
+	if(storageSize > runtime -> stackAllocator -> getInitialCommit() / 2)
+	{
+		fprintf(stderr,"thread library error: spawn storage can't exceed "\
+		"half of the stack\n");
+		return FUNCTION_FAIL;
+	}
+	
+	//Reaping early rather than allocating a new thread object
+	if(runtime -> threadPool -> size() == 0 && 
+	   runtime -> threadReaper -> size() > 0)
+	{
+		runtime -> threadReaper -> reap();
+	}
+	
+	Thread* newThread = createThread(entry, arg, storageSize, init, ctx);
+	runtime -> readyQueue -> add(newThread);
+	
+	return newThread -> getId();
+}
+
+
+/* Creates a new thread like spawnThread, without adding it to the READY 
+threads list, and returns it. Expects SIGVTALRM to be masked, and the
+number of threads to be below MAX_THREAD_NUM */
+Thread* createThread(void (*entry)(void*), void* arg, size_t storageSize,
+                     void (*init)(void*, void*), void* ctx)
+{
+	Thread* newThread;
+	// If memory for stack can't be allocated, abort program with exit code 1.
+	try
+	{
+		newThread = runtime -> threadPool -> acquire(
+		                    runtime -> idDistributor -> distribute(), 
+		                    entry, arg, storageSize);
+	}
+	catch(const char* e)
+	{
+		cleanAndAbort(1);		
+	}
+	
+	if(init != nullptr)
+	{
+		init(newThread -> getArg(), ctx);
+	}
+	
+	runtime -> collection -> add(newThread);
+	runtime -> schedulerStats -> countSpawn();
+	traceEvent(TRACE_SPAWN, newThread -> getId());
+	
+	return newThread;
+}
+
+
+/* Spawns a new thread like spawnThread, running on the runtime's shared run
+stack, which is created by the first shared thread. Shared threads aren't 
+pooled, as their objects are small. Expects SIGVTALRM to be masked */
+int spawnSharedThread(void (*entry)(void*), void* arg)
+{
+	if(runtime -> collection -> size() >= MAX_THREAD_NUM)
+	{
+		fprintf(stderr,"thread library error: you reached the max number "\
+		"of threads\n");
+		return FUNCTION_FAIL;
+	}
+	
+	Thread* newThread;
+	// If memory for the shared stack can't be allocated, abort program with
+	// exit code 1.
+	try
+	{
+		if(runtime -> sharedStack == nullptr)
+		{
+			runtime -> sharedStack = 
+				new SharedStack(runtime -> stackAllocator);
+		}
+		newThread = new Thread(runtime -> sharedStack, 
+		                       runtime -> idDistributor -> distribute(), 
+		                       runtime -> threadTable, 
+		                       runtime -> stackAllocator, entry, arg);
+	}
+	catch(const char* e)
+	{
+		cleanAndAbort(1);
+	}
+	
+	runtime -> collection -> add(newThread);
+	runtime -> schedulerStats -> countSpawn();
+	traceEvent(TRACE_SPAWN, newThread -> getId());
+	runtime -> readyQueue -> add(newThread);
+	
+	return newThread -> getId();
+}
+
+/*
+ * Description: This function creates a new thread, whose entry point is the
+ * function f with the signature void f(void). The thread is added to the end
+ * of the READY threads list. The uthread_spawn function should fail if it
+ * would cause the number of concurrent threads to exceed the limit
+ * (MAX_THREAD_NUM). Each thread should be allocated with a stack of size
+ * STACK_SIZE bytes (unless growable stacks were chosen by 
+ * uthread_init_options). When f returns, the thread is terminated as if it
+ * called uthread_terminate with its own id.
+ * Return value: On success, return the ID of the created thread.
+ * On failure, return -1.
+*/
+int uthread_spawn(void (*f)(void))
+{
+	maskSIGVRALRM();
+	int tid = spawnThread(runVoidFunction, (void*)f, 0, nullptr, nullptr);
+	unmaskSIGVRALRM();
+	return tid;
+}
+
+
+/*
+ * Description: This function creates a new thread like uthread_spawn, whose
+ * entry point is the function f, called with the argument arg.
+ * Return value: On success, return the ID of the created thread.
+ * On failure, return -1.
+*/
+int uthread_spawn_arg(void (*f)(void*), void* arg)
+{
+	maskSIGVRALRM();
+	int tid = spawnThread(f, arg, 0, nullptr, nullptr);
+	unmaskSIGVRALRM();
+	return tid;
+}
+
+
+/*
+ * Description: This function creates a new thread like uthread_spawn_arg,
+ * but first reserves size bytes at the top of the new thread's stack 
+ * (aligned to 16 bytes). Before the thread is added to the READY threads 
+ * list, init is called with the reserved storage and ctx, and the thread's
+ * entry point f is later called with the storage. This allows the thread's
+ * argument to be constructed in place without allocating memory. init is 
+ * called while the library's signals are masked, so it must not call the 
+ * library. It is an error to reserve more than half of the stack (half of
+ * the initially committed stack, with growable stacks).
+ * Return value: On success, return the ID of the created thread.
+ * On failure, return -1.
+*/
+int uthread_spawn_with_storage(void (*f)(void*), size_t size, 
+                               void (*init)(void* storage, void* ctx), 
+                               void* ctx)
+{
+	maskSIGVRALRM();
+	int tid = spawnThread(f, nullptr, size, init, ctx);
+	unmaskSIGVRALRM();
+	return tid;
+}
+
+
+/* Returns true if the given thread context is known */
+bool validContext(uthread_context context)
+{
+	return context == UTHREAD_CONTEXT_FULL || 
+	       context == UTHREAD_CONTEXT_INTEGER;
+}
+
+
+/*
+ * Description: This function fills attr with the default attributes of a 
+ * new thread, which are the ones used by uthread_spawn (a 
+ * UTHREAD_CONTEXT_FULL context, on a stack of its own).
+*/
+void uthread_attr_init(uthread_attr* attr)
+{
+	attr -> context = UTHREAD_CONTEXT_FULL;
+	attr -> shared_stack = 0;
+}
+
+
+/*
+ * Description: This function creates a new thread like uthread_spawn_arg,
+ * with the given attributes. Threads which only use integer registers may 
+ * be given a UTHREAD_CONTEXT_INTEGER context, which makes their switches 
+ * cheaper. Threads which are mostly idle may be given a shared stack (the 
+ * shared run stack is created by the first of them). A shared thread's 
+ * frames must not be pointed to by other threads while it is switched out,
+ * as they are moved. It is an error to give an unknown context.
+ * Return value: On success, return the ID of the created thread.
+ * On failure, return -1.
+*/
+int uthread_spawn_attr(void (*f)(void*), void* arg, const uthread_attr* attr)
+{
+	maskSIGVRALRM();
+	if(!validContext(attr -> context))
+	{
+		unmaskSIGVRALRM();
+		fprintf(stderr,"thread library error: invalid thread context\n");
+		return FUNCTION_FAIL;
+	}
+	
+	int tid;
+	if(attr -> shared_stack != 0)
+	{
+		tid = spawnSharedThread(f, arg);
+	}
+	else
+	{
+		tid = spawnThread(f, arg, 0, nullptr, nullptr);
+	}
+	if(tid != FUNCTION_FAIL)
+	{
+		runtime -> collection -> get(tid) -> setContext(attr -> context);
+	}
+	unmaskSIGVRALRM();
+	return tid;
+}
+
+
+/* Returns the thread with the given id, if it may be terminated. Otherwise
+(it doesn't exist, or is sleeping) prints the error and returns null */
+Thread* findTerminable(int tid)
+{
+	Thread* thread;
+	try
+	{
+		thread = runtime -> collection -> get(tid);
+	}
+	catch(const std::out_of_range&)
+	{
+		fprintf(stderr, "thread library error: Trying to terminate "\
+		"non-existant thread\n");
+		return nullptr;
+	}
+	
+	//It ias an error to try and kill a sleeping thread
+	if(thread -> getState() == SLEEPING)
+	{
+		fprintf(stderr, "thread library error: Trying to terminate "\
+		"a sleeping thread\n");
+		return nullptr;
+	}
+	if(thread -> isTerminating())
+	{
+		fprintf(stderr, "thread library error: Trying to terminate "\
+		"a thread which is being terminated\n");
+		return nullptr;
+	}
+	return thread;
+}
+
+
+/* Takes the given thread, which isn't running, out of scheduling until it 
+is terminated: it is BLOCKED, and can't be made READY again. Expects 
+SIGVTALRM to be masked */
+void stopScheduling(Thread* thread)
+{
+	runtime -> readyQueue -> remove(thread);
+	thread -> setState(BLOCKED);
+	thread -> markTerminating();
+	if(runtime -> executor != nullptr)
+	{
+		runtime -> executor -> forget(thread);
+	}
+}
+
+
+/*
+ * Description: This function terminates the thread with ID tid and deletes
+ * it from all relevant control structures. All the resources allocated by
+ * the library for this thread should be released. If no thread with ID tid
+ * exists it is considered as an error. Terminating the main thread
+ * (tid == 0) will result in the termination of the entire process using
+ * exit(0) [after releasing the assigned library memory]. While the key 
+ * destructors of another thread run (see uthread_key_create), that thread 
+ * is BLOCKED and can't be resumed, and terminating it again is an error.
+ * Return value: The function returns 0 if the thread was successfully
+ * terminated and -1 otherwise. If a thread terminates itself or the main
+ * thread is terminated, the function does not return.
+*/
+int uthread_terminate(int tid)
+{
+	maskSIGVRALRM();
+	
+	Thread* thread = findTerminable(tid);
+	if(thread == nullptr)
+	{
+		unmaskSIGVRALRM();
+		return FUNCTION_FAIL;
+	}
+	
+	//The destructors are user code, so they run outside the library's 
+	//critical section, once the thread is known to be terminable. Another 
+	//thread is taken out of scheduling first, so it can't run, sleep or be
+	//terminated meanwhile, and its id isn't reused
+	if(tid != MAIN_ID)
+	{
+		if(thread != runtime -> runningThread)
+		{
+			stopScheduling(thread);
+		}
+		unmaskSIGVRALRM();
+		runKeyDestructors(thread);
+		maskSIGVRALRM();
+	}
+	
+	int runningThreadId = runtime -> runningThread -> getId();
+		
+	//If the given thread was the main thread, scheduler is run in order to
+	//replace it (the thread will no longer run as the object and all pointers
+	//have been deleted)
+	if(tid == MAIN_ID)
+	{
+		cleanAndAbort(0);
+	}
+	
+	//Delete given thread
+	traceEvent(TRACE_TERMINATE, tid);
+
+	runtime -> collection -> remove(tid); //n ote - this function throws an 
+							   //exception, but this would have been caught by
+							   //the catch above
+							   
+	runtime -> readyQueue -> remove(thread);
+	runtime -> sleepManager -> remove(thread);
+	runtime -> idDistributor -> freeId(tid);
+	if(runtime -> fpuLive == thread)
+	{
+		runtime -> fpuLive = nullptr;
+	}
+	runtime -> arenaPool -> release(thread -> takeArena());
+	thread -> abandonGenerators();
+	if(thread -> isShared())
+	{
+		runtime -> sharedStack -> forget(thread);
+	}
+	runtime -> schedulerStats -> countTermination();
+	if(runtime -> stackAllocator -> isPainting() && !thread -> isShared())
+	{
+		runtime -> stackUsageTable -> record(userEntryOf(thread), 
+		                                     thread -> measureStackUsage());
+	}
+	if(tid != runningThreadId)
+	{
+		runtime -> threadReaper -> add(thread);
+		scheduleReap(true);
+	}
+	if(thread == runtime -> taskRunner)
+	{
+		runtime -> taskRunner = nullptr;
+	}
+	if(runtime -> executor != nullptr)
+	{
+		runtime -> executor -> forget(thread);
+	}
+	
+	//If the main thread is being deleted, delete all threads, remove all
+	//resources and exit process
+	
+	if(tid ==runningThreadId)
+	{
+		scheduler(TERMINATED);
+	}
+	
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS;		
+}
+
+
+/* Runs the destructors of the keys of the given thread on its non-null 
+values, resetting each value to null before its destructor is called. 
+Values set again by the destructors are destroyed in further rounds, up to 
+UTHREAD_DESTRUCTOR_ITERATIONS. Signals are unmasked while a destructor runs,
+so the thread must be running, or taken out of scheduling */
+void runKeyDestructors(Thread* thread)
+{
+	for(int round = 0; round < UTHREAD_DESTRUCTOR_ITERATIONS; round++)
+	{
+		bool destroyed = false;
+		for(int key = 0; ; key++)
+		{
+			maskSIGVRALRM();
+			
+			//finding the next value to destroy
+			void** slots = thread -> getSlots();
+			void (*destructor)(void*) = nullptr;
+			for(; key < runtime -> threadKeys -> size(); key++)
+			{
+				destructor = runtime -> threadKeys -> getDestructor(key);
+				if(destructor != nullptr && slots[key] != nullptr)
+				{
+					break;
+				}
+			}
+			if(key >= runtime -> threadKeys -> size())
+			{
+				unmaskSIGVRALRM();
+				break;
+			}
+			void* value = slots[key];
+			slots[key] = nullptr;
+			unmaskSIGVRALRM();
+			
+			destructor(value);
+			destroyed = true;
+		}
+		if(!destroyed)
+		{
+			return;
+		}
+	}
+}
+
+
+/*
+ * Description: This function creates n threads like uthread_spawn, all with
+ * the entry point f, and writes their ids to tids_out. All threads are 
+ * added to the end of the READY threads list at once, in the order of their
+ * ids in tids_out. The whole batch is created in a single critical section,
+ * with the stacks missing from the thread pool allocated together. The 
+ * function fails, creating no thread, if it would cause the number of 
+ * concurrent threads to exceed MAX_THREAD_NUM. It is an error to call this
+ * function with a non-positive n or a null tids_out.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_spawn_many(void (*f)(void), int n, int* tids_out)
+{
+	if(n <= 0 || tids_out == nullptr)
+	{
+		fprintf(stderr,"thread library error: spawning many threads needs a "\
+		"positive count and an ids array\n");
+		return FUNCTION_FAIL;
+	}
+	
+	maskSIGVRALRM();
+	
+	if(runtime -> collection -> size() + n > MAX_THREAD_NUM)
+	{
+		fprintf(stderr,"thread library error: you reached the max number "\
+		"of threads\n");
+		unmaskSIGVRALRM();
+		return FUNCTION_FAIL;
+	}
+	
+	//Reaping early, and allocating the objects still missing together
+	if(runtime -> threadPool -> size() < n && 
+	   runtime -> threadReaper -> size() > 0)
+	{
+		runtime -> threadReaper -> reap();
+	}
+	// If memory for stacks can't be allocated, abort program with exit code 1.
+	try
+	{
+		runtime -> threadPool -> reserve(n);
+	}
+	catch(const char* e)
+	{
+		cleanAndAbort(1);
+	}
+	
+	ThreadList newThreads;
+	for(int i = 0; i < n; i++)
+	{
+		Thread* newThread = createThread(runVoidFunction, (void*)f, 0, 
+		                                 nullptr, nullptr);
+		newThreads.pushBack(newThread);
+		tids_out[i] = newThread -> getId();
+	}
+	runtime -> readyQueue -> addAll(&newThreads);
+	
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS;
+}
+
+
+/* Checks that the array of n thread ids is valid, and that all of the 
+threads exist. On failure prints an error mentioning the action, and returns
+false. Expects SIGVTALRM to be masked */
+bool checkThreadIds(const int* tids, int n, const char* action)
+{
+	if(n < 0 || (tids == nullptr && n > 0))
+	{
+		fprintf(stderr, "thread library error: Trying to %s an invalid "\
+		"array of threads\n", action);
+		return false;
+	}
+	
+	for(int i = 0; i < n; i++)
+	{
+		try
+		{
+			runtime -> collection -> get(tids[i]);
+		}
+		catch(const std::out_of_range&)
+		{
+			fprintf(stderr, "thread library error: Trying to %s non-"\
+			"existant thread\n", action);
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/*
+ * Description: This function resumes the n threads whose ids are in tids, 
+ * like uthread_resume, in a single critical section. The resumed threads are
+ * added to the end of the READY threads list at once, in the order of tids.
+ * If any of the ids doesn't exist it is considered as an error, and no 
+ * thread is resumed. It is an error to call this function with a negative n,
+ * or with a null tids and a positive n.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_resume_many(const int* tids, int n)
+{
+	maskSIGVRALRM();
+	
+	if(!checkThreadIds(tids, n, "resume"))
+	{
+		unmaskSIGVRALRM();
+		return FUNCTION_FAIL;
+	}
+	
+	ThreadList resumed;
+	for(int i = 0; i < n; i++)
+	{
+		Thread* thread = runtime -> collection -> get(tids[i]);
+		if(thread -> isResumable())
+		{
+			traceEvent(TRACE_RESUME, tids[i]);
+			thread -> setState(READY);
+			resumed.pushBack(thread);
+		}
+	}
+	runtime -> readyQueue -> addAll(&resumed);
+	
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function blocks the n threads whose ids are in tids, 
+ * like uthread_block, in a single critical section. If the calling thread is
+ * one of them, it is blocked after all others, and a scheduling decision is 
+ * made. If any of the ids doesn't exist or is the main thread's it is 
+ * considered as an error, and no thread is blocked. It is an error to call 
+ * this function with a negative n, or with a null tids and a positive n.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_block_many(const int* tids, int n)
+{
+	maskSIGVRALRM();
+	
+	if(!checkThreadIds(tids, n, "block"))
+	{
+		unmaskSIGVRALRM();
+		return FUNCTION_FAIL;
+	}
+	for(int i = 0; i < n; i++)
+	{
+		if(tids[i] == MAIN_ID)
+		{
+			fprintf(stderr, "thread library error: Trying to block main "\
+			"thread\n");
+			unmaskSIGVRALRM();
+			return FUNCTION_FAIL;
+		}
+	}
+	
+	bool blockSelf = false;
+	for(int i = 0; i < n; i++)
+	{
+		Thread* thread = runtime -> collection -> get(tids[i]);
+		if(thread == runtime -> runningThread)
+		{
+			blockSelf = true;
+		}
+		else if(thread -> getState() == READY)
+		{
+			runtime -> readyQueue -> remove(thread);
+			traceEvent(TRACE_BLOCK, tids[i]);
+			thread -> setState(BLOCKED);
+		}
+	}
+	
+	if(blockSelf && runtime -> runningThread -> getState() == RUNNING)
+	{
+		traceEvent(TRACE_BLOCK, runtime -> runningThread -> getId());
+		runtime -> runningThread -> setState(BLOCKED);
+		scheduler(BLOCKED_SELF);
+	}
+	
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function blocks the thread with ID tid. The thread may
+ * be resumed later using uthread_resume. If no thread with ID tid exists it
+ * is considered as an error. In addition, it is an error to try blocking the
+ * main thread (tid == 0). If a thread blocks itself, a scheduling decision
+ * should be made. Blocking a thread in BLOCKED or SLEEPING states has no
+ * effect and is not considered as an error.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_block(int tid)
+{
+	maskSIGVRALRM();
+	
+	if(tid == MAIN_ID)
+	{
+		fprintf(stderr, "thread library error: Trying to block main "\
+		"thread\n");
+		unmaskSIGVRALRM();
+		return FUNCTION_FAIL;
+	}
+	Thread* thread;
+	
+	try
+	{
+		thread = runtime -> collection -> get(tid);
+	}
+	catch(const std::out_of_range)
+	{
+		fprintf(stderr, "thread library error: Trying to block non-"\
+		"existant thread\n");
+		unmaskSIGVRALRM();
+		return FUNCTION_FAIL;
+	}
+	
+	switch(thread -> getState()){
+		//In case thread is currently running, the next runner up will 
+		//be inserted instead.
+		case RUNNING: 
+			assert(runtime -> runningThread -> getId() == tid);
+			traceEvent(TRACE_BLOCK, tid);
+			thread -> setState(BLOCKED);
+			scheduler(BLOCKED_SELF);
+			break;
+			
+		//If thread was in the waiting queue, it is removed.
+		case READY:
+			runtime -> readyQueue -> remove(thread);
+			traceEvent(TRACE_BLOCK, tid);
+			thread -> setState(BLOCKED);
+			break;
+		default:
+			//No action for other states
+			break;
+	}	
+	
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function resumes a blocked thread with ID tid and moves
+ * it to the READY state. Resuming a thread in the RUNNING, READY or SLEEPING
+ * state has no effect and is not considered as an error. If no thread with
+ * ID tid exists it is considered as an error.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_resume(int tid)
+{
+
+	maskSIGVRALRM();
+	
+	Thread* thread;
+	
+	try
+	{
+		thread = runtime -> collection -> get(tid);
+	}
+	catch(const std::out_of_range)
+	{
+		fprintf(stderr, "thread library error: Trying to resume non-" \
+		"existant thread\n");
+		unmaskSIGVRALRM();
+		return FUNCTION_FAIL;
+	}
+	
+	if(thread -> isResumable())
+	{
+		traceEvent(TRACE_RESUME, tid);
+		thread -> setState(READY);
+		runtime -> readyQueue -> add(thread);
+	}
+
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS;
+}
+
+/*
+ * Description: This function moves the RUNNING thread to the end of the 
+ * READY threads list, and makes a scheduling decision. If no other thread is
+ * READY, the calling thread continues running in a new quantum.
+ * Return value: Always 0.
+*/
+int uthread_yield()
+{
+	maskSIGVRALRM();
+	
+	assert(runtime -> runningThread -> getState() == RUNNING);
+	scheduler(YIELDED);
+	
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS;
+}
+
+/*
+ * Description: This function puts the RUNNING thread to sleep for a period
+ * of num_quantums (not including the current quantum) after which it is moved
+ * to the READY state. num_quantums must be a positive number. It is an error
+ * to try to put the main thread (tid==0) to sleep. Immediately after a thread
+ * transitions to the SLEEPING state a scheduling decision should be made.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_sleep(int num_quantums)
+{
+	maskSIGVRALRM();
+	
+	if(runtime -> runningThread -> getId() == MAIN_ID)
+	{
+		fprintf(stderr, "thread library error: Trying to put main "\
+		"thread to sleep\n");
+		unmaskSIGVRALRM();
+		return FUNCTION_FAIL;		
+	}
+	
+	if(num_quantums <= 0)
+	{
+		fprintf(stderr, "thread library error: num_quantums for sleep call"\
+		" must be positive\n");
+		unmaskSIGVRALRM();
+		return FUNCTION_FAIL;		
+	}
+	
+	
+	assert(runtime -> runningThread -> getState() == RUNNING);
+	runtime -> runningThread -> setState(SLEEPING);
+	runtime -> runningThread -> setQuantumsTillWakeup(num_quantums);
+	runtime -> sleepManager -> add(runtime -> runningThread);
+	traceEvent(TRACE_SLEEP, runtime -> runningThread -> getId(), num_quantums);
+	scheduler(SLEPT);
+	
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS;	
+	
+}
+
+/*
+ * Description: This function returns the number of quantums until the thread
+ * with id tid wakes up including the current quantum. If no thread with ID
+ * tid exists it is considered as an error. If the thread is not sleeping,
+ * the function should return 0.
+ * Return value: Number of quantums (including current quantum) until wakeup.
+*/
+int uthread_get_time_until_wakeup(int tid)
+{
+	maskSIGVRALRM();
+	Thread* thread;
+		
+	try
+	{
+		thread = runtime -> collection -> get(tid);
+	}
+	catch(const std::out_of_range)
+	{
+		fprintf(stderr, "thread library error: Trying to get time until "\
+		"wakeup for non-existant thread\n");
+		unmaskSIGVRALRM();
+		return FUNCTION_FAIL;
+	}
+	
+	if(thread -> getState() == SLEEPING)
+	{
+		//Since implementation decrements this value at the
+		//start of each quantum, 1 must be added in order to obtain
+		//true value
+		unmaskSIGVRALRM();
+		return thread -> getQuantumsTillWakeup() + 1;
+	}
+	else{
+		unmaskSIGVRALRM();
+		return 0;
+	}
+	
+}
+
+
+/*
+ * Description: This function returns the thread ID of the calling thread.
+ * Return value: The ID of the calling thread.
+*/
+
+int uthread_get_tid()
+{
+	
+	maskSIGVRALRM();
+	int id = runtime -> runningThread -> getId();
+	
+	unmaskSIGVRALRM();
+	return id;
+}
+
+/*
+ * Description: This function returns the total number of quantums that were
+ * started since the library was initialized, including the current quantum.
+ * Right after the call to uthread_init, the value should be 1.
+ * Each time a new quantum starts, regardless of the reason, this number
+ * should be increased by 1.
+ * Return value: The total number of quantums.
+*/
+int uthread_get_total_quantums()
+{
+	return runtime -> totalQuantumCounter;	
+}
+
+
+
+/*
+ * Description: This function returns the number of quantums the thread with
+ * ID tid was in RUNNING state. On the first time a thread runs, the function
+ * should return 1. Every additional quantum that the thread starts should
+ * increase this value by 1 (so if the thread with ID tid is in RUNNING state
+ * when this function is called, include also the current quantum). If no
+ * thread with ID tid exists it is considered as an error.
+ * Return value: On success, return the number of quantums of the 
+ * thread with ID tid. On failure, return -1.
+*/
+int uthread_get_quantums(int tid)
+{
+	maskSIGVRALRM();
+	Thread* thread;
+		
+	try
+	{
+		thread = runtime -> collection -> get(tid);
+	}
+	catch(const std::out_of_range)
+	{
+		fprintf(stderr, "thread library error: Trying to get quantums for "\
+		"non-existant thread\n");
+		unmaskSIGVRALRM();
+		return FUNCTION_FAIL;
+	}
+	
+	unmaskSIGVRALRM();
+	return thread -> getQuantumRuntime();
+	
+}
+
+
+/*
+ * Description: This function fills stats with the statistics of the thread
+ * with ID tid. Time spent in the thread's current state is included. If no
+ * thread with ID tid exists, or stats is null, it is considered as an 
+ * error. The statistics are recorded at all times, at the cost of reading 
+ * the cycle counter on each state change.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_get_stats(int tid, uthread_stats* stats)
+{
+	if(stats == nullptr)
+	{
+		fprintf(stderr, "thread library error: stats must not be null\n");
+		return FUNCTION_FAIL;
+	}
+	
+	maskSIGVRALRM();
+	Thread* thread;
+	
+	try
+	{
+		thread = runtime -> collection -> get(tid);
+	}
+	catch(const std::out_of_range&)
+	{
+		fprintf(stderr, "thread library error: Trying to get stats for "\
+		"non-existant thread\n");
+		unmaskSIGVRALRM();
+		return FUNCTION_FAIL;
+	}
+	
+	stats -> run_cycles = thread -> getCyclesInState(RUNNING);
+	stats -> ready_wait_cycles = thread -> getCyclesInState(READY);
+	stats -> sleep_cycles = thread -> getCyclesInState(SLEEPING);
+	stats -> blocked_cycles = thread -> getCyclesInState(BLOCKED);
+	stats -> voluntary_switches = thread -> getVoluntarySwitches();
+	stats -> involuntary_switches = thread -> getInvoluntarySwitches();
+	stats -> quantums = thread -> getQuantumRuntime();
+	stats -> stack_committed = thread -> getStackCommitted();
+	
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function fills stats with a snapshot of the statistics
+ * of the entire scheduler. It is an error to pass a null stats.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_get_global_stats(uthread_global_stats* stats)
+{
+	if(stats == nullptr)
+	{
+		fprintf(stderr, "thread library error: stats must not be null\n");
+		return FUNCTION_FAIL;
+	}
+	
+	//Calibrating before masking, as it may wait for the clock to advance
+	double cyclesPerUsec = runtime -> schedulerStats -> cyclesPerUsec();
+	
+	maskSIGVRALRM();
+	
+	SchedulerStats* schedulerStats = runtime -> schedulerStats;
+	stats -> total_switches = schedulerStats -> getTotalSwitches();
+	stats -> voluntary_switches = schedulerStats -> getVoluntarySwitches();
+	stats -> involuntary_switches = schedulerStats -> 
+	                                getInvoluntarySwitches();
+	stats -> threads_spawned = schedulerStats -> getThreadsSpawned();
+	stats -> threads_terminated = schedulerStats -> getThreadsTerminated();
+	stats -> cycles_since_init = schedulerStats -> getCyclesSinceInit();
+	stats -> cycles_per_usec = cyclesPerUsec;
+	stats -> total_quantums = runtime -> totalQuantumCounter;
+	stats -> live_threads = runtime -> collection -> size();
+	for(int i = 0; i < UTHREAD_LATENCY_BUCKETS; i++)
+	{
+		stats -> switch_latency_hist[i] = schedulerStats -> 
+		                                  getLatencyBucket(i);
+	}
+	
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function returns the stack usage of the thread with ID
+ * tid - the number of bytes from the top of its stack down to the deepest
+ * byte it wrote so far. It is an error to call this function if stack 
+ * painting is off (see uthread_options.stack_paint), or if no thread with ID
+ * tid exists. The main thread, which runs on the process's stack, has a 
+ * usage of 0.
+ * Return value: On success, return the stack usage in bytes. On failure, 
+ * return -1.
+*/
+int uthread_get_stack_usage(int tid)
+{
+	if(!runtime -> stackAllocator -> isPainting())
+	{
+		fprintf(stderr, "thread library error: Stack painting is off\n");
+		return FUNCTION_FAIL;
+	}
+	
+	maskSIGVRALRM();
+	Thread* thread;
+	
+	try
+	{
+		thread = runtime -> collection -> get(tid);
+	}
+	catch(const std::out_of_range&)
+	{
+		fprintf(stderr, "thread library error: Trying to get stack usage "\
+		"for non-existant thread\n");
+		unmaskSIGVRALRM();
+		return FUNCTION_FAIL;
+	}
+	
+	int usage = tid == MAIN_ID ? 0 : (int)thread -> measureStackUsage();
+	unmaskSIGVRALRM();
+	return usage;
+}
+
+
+/*
+ * Description: This function reports the stack usage of terminated threads,
+ * aggregated by their entry function: the number of threads, their deepest
+ * usage and their total usage (see uthread_get_stack_usage). The usage of 
+ * at most capacity entry functions is written to usages, in no particular
+ * order. It is an error to call this function if stack painting is off, 
+ * with a negative capacity, or with a null usages and a positive capacity.
+ * Return value: On success, return the number of entry functions recorded,
+ * which may be larger than capacity. On failure, return -1.
+*/
+int uthread_get_entry_stack_usage(uthread_entry_stack_usage* usages, 
+                                  int capacity)
+{
+	if(!runtime -> stackAllocator -> isPainting() || capacity < 0 || 
+	   (usages == nullptr && capacity > 0))
+	{
+		fprintf(stderr, "thread library error: Stack painting is off, or "\
+		"invalid usage buffer\n");
+		return FUNCTION_FAIL;
+	}
+	
+	maskSIGVRALRM();
+	int count = runtime -> stackUsageTable -> report(usages, capacity);
+	unmaskSIGVRALRM();
+	return count;
+}
+
+
+/*
+ * Description: This function starts recording scheduler events (spawn, 
+ * switch in and out, block, resume, sleep, wake, terminate and signal 
+ * arrival) into a ring buffer holding the last capacity events. A previously
+ * recorded trace is discarded. It is an error to call this function with a
+ * non-positive capacity.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_trace_start(int capacity)
+{
+	if(capacity <= 0)
+	{
+		fprintf(stderr, "thread library error: trace capacity must be "\
+		"positive\n");
+		return FUNCTION_FAIL;
+	}
+	
+	maskSIGVRALRM();
+	
+	TraceBuffer* newBuffer;
+	// If memory for the buffer can't be allocated, abort program with exit
+	// code 1.
+	try
+	{
+		newBuffer = new TraceBuffer(capacity);
+	}
+	catch(const char* e)
+	{
+		cleanAndAbort(1);
+	}
+	
+	traceBuffer = nullptr;
+	delete runtime -> traceStorage;
+	runtime -> traceStorage = newBuffer;
+	traceBuffer = newBuffer;
+	
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function stops recording scheduler events. The events
+ * recorded so far are kept, and may still be dumped. Stopping when no trace
+ * is recorded has no effect and is not considered as an error.
+ * Return value: Always 0.
+*/
+int uthread_trace_stop()
+{
+	traceBuffer = nullptr;
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function writes the recorded scheduler events to the 
+ * file at path, in the Chrome trace JSON format, which can be opened by
+ * chrome://tracing and by the Perfetto UI. It is an error to call this 
+ * function if no trace was started, or if the file can't be written.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_trace_dump(const char* path)
+{
+	if(runtime -> traceStorage == nullptr)
+	{
+		fprintf(stderr, "thread library error: No trace was started\n");
+		return FUNCTION_FAIL;
+	}
+	
+	FILE* out = fopen(path, "w");
+	if(out == NULL)
+	{
+		fprintf(stderr, "thread library error: Can't open trace file\n");
+		return FUNCTION_FAIL;
+	}
+	
+	//Calibrating before masking, as it may wait for the clock to advance
+	double cyclesPerUsec = runtime -> schedulerStats -> cyclesPerUsec();
+	
+	maskSIGVRALRM();
+	int retVal = runtime -> traceStorage -> dumpChromeTrace(out, cyclesPerUsec);
+	unmaskSIGVRALRM();
+	
+	if(fclose(out) != 0 || retVal == FUNCTION_FAIL)
+	{
+		fprintf(stderr, "thread library error: Can't write trace file\n");
+		return FUNCTION_FAIL;
+	}
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function starts the sampling profiler: every 
+ * interval_usecs micro-seconds of the calling kernel thread's CPU time, a 
+ * SIGPROF handler (running on an alternate signal stack) records the 
+ * RUNNING thread's id, the entry function it was spawned with and its 
+ * backtrace, into a ring buffer holding the last capacity samples. A 
+ * previously recorded profile is discarded. Samples taken while the library
+ * runs with SIGVTALRM masked aren't unwound. Frames are named when the 
+ * profile is dumped, by the dynamic symbol table, so the executable should 
+ * be linked with -rdynamic. It is an error to call this function with a 
+ * non-positive interval_usecs or capacity. 
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_profile_start(int interval_usecs, int capacity)
+{
+	if(interval_usecs <= 0 || capacity <= 0)
+	{
+		fprintf(stderr, "thread library error: profiling interval and "\
+		"capacity must be positive\n");
+		return FUNCTION_FAIL;
+	}
+	
+	maskSIGVRALRM();
+	
+	//The samples are unwound on an alternate stack, as the running thread's
+	//may not hold the unwinder
+	if(runtime -> faultStack == nullptr)
+	{
+		runtime -> faultStack = new char[FAULT_STACK_SIZE];
+		installAlternateStack();
+	}
+	installProfileHandler();
+	
+	Profiler* newProfiler;
+	// If the profiler can't be created, abort program with exit code 1.
+	try
+	{
+		newProfiler = new Profiler(interval_usecs, capacity);
+	}
+	catch(const char* e)
+	{
+		cleanAndAbort(1);
+	}
+	
+	Profiler* oldProfiler = runtime -> profiler;
+	runtime -> profiler = newProfiler;
+	delete oldProfiler;
+	
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function stops the sampling profiler. The samples 
+ * recorded so far are kept, and may still be dumped. Stopping when the 
+ * profiler isn't running has no effect and is not considered as an error.
+ * Return value: Always 0.
+*/
+int uthread_profile_stop()
+{
+	if(runtime != nullptr && runtime -> profiler != nullptr)
+	{
+		runtime -> profiler -> stop();
+	}
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function writes the recorded samples to the file at 
+ * path as folded stacks (a line per stack, its frames separated by 
+ * semicolons from the outermost, followed by its number of samples), which
+ * flamegraph.pl, inferno and speedscope read. Each stack is rooted at the
+ * thread it was sampled in, or at the thread's entry function, as set by 
+ * group. It is an error to call this function if the profiler was never 
+ * started, with an unknown group, or if the file can't be written.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_profile_dump(const char* path, uthread_profile_group group)
+{
+	if(runtime -> profiler == nullptr)
+	{
+		fprintf(stderr, "thread library error: The profiler was never "\
+		"started\n");
+		return FUNCTION_FAIL;
+	}
+	if(group != UTHREAD_PROFILE_BY_THREAD && group != UTHREAD_PROFILE_BY_ENTRY)
+	{
+		fprintf(stderr, "thread library error: Unknown profile grouping\n");
+		return FUNCTION_FAIL;
+	}
+	
+	FILE* out = fopen(path, "w");
+	if(out == NULL)
+	{
+		fprintf(stderr, "thread library error: Can't open profile file\n");
+		return FUNCTION_FAIL;
+	}
+	
+	//The samples are recorded by the SIGPROF handler of this kernel thread
+	sigset_t profileSignalSet;
+	sigemptyset(&profileSignalSet);
+	sigaddset(&profileSignalSet, SIGPROF);
+	maskSIGVRALRM();
+	pthread_sigmask(SIG_BLOCK, &profileSignalSet, NULL);
+	int retVal = runtime -> profiler -> dumpFolded(out, group);
+	pthread_sigmask(SIG_UNBLOCK, &profileSignalSet, NULL);
+	unmaskSIGVRALRM();
+	
+	if(fclose(out) != 0 || retVal == FUNCTION_FAIL)
+	{
+		fprintf(stderr, "thread library error: Can't write profile file\n");
+		return FUNCTION_FAIL;
+	}
+	return FUNCTION_SUCCESS;
+}
+
+
+/* Publishes the stats of every thread and the totals of the runtime to its
+stats segment, freeing the records of ids no longer in use. The given thread
+is published as the running one (the scheduler publishes before switching 
+to it) */
+void publishStats(Thread* running)
+{
+	StatsSegment* segment = runtime -> statsSegment;
+	for(int tid = 0; tid < MAX_THREAD_NUM; tid++)
+	{
+		Thread* thread = runtime -> collection -> find(tid);
+		if(thread == nullptr)
+		{
+			if(segment -> holds(tid))
+			{
+				segment -> clearThread(tid);
+			}
+			continue;
+		}
 		
+		StatsThreadData* data = segment -> beginThread(tid);
+		data -> tid = tid;
+		data -> state = thread -> getState();
+		data -> quantums = thread -> getQuantumRuntime();
+		data -> voluntarySwitches = thread -> getVoluntarySwitches();
+		data -> involuntarySwitches = thread -> getInvoluntarySwitches();
+		data -> runCycles = thread -> getCyclesInState(RUNNING);
+		segment -> endThread(tid);
+	}
+	
+	SchedulerStats* schedulerStats = runtime -> schedulerStats;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	StatsTotals* totals = segment -> beginTotals();
+	totals -> liveThreads = runtime -> collection -> size();
+	totals -> readyLength = runtime -> readyQueue -> size();
+	totals -> sleepers = runtime -> sleepManager -> size();
+	totals -> runningTid = running -> getId();
+	totals -> totalQuantums = runtime -> totalQuantumCounter;
+	totals -> voluntarySwitches = schedulerStats -> getVoluntarySwitches();
+	totals -> involuntarySwitches = schedulerStats -> 
+	                                getInvoluntarySwitches();
+	totals -> threadsSpawned = schedulerStats -> getThreadsSpawned();
+	totals -> threadsTerminated = schedulerStats -> getThreadsTerminated();
+	totals -> publishedNsecs = now.tv_sec * 1000000000ULL + now.tv_nsec;
+	segment -> endTotals();
+}
+
+
+/*
+ * Description: This function starts publishing live stats to a POSIX 
+ * shared memory object of the given name (created, or replaced if it 
+ * exists), which uthread-top and other processes can map and read without 
+ * affecting the calling process. Every period scheduling decisions, the 
+ * scheduler writes a record per thread id (the thread's state, quantums, 
+ * voluntary and involuntary switches and running cycles) and the totals 
+ * (live threads, ready queue length, sleepers, the running thread, 
+ * quantums and switches), each record under a sequence lock, so readers 
+ * never see a torn record and never delay the writer. The layout is defined
+ * by stats_segment.h. A previously published segment is unlinked. The name
+ * must start with a '/' and contain no other '/'. It is an error to call 
+ * this function with an invalid name or a non-positive period, or if the 
+ * shared memory object can't be created.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_stats_publish(const char* name, int period)
+{
+	if(name == nullptr || name[0] != '/' || strchr(name + 1, '/') != nullptr)
+	{
+		fprintf(stderr, "thread library error: Invalid stats segment "\
+		"name\n");
+		return FUNCTION_FAIL;
+	}
+	if(period <= 0)
+	{
+		fprintf(stderr, "thread library error: stats period must be "\
+		"positive\n");
+		return FUNCTION_FAIL;
+	}
+	
+	//Calibrating before masking, as it may wait for the clock to advance
+	double cyclesPerUsec = runtime -> schedulerStats -> cyclesPerUsec();
+	
+	maskSIGVRALRM();
+	
+	//The old segment is unlinked first, as it may have the same name
+	delete runtime -> statsSegment;
+	runtime -> statsSegment = nullptr;
 	try
 	{
-		thread = collection -> get(tid);
+		runtime -> statsSegment = new StatsSegment(name, MAX_THREAD_NUM, 
+		                                           cyclesPerUsec);
 	}
-	catch(const std::out_of_range)
+	catch(const char* e)
 	{
-		fprintf(stderr, "thread library error: Trying to terminate "\
-		"non-existant thread\n");
 		unmaskSIGVRALRM();
+		fprintf(stderr, "thread library error: Can't create stats "\
+		"segment\n");
 		return FUNCTION_FAIL;
 	}
+	runtime -> statsPeriod = period;
+	publishStats(runtime -> runningThread);
 	
-	//It ias an error to try and kill a sleeping thread
-	if(thread -> getState() == SLEEPING)
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function stops publishing live stats: the segment is 
+ * marked closed and unlinked (readers which mapped it may still read its 
+ * last publication). Stopping when no segment is published has no effect 
+ * and is not considered as an error.
+ * Return value: Always 0.
+*/
+int uthread_stats_unpublish()
+{
+	if(runtime != nullptr && runtime -> statsSegment != nullptr)
 	{
-		fprintf(stderr, "thread library error: Trying to terminate "\
-		"a sleeping thread\n");
+		maskSIGVRALRM();
+		delete runtime -> statsSegment;
+		runtime -> statsSegment = nullptr;
 		unmaskSIGVRALRM();
+	}
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function creates a thread-local key. Each thread 
+ * (including the main thread) holds its own value for the key, which is NULL
+ * until set by uthread_setspecific. When a thread other than the main thread
+ * is terminated, destructor (if not NULL) is called with each of its 
+ * non-NULL values, after the value is reset to NULL - for up to 
+ * UTHREAD_DESTRUCTOR_ITERATIONS rounds, if destructors set values again. The
+ * destructors are run by the thread calling uthread_terminate (or returning
+ * from its entry function), before the thread is terminated - and only if 
+ * it can be, so a failing uthread_terminate leaves the values as they are.
+ * At most UTHREAD_KEYS_MAX keys can be created, and keys are never deleted.
+ * Return value: On success, return the new key. On failure, return -1.
+*/
+int uthread_key_create(void (*destructor)(void*))
+{
+	maskSIGVRALRM();
+	int key = runtime -> threadKeys -> create(destructor);
+	unmaskSIGVRALRM();
+	if(key == FUNCTION_FAIL)
+	{
+		fprintf(stderr, "thread library error: All thread-local keys were "\
+		"created\n");
+	}
+	return key;
+}
+
+
+/*
+ * Description: This function returns the RUNNING thread's value for key.
+ * The value is read through a pointer to the thread's slots, which is 
+ * updated on every context switch, so this function doesn't mask signals. 
+ * It is an error to call this function before uthread_init, or with a key 
+ * which wasn't created.
+ * Return value: The RUNNING thread's value for key, or NULL on failure.
+*/
+void* uthread_getspecific(int key)
+{
+	//A preemption can't change the slots between reading the pointer and 
+	//indexing it, as they are the running thread's whenever it runs
+	uthread_runtime* self = runtime;
+	if(self == nullptr || 
+	   (unsigned)key >= (unsigned)self -> threadKeys -> size())
+	{
+		fprintf(stderr, "thread library error: Invalid thread-local key\n");
+		return nullptr;
+	}
+	return self -> runningSlots[key];
+}
+
+
+/*
+ * Description: This function sets the RUNNING thread's value for key, 
+ * without masking signals. It is an error to call this function before 
+ * uthread_init, or with a key which wasn't created.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_setspecific(int key, const void* value)
+{
+	uthread_runtime* self = runtime;
+	if(self == nullptr || 
+	   (unsigned)key >= (unsigned)self -> threadKeys -> size())
+	{
+		fprintf(stderr, "thread library error: Invalid thread-local key\n");
 		return FUNCTION_FAIL;
 	}
-		
-	//If the given thread was the main thread, scheduler is run in order to
-	//replace it (the thread will no longer run as the object and all pointers
-	//have been deleted)
-	if(tid == MAIN_ID)
+	self -> runningSlots[key] = (void*)value;
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function allocates size bytes (aligned to 16 bytes) for
+ * the RUNNING thread, from a chain of memory regions held by the thread. The
+ * memory can't be freed on its own: the whole chain is released at once 
+ * when the thread terminates, and its regions are kept by the runtime for 
+ * reuse (up to arena_pool_max). An allocation only bumps a pointer in the 
+ * thread's region, without masking signals. When the region is used up, a 
+ * new one is taken from the runtime's pool (or allocated, and an allocation
+ * larger than a region gets a region of its own). The main thread's regions
+ * are only released when the process exits. If a region can't be 
+ * allocated, the process exits with exit code 1.
+ * Return value: A pointer to the allocated memory.
+*/
+void* uthread_alloc(size_t size)
+{
+	void* memory = runtime -> runningThread -> allocate(size);
+	if(memory != nullptr)
 	{
-		cleanAndAbort(0);
+		return memory;
+	}
+	
+	maskSIGVRALRM();
+	Thread* self = runtime -> runningThread;
+	// If memory for the region can't be allocated, abort program with exit
+	// code 1.
+	try
+	{
+		self -> addRegion(runtime -> arenaPool -> take(size));
+	}
+	catch(const char* e)
+	{
+		cleanAndAbort(1);
+	}
+	memory = self -> allocate(size);
+	unmaskSIGVRALRM();
+	return memory;
+}
+
+
+/*
+ * Description: This function creates a generator: fn, called with arg on a
+ * stack of its own (like a new thread's), producing values one at a time 
+ * with uthread_generator_yield for the thread pulling them with 
+ * uthread_generator_next. The generator only runs inside 
+ * uthread_generator_next, as part of the calling thread (its consumer): 
+ * control moves between the two by a direct switch of stacks, without a 
+ * scheduling decision, the ready queue or a system call, so an item costs a
+ * single switch each way. The library functions called by fn act on the 
+ * consumer, which may be preempted, sleep or block while running the 
+ * generator as usual. The generator doesn't take a thread id. Generators 
+ * may nest, and are bound to the runtime that created them. It is an error 
+ * to create a generator of a null fn.
+ * Return value: On success, return the generator. On failure, return NULL.
+*/
+uthread_generator* uthread_generator_create(void (*fn)(void*), void* arg)
+{
+	if(fn == nullptr)
+	{
+		fprintf(stderr, "thread library error: Can't create a generator of "\
+		"a null function\n");
+		return nullptr;
+	}
+	
+	maskSIGVRALRM();
+	uthread_generator* generator;
+	// If memory for the stack can't be allocated, abort program with exit 
+	// code 1.
+	try
+	{
+		generator = new uthread_generator(runtime -> stackAllocator, fn, arg);
+	}
+	catch(const char* e)
+	{
+		cleanAndAbort(1);
+	}
+	unmaskSIGVRALRM();
+	return generator;
+}
+
+
+/*
+ * Description: This function runs the generator until it yields a value, 
+ * which is stored in value, or until its function returns. A finished 
+ * generator returns right away. It is an error to call this function with 
+ * a null generator or value, or with a generator which is running (such as
+ * from inside the generator itself).
+ * Return value: Return 1 if the generator yielded a value, 0 if it has 
+ * finished, and -1 on failure.
+*/
+int uthread_generator_next(uthread_generator* generator, void** value)
+{
+	if(runtime == nullptr || generator == nullptr || value == nullptr || 
+	   generator -> isRunning())
+	{
+		fprintf(stderr, "thread library error: Invalid generator to run\n");
+		return FUNCTION_FAIL;
+	}
+	return generator -> next(runtime -> runningThread, value) ? 1 : 0;
+}
+
+
+/*
+ * Description: This function hands value to the consumer of the generator
+ * running it, and returns once the generator is resumed by 
+ * uthread_generator_next. It is an error to call this function outside of 
+ * a generator.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_generator_yield(void* value)
+{
+	Generator* generator = runtime == nullptr ? nullptr : 
+	                       runtime -> runningThread -> getGenerator();
+	if(generator == nullptr)
+	{
+		fprintf(stderr, "thread library error: Yielding a value outside of "\
+		"a generator\n");
+		return FUNCTION_FAIL;
+	}
+	generator -> yield(value);
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function destroys the generator and frees its stack. A
+ * generator which hasn't finished is abandoned where it yielded last (its 
+ * function never continues). A generator whose consumer was terminated 
+ * while running it is finished. It is an error to call this function with 
+ * a null generator, or with a generator which is running.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_generator_destroy(uthread_generator* generator)
+{
+	if(generator == nullptr || generator -> isRunning())
+	{
+		fprintf(stderr, "thread library error: Invalid generator to "\
+		"destroy\n");
+		return FUNCTION_FAIL;
+	}
+	
+	maskSIGVRALRM();
+	delete generator;
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function posts a task - a call of fn with the argument
+ * arg - to the library's task runner. The task runner is a thread created
+ * by the library when the first task is posted, which runs posted tasks one
+ * after the other in the order they were posted, and is BLOCKED while there
+ * are none. It is scheduled like any other thread (and counts towards 
+ * MAX_THREAD_NUM). It is an error to post a null fn.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_post(void (*fn)(void*), void* arg)
+{
+	if(fn == nullptr)
+	{
+		fprintf(stderr, "thread library error: Can't post a null task\n");
+		return FUNCTION_FAIL;
+	}
+	
+	maskSIGVRALRM();
+	runtime -> taskQueue -> post(fn, arg);
+	createTaskRunner();
+	wakeTaskRunner();
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function posts a task like uthread_post, to be run 
+ * after num_quantums quantums (not including the current quantum), like a
+ * thread that called uthread_sleep. Waiting tasks are kept in a heap, so the
+ * cost of a scheduling decision doesn't grow with their number. It is an
+ * error to post a null fn, or a non-positive num_quantums.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_post_after(int num_quantums, void (*fn)(void*), void* arg)
+{
+	if(fn == nullptr || num_quantums <= 0)
+	{
+		fprintf(stderr, "thread library error: Delayed tasks must have a "\
+		"function and a positive number of quantums\n");
+		return FUNCTION_FAIL;
 	}
 	
-	//Delete given thread
+	maskSIGVRALRM();
+	//The task becomes due at the same quantum a sleeping thread wakes up
+	runtime -> taskQueue -> postAt(
+	          (int64_t)runtime -> totalQuantumCounter + num_quantums + 1, 
+	          fn, arg);
+	//The scheduler moves the task when it becomes due, and only wakes the 
+	//runner
+	createTaskRunner();
+	unmaskSIGVRALRM();
+	return FUNCTION_SUCCESS;
+}
 
-	collection -> remove(tid); //n ote - this function throws an exception,
-							   //but this would have been caught by the catch
-							   //above
-							   
-	readyQueue -> remove(thread);
-	sleepManager -> remove(thread);
-	idDistributor -> freeId(tid);
-	delete thread;	
-	
-	//If the main thread is being deleted, delete all threads, remove all
-	//resources and exit process
-	
-	if(tid ==runningThreadId)
+
+/*
+ * Description: This function makes the RUNNING thread wait until *flag is
+ * non-zero. A thread other than the main thread is BLOCKED while waiting, 
+ * and must be resumed (with uthread_resume) by whoever sets the flag, after
+ * setting it. The main thread, which can't be blocked, yields until the flag
+ * is set. Checking the flag and blocking is atomic with respect to the 
+ * library's threads, so a wakeup can't be lost.
+ * Return value: Always 0.
+*/
+int uthread_wait_flag(volatile int* flag)
+{
+	maskSIGVRALRM();
+	while(*flag == 0)
 	{
-		scheduler();
+		if(runtime -> runningThread -> getId() == MAIN_ID)
+		{
+			scheduler(YIELDED);
+			continue;
+		}
+		traceEvent(TRACE_BLOCK, runtime -> runningThread -> getId());
+		runtime -> runningThread -> setState(BLOCKED);
+		scheduler(BLOCKED_SELF);
 	}
-	
 	unmaskSIGVRALRM();
-	return FUNCTION_SUCCESS;		
+	return FUNCTION_SUCCESS;
 }
 
 
 /*
- * Description: This function blocks the thread with ID tid. The thread may
- * be resumed later using uthread_resume. If no thread with ID tid exists it
- * is considered as an error. In addition, it is an error to try blocking the
- * main thread (tid == 0). If a thread blocks itself, a scheduling decision
- * should be made. Blocking a thread in BLOCKED or SLEEPING states has no
- * effect and is not considered as an error.
+ * Description: This function returns the runtime of the calling kernel 
+ * thread. Each kernel thread which called uthread_init runs its own runtime
+ * - its own threads, queues and quantum timer - and all other library 
+ * functions act on the calling kernel thread's runtime. The returned handle
+ * lets other kernel threads send requests to the runtime (see 
+ * uthread_resume_remote_on), and stays valid until the process exits.
+ * Return value: The calling kernel thread's runtime, or NULL if it didn't
+ * call uthread_init.
+*/
+uthread_runtime* uthread_get_runtime()
+{
+	return runtime;
+}
+
+
+/*
+ * Description: This function asks the given runtime to resume its thread 
+ * with ID tid, like uthread_resume, and may be called from any kernel thread
+ * or signal handler (it doesn't touch the runtime's state). The request is 
+ * pushed to a lock-free queue, which the runtime's scheduler drains on every
+ * scheduling decision, so it takes effect by the next one; requests naming 
+ * a thread which doesn't exist by then are ignored. It is an error to call 
+ * this function with a null runtime, with a tid out of range, or when the 
+ * queue holds remote_capacity requests already. Errors are written with 
+ * write(2), which is safe in signal handlers.
  * Return value: On success, return 0. On failure, return -1.
 */
-int uthread_block(int tid)
+int uthread_resume_remote_on(uthread_runtime* target, int tid)
 {
-	maskSIGVRALRM();
-	
-	if(tid == MAIN_ID)
+	if(target == nullptr || tid < 0 || tid >= MAX_THREAD_NUM)
 	{
-		fprintf(stderr, "thread library error: Trying to block main "\
-		"thread\n");
-		unmaskSIGVRALRM();
+		writeRemoteError("thread library error: Trying to resume "\
+		"non-existant thread\n");
 		return FUNCTION_FAIL;
 	}
-	Thread* thread;
 	
-	try
+	RemoteRequest request = {nullptr, nullptr, tid};
+	if(!target -> remoteQueue -> push(request))
 	{
-		thread = collection -> get(tid);
+		writeRemoteError("thread library error: Remote queue is full\n");
+		return FUNCTION_FAIL;
 	}
-	catch(const std::out_of_range)
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function posts a task - a call of fn with the argument
+ * arg - to the given runtime, like uthread_post, and may be called from any
+ * kernel thread or signal handler. The task is pushed to the queue of 
+ * uthread_resume_remote_on, and posted when the runtime's scheduler drains
+ * it. It is an error to call this function with a null runtime or fn, with
+ * a runtime initialized without remote_tasks, or when the queue is full. 
+ * Tasks submitted after the task runner was terminated wait for a 
+ * uthread_post to create it again.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_submit_remote_on(uthread_runtime* target, void (*fn)(void*), 
+                             void* arg)
+{
+	if(target == nullptr || fn == nullptr || !target -> remoteTasks)
 	{
-		fprintf(stderr, "thread library error: Trying to block non-"\
-		"existant thread\n");
-		unmaskSIGVRALRM();
+		writeRemoteError("thread library error: Can't submit a null task, "\
+		"or to a runtime without remote tasks\n");
 		return FUNCTION_FAIL;
 	}
 	
-	switch(thread -> getState()){
-		//In case thread is currently running, the next runner up will 
-		//be inserted instead.
-		case RUNNING: 
-			assert(runningThread -> getId() == tid);
-			thread -> setState(BLOCKED);
-			scheduler();
-			break;
-			
-		//If thread was in the waiting queue, it is removed.
-		case READY:
-			readyQueue -> remove(tid);
-			thread -> setState(BLOCKED);
-			break;
-		default:
-			//No action for other states
-			break;
-	}	
-	
-	unmaskSIGVRALRM();
+	RemoteRequest request = {fn, arg, 0};
+	if(!target -> remoteQueue -> push(request))
+	{
+		writeRemoteError("thread library error: Remote queue is full\n");
+		return FUNCTION_FAIL;
+	}
 	return FUNCTION_SUCCESS;
 }
 
 
 /*
- * Description: This function resumes a blocked thread with ID tid and moves
- * it to the READY state. Resuming a thread in the RUNNING, READY or SLEEPING
- * state has no effect and is not considered as an error. If no thread with
- * ID tid exists it is considered as an error.
+ * Description: This function is uthread_resume_remote_on, for the first 
+ * runtime initialized in the process.
  * Return value: On success, return 0. On failure, return -1.
 */
-int uthread_resume(int tid)
+int uthread_resume_remote(int tid)
 {
+	return uthread_resume_remote_on(primaryRuntime.load(), tid);
+}
 
-	maskSIGVRALRM();
-	
-	Thread* thread;
+
+/*
+ * Description: This function is uthread_submit_remote_on, for the first 
+ * runtime initialized in the process.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_submit_remote(void (*fn)(void*), void* arg)
+{
+	return uthread_submit_remote_on(primaryRuntime.load(), fn, arg);
+}
+
+
+/*
+ * Description: This function returns an eventfd of the calling kernel 
+ * thread's runtime, which becomes readable when remote requests are pushed
+ * to it, and is reset by the scheduler when it drains them. Library threads
+ * are scheduled by a CPU time timer, which doesn't run while the kernel 
+ * thread waits in the kernel, so a thread waiting for I/O (with poll, select
+ * or epoll) should wait for this fd too, and call uthread_yield when it is 
+ * readable, rather than read it.
+ * Return value: The eventfd, or -1 if the library isn't initialized.
+*/
+int uthread_remote_fd()
+{
+	if(runtime == nullptr)
+	{
+		return FUNCTION_FAIL;
+	}
+	return runtime -> remoteQueue -> getFd();
+}
+
+
+/*
+ * Description: This function starts the library's executor: workers 
+ * long-lived threads (counting towards MAX_THREAD_NUM), which run the jobs 
+ * submitted by uthread_executor_submit one after the other, and are BLOCKED
+ * while there are none. Up to capacity submitted jobs may wait for a 
+ * worker. It is an error to call this function with a non-positive workers
+ * or capacity, if the executor was started already, or if it would cause 
+ * the number of concurrent threads to exceed MAX_THREAD_NUM.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_executor_start(int workers, int capacity)
+{
+	if(workers <= 0 || capacity <= 0)
+	{
+		fprintf(stderr, "thread library error: Invalid executor size\n");
+		return FUNCTION_FAIL;
+	}
 	
-	try
+	maskSIGVRALRM();
+	if(runtime -> executor != nullptr)
 	{
-		thread = collection -> get(tid);
+		unmaskSIGVRALRM();
+		fprintf(stderr, "thread library error: Executor is already "\
+		"started\n");
+		return FUNCTION_FAIL;
 	}
-	catch(const std::out_of_range)
+	if(runtime -> collection -> size() + workers > MAX_THREAD_NUM)
 	{
-		fprintf(stderr, "thread library error: Trying to resume non-" \
-		"existant thread\n");
 		unmaskSIGVRALRM();
+		fprintf(stderr,"thread library error: you reached the max number "\
+		"of threads\n");
 		return FUNCTION_FAIL;
 	}
 	
-	if(thread -> getState() == BLOCKED)
+	runtime -> executor = new Executor(capacity, workers);
+	for(int i = 0; i < workers; i++)
 	{
-		thread -> setState(READY);
-		readyQueue -> add(thread);
+		Thread* worker = createThread(runExecutorJobs, nullptr, 0, nullptr,
+		                              nullptr);
+		runtime -> executor -> addWorker(worker);
+		runtime -> readyQueue -> add(worker);
 	}
-
+	
 	unmaskSIGVRALRM();
 	return FUNCTION_SUCCESS;
 }
 
+
 /*
- * Description: This function puts the RUNNING thread to sleep for a period
- * of num_quantums (not including the current quantum) after which it is moved
- * to the READY state. num_quantums must be a positive number. It is an error
- * to try to put the main thread (tid==0) to sleep. Immediately after a thread
- * transitions to the SLEEPING state a scheduling decision should be made.
- * Return value: On success, return 0. On failure, return -1.
+ * Description: This function submits a job - a call of fn with the argument
+ * arg - to the executor, and returns a future which is done once a worker 
+ * has run it, holding its return value. If capacity jobs are waiting 
+ * already, the calling thread is BLOCKED until a worker takes one (the main
+ * thread, which can't be blocked, yields until then). The future must be 
+ * given up with uthread_future_release. It is an error to call this 
+ * function before uthread_executor_start, with a null fn, or from a worker
+ * when the queue is full (as all workers could wait for each other).
+ * Return value: On success, return the future. On failure, return NULL.
 */
-int uthread_sleep(int num_quantums)
+uthread_future* uthread_executor_submit(void* (*fn)(void*), void* arg)
 {
-	maskSIGVRALRM();
-	
-	if(runningThread -> getId() == MAIN_ID)
+	return submitJob(fn, arg, true);
+}
+
+
+/*
+ * Description: This function submits a job like uthread_executor_submit, 
+ * but fails rather than waiting if the queue is full, so that the caller 
+ * may shed or defer the work.
+ * Return value: On success, return the future. On failure (including a 
+ * full queue), return NULL.
+*/
+uthread_future* uthread_executor_try_submit(void* (*fn)(void*), void* arg)
+{
+	return submitJob(fn, arg, false);
+}
+
+
+/*
+ * Description: This function makes the RUNNING thread wait until the job of
+ * future was run, and returns its return value. A thread other than the 
+ * main thread is BLOCKED while waiting, and the main thread yields until 
+ * then. A worker waiting for a job which is still in the queue may wait 
+ * forever, if all workers wait. It is an error to call this function with a
+ * null future, or while another thread waits for it.
+ * Return value: The return value of the future's job, or NULL on failure.
+*/
+void* uthread_future_wait(uthread_future* future)
+{
+	if(future == nullptr)
 	{
-		fprintf(stderr, "thread library error: Trying to put main "\
-		"thread to sleep\n");
-		unmaskSIGVRALRM();
-		return FUNCTION_FAIL;		
+		fprintf(stderr, "thread library error: Can't wait for a null "\
+		"future\n");
+		return nullptr;
 	}
 	
-	if(num_quantums <= 0)
+	maskSIGVRALRM();
+	while(!future -> done)
 	{
-		fprintf(stderr, "thread library error: num_quantums for sleep call"\
-		" must be positive\n");
-		unmaskSIGVRALRM();
-		return FUNCTION_FAIL;		
+		if(runtime -> runningThread -> getId() == MAIN_ID)
+		{
+			scheduler(YIELDED);
+			continue;
+		}
+		if(future -> waiter != nullptr)
+		{
+			unmaskSIGVRALRM();
+			fprintf(stderr, "thread library error: Another thread waits for "\
+			"the future\n");
+			return nullptr;
+		}
+		runtime -> executor -> waitForFuture(future, runtime -> runningThread);
+		blockRunningThread();
+		runtime -> executor -> stopWaiting(runtime -> runningThread);
 	}
-	
-	
-	assert(runningThread -> getState() == RUNNING);
-	runningThread -> setState(SLEEPING);
-	runningThread -> setQuantumsTillWakeup(num_quantums);
-	sleepManager -> add(runningThread);
-	scheduler();
-	
+	void* result = future -> result;
 	unmaskSIGVRALRM();
-	return FUNCTION_SUCCESS;	
-	
+	return result;
 }
 
+
 /*
- * Description: This function returns the number of quantums until the thread
- * with id tid wakes up including the current quantum. If no thread with ID
- * tid exists it is considered as an error. If the thread is not sleeping,
- * the function should return 0.
- * Return value: Number of quantums (including current quantum) until wakeup.
+ * Description: This function sets a continuation of the future: fn is called
+ * with the return value of its job and with arg, once the job was run - by
+ * the worker which ran it, right after it. If the job was run already, fn 
+ * is called at once by the calling thread. It is an error to call this 
+ * function with a null future or fn, or if the future has a continuation.
+ * Return value: On success, return 0. On failure, return -1.
 */
-int uthread_get_time_until_wakeup(int tid)
+int uthread_future_then(uthread_future* future, 
+                        void (*fn)(void* result, void* arg), void* arg)
 {
-	maskSIGVRALRM();
-	Thread* thread;
-		
-	try
-	{
-		thread = collection -> get(tid);
-	}
-	catch(const std::out_of_range)
+	if(future == nullptr || fn == nullptr)
 	{
-		fprintf(stderr, "thread library error: Trying to get time until "\
-		"wakeup for non-existant thread\n");
-		unmaskSIGVRALRM();
+		fprintf(stderr, "thread library error: Null future or "\
+		"continuation\n");
 		return FUNCTION_FAIL;
 	}
 	
-	if(thread -> getState() == SLEEPING)
+	maskSIGVRALRM();
+	if(future -> thenFn != nullptr)
 	{
-		//Since implementation decrements this value at the
-		//start of each quantum, 1 must be added in order to obtain
-		//true value
 		unmaskSIGVRALRM();
-		return thread -> getQuantumsTillWakeup() + 1;
+		fprintf(stderr, "thread library error: The future already has a "\
+		"continuation\n");
+		return FUNCTION_FAIL;
 	}
-	else{
+	if(!future -> done)
+	{
+		future -> thenFn = fn;
+		future -> thenArg = arg;
 		unmaskSIGVRALRM();
-		return 0;
+		return FUNCTION_SUCCESS;
 	}
+	void* result = future -> result;
+	unmaskSIGVRALRM();
 	
+	fn(result, arg);
+	return FUNCTION_SUCCESS;
 }
 
 
 /*
- * Description: This function returns the thread ID of the calling thread.
- * Return value: The ID of the calling thread.
+ * Description: This function gives the future up. Its object is reused by
+ * later submissions once its job was run (its continuation, if any, still
+ * runs), so it must not be used anymore. It is an error to call this 
+ * function with a null future.
+ * Return value: On success, return 0. On failure, return -1.
 */
-
-int uthread_get_tid()
+int uthread_future_release(uthread_future* future)
 {
+	if(future == nullptr)
+	{
+		fprintf(stderr, "thread library error: Can't release a null "\
+		"future\n");
+		return FUNCTION_FAIL;
+	}
 	
 	maskSIGVRALRM();
-	int id = runningThread -> getId();
-	
+	if(future -> done)
+	{
+		runtime -> executor -> freeFuture(future);
+	}
+	else
+	{
+		future -> released = true;
+	}
 	unmaskSIGVRALRM();
-	return id;
+	return FUNCTION_SUCCESS;
 }
 
-/*
- * Description: This function returns the total number of quantums that were
- * started since the library was initialized, including the current quantum.
- * Right after the call to uthread_init, the value should be 1.
- * Each time a new quantum starts, regardless of the reason, this number
- * should be increased by 1.
- * Return value: The total number of quantums.
-*/
-int uthread_get_total_quantums()
+
+/* Returns the next number of the simulation's pseudo-random sequence 
+(xorshift64*) */
+uint64_t nextSimRandom()
 {
-	return totalQuantumCounter;	
+	uint64_t state = runtime -> simState;
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	runtime -> simState = state;
+	return state * 0x2545F4914F6CDD1DULL;
 }
 
 
+/* Preempts the running thread as the quantum timer would. A preempted 
+thread's floating point control state is kept in its signal frame, so here
+it is saved before the switch. Expects SIGVTALRM to be masked */
+void simulatePreemption()
+{
+	if(runtime -> runningThread -> getContext() == UTHREAD_CONTEXT_FULL)
+	{
+		runtime -> runningThread -> saveFpu();
+	}
+	traceEvent(TRACE_SIGNAL, runtime -> runningThread -> getId(), SIGVTALRM);
+	scheduler(PREEMPTED);
+}
+
 
 /*
- * Description: This function returns the number of quantums the thread with
- * ID tid was in RUNNING state. On the first time a thread runs, the function
- * should return 1. Every additional quantum that the thread starts should
- * increase this value by 1 (so if the thread with ID tid is in RUNNING state
- * when this function is called, include also the current quantum). If no
- * thread with ID tid exists it is considered as an error.
- * Return value: On success, return the number of quantums of the 
- * thread with ID tid. On failure, return -1.
+ * Description: This function ends the quantum of the RUNNING thread in 
+ * simulation mode (see uthread_options.sim_mode), as if the timer expired:
+ * the thread is preempted, moved to the end of the READY threads list, and 
+ * a scheduling decision is made. It is an error to call this function 
+ * outside of simulation mode.
+ * Return value: On success, return 0. On failure, return -1.
 */
-int uthread_get_quantums(int tid)
+int uthread_sim_tick()
 {
 	maskSIGVRALRM();
-	Thread* thread;
-		
-	try
+	if(!runtime -> simulated)
 	{
-		thread = collection -> get(tid);
-	}
-	catch(const std::out_of_range)
-	{
-		fprintf(stderr, "thread library error: Trying to get quantums for "\
-		"non-existant thread\n");
 		unmaskSIGVRALRM();
+		fprintf(stderr, "thread library error: the library isn't in "\
+		"simulation mode\n");
 		return FUNCTION_FAIL;
 	}
 	
+	simulatePreemption();
 	unmaskSIGVRALRM();
-	return thread -> getQuantumRuntime();
+	return FUNCTION_SUCCESS;
+}
+
+
+/*
+ * Description: This function marks a point at which the RUNNING thread may
+ * be preempted in simulation mode. The point preempts the thread (like 
+ * uthread_sim_tick) with a chance of 1 in sim_preempt_odds, drawn from a 
+ * pseudo-random sequence seeded by sim_seed, so the same seed replays the 
+ * same schedule. Outside of simulation mode it does nothing.
+ * Return value: 1 if the thread was preempted, and 0 otherwise.
+*/
+int uthread_sim_point()
+{
+	if(!runtime -> simulated || runtime -> simPreemptOdds == 0)
+	{
+		return 0;
+	}
 	
+	maskSIGVRALRM();
+	bool preempt = nextSimRandom() % runtime -> simPreemptOdds == 0;
+	if(preempt)
+	{
+		simulatePreemption();
+	}
+	unmaskSIGVRALRM();
+	return preempt ? 1 : 0;
 }
@@ -1,47 +1,358 @@
 #ifndef _UTHREADS_H
 #define _UTHREADS_H
 
+#include <stddef.h>
+
 /*
  * User-Level Threads Library (uthreads)
  * Author: OS, os@cs.huji.ac.il
  */
 
+#ifndef MAX_THREAD_NUM
 #define MAX_THREAD_NUM 100 /* maximal number of threads */
+#endif
+#ifndef STACK_SIZE
 #define STACK_SIZE 4096 /* stack size per thread (in bytes) */
+#endif
+#define UTHREAD_LATENCY_BUCKETS 64 /* buckets in the switch latency histogram */
+#define UTHREAD_DEFAULT_POOL_MAX 32 /* default of uthread_options.pool_max */
+/* defaults of uthread_options.stack_max and stack_commit */
+#define UTHREAD_DEFAULT_STACK_MAX (1024 * 1024)
+#define UTHREAD_DEFAULT_STACK_COMMIT STACK_SIZE
+#define UTHREAD_DEFAULT_REAP_BATCH 16 /* default of uthread_options.reap_batch */
+/* default of uthread_options.stack_colors */
+#define UTHREAD_DEFAULT_STACK_COLORS 16
+/* default of uthread_options.remote_capacity */
+#define UTHREAD_DEFAULT_REMOTE_CAPACITY 1024
+#define UTHREAD_KEYS_MAX 16 /* maximal number of thread-local keys */
+/* defaults of uthread_options.arena_region_size and arena_pool_max */
+#define UTHREAD_DEFAULT_ARENA_REGION_SIZE (16 * 1024)
+#define UTHREAD_DEFAULT_ARENA_POOL_MAX 64
+#define UTHREAD_MIN_ARENA_REGION_SIZE 1024
+#define UTHREAD_DESTRUCTOR_ITERATIONS 4 /* rounds of key destructors */
+
+/* How the stacks of threads are allocated */
+typedef enum uthread_stack_mode
+{
+	/* Fixed stacks of STACK_SIZE bytes, allocated from the heap */
+	UTHREAD_STACK_MALLOC,
+	/* Stacks of up to stack_max bytes, of which only stack_commit bytes are 
+	committed at first. The rest of the stack's address space is reserved, 
+	and committed on demand as the thread's stack grows into it */
+	UTHREAD_STACK_GROWABLE,
+	/* Fixed stacks of STACK_SIZE bytes, packed into an arena of 2 MiB huge
+	pages (MAP_HUGETLB if huge pages are reserved, and otherwise transparent
+	huge pages, requested with madvise), so that switching among thousands 
+	of threads touches few TLB entries. Stacks of terminated threads are 
+	reused, and their pages are never released (see stack_release) */
+	UTHREAD_STACK_HUGE
+} uthread_stack_mode;
+
+/* What is done with the memory of the stacks of terminated threads which are
+kept for reuse */
+typedef enum uthread_stack_release
+{
+	/* The pages are kept, so reusing the stack doesn't fault them in again*/
+	UTHREAD_STACK_KEEP,
+	/* The pages are returned to the system at once (MADV_DONTNEED), so the 
+	process's RSS drops, and are faulted in as zero pages when reused */
+	UTHREAD_STACK_DONTNEED,
+	/* The pages are returned to the system only under memory pressure 
+	(MADV_FREE, or MADV_DONTNEED where it isn't supported) */
+	UTHREAD_STACK_FREE
+} uthread_stack_release;
+
+/* The state a thread's context switches preserve */
+typedef enum uthread_context
+{
+	/* The callee-saved registers, the signal mask, and the floating point 
+	control state (the x87 control word and MXCSR - rounding, exception 
+	masks, flush to zero), so that fenv changes stay with the thread. The 
+	x87/SSE/AVX registers themselves are caller-saved, so they hold nothing 
+	across a voluntary switch, and a preempted thread's whole FPU state is 
+	saved by the kernel in its signal frame */
+	UTHREAD_CONTEXT_FULL,
+	/* Only the callee-saved integer registers. The thread doesn't keep a 
+	signal mask of its own across voluntary switches (saving and restoring 
+	it takes two system calls per switch), and must not change the floating
+	point control state */
+	UTHREAD_CONTEXT_INTEGER
+} uthread_context;
+
+/* Attributes of a thread spawned by uthread_spawn_attr */
+typedef struct uthread_attr
+{
+	uthread_context context; /* see uthread_context */
+	/* Nonzero to run the thread on the runtime's shared run stack rather 
+	than a stack of its own. Only the frames of the shared thread which ran 
+	last are on the shared stack: the frames of the others are kept in 
+	buffers of their exact size, so a mostly idle thread costs the depth of
+	its stack rather than a whole stack. Switching between two shared 
+	threads copies the frames of both */
+	int shared_stack;
+} uthread_attr;
+
+/* The runtime of a kernel thread which called uthread_init (see 
+uthread_get_runtime) */
+typedef struct uthread_runtime uthread_runtime;
+
+/* A job submitted to the library's executor (see uthread_executor_submit)*/
+typedef struct uthread_future uthread_future;
+
+/* A function producing values on its own stack (see 
+uthread_generator_create) */
+typedef struct uthread_generator uthread_generator;
+
+/* How uthread_profile_dump roots the stacks of the profile */
+typedef enum uthread_profile_group
+{
+	/* At the thread each sample was taken in ("uthread <id>") */
+	UTHREAD_PROFILE_BY_THREAD,
+	/* At the entry function of the thread each sample was taken in, given to
+	its spawn function, merging the threads running the same function */
+	UTHREAD_PROFILE_BY_ENTRY
+} uthread_profile_group;
+
+/* Options of the thread library, given to uthread_init_options. Should be
+filled with the defaults by uthread_default_options before being changed */
+typedef struct uthread_options
+{
+	int quantum_usecs; /* length of a quantum in micro-seconds */
+	/* Number of thread objects (each with its stack) allocated at 
+	initialization, so that the first spawns don't allocate memory */
+	int pool_warm;
+	/* Maximal number of terminated thread objects kept for reuse by later
+	spawns. Objects terminated beyond that are freed */
+	int pool_max;
+	uthread_stack_mode stack_mode; /* see uthread_stack_mode */
+	/* Maximal size of a growable stack in bytes, rounded up to whole pages.
+	A thread growing its stack beyond it crashes the process */
+	size_t stack_max;
+	/* Bytes committed when a growable stack is created, rounded up to whole
+	pages. Storage reserved by uthread_spawn_with_storage must fit in half of
+	them */
+	size_t stack_commit;
+	/* If non-zero, stacks are painted with a canary pattern, so that the 
+	deepest byte each thread used can be measured. Costs scanning and 
+	repainting the stack on every spawn and termination */
+	int stack_paint;
+	/* Terminated threads are released to the pool by a reaper, once 
+	reap_batch threads are waiting, off the scheduling path: on the task 
+	runner thread if it exists (see uthread_post), and otherwise by the next
+	termination of another thread. A spawn reaps at once if the pool is 
+	empty. Stack memory is released according to stack_release, in one pass 
+	over the whole batch. Stack pages aren't released while stacks are 
+	painted or guarded, nor from huge page stacks */
+	int reap_batch;
+	uthread_stack_release stack_release; /* see uthread_stack_release */
+	/* Number of requests from other kernel threads (see 
+	uthread_resume_remote) which may wait for the scheduler, rounded up to a
+	power of two */
+	int remote_capacity;
+	/* If non-zero, the task runner (see uthread_post) is created at 
+	initialization, so that tasks submitted by other kernel threads (see 
+	uthread_submit_remote) can be posted by the scheduler, which can't 
+	create threads itself */
+	int remote_tasks;
+	/* If non-zero, the initial stack pointer of each thread is lowered by 
+	(id % stack_colors) * stack_color_stride bytes below the top of its 
+	stack, so that the top frames of different threads (whose stacks all 
+	start at page boundaries) fall in different cache sets instead of 
+	evicting each other on every switch. Must be a multiple of 16, and the 
+	largest offset must fit in a quarter of STACK_SIZE (or of stack_commit,
+	for growable stacks). 0 (no coloring) by default */
+	size_t stack_color_stride;
+	int stack_colors; /* number of stack offsets used by stack_color_stride */
+	/* If non-zero, the bottom 64 bytes of every fixed stack (malloc or huge
+	page stacks, which have no guard page) hold a canary pattern, which is 
+	checked whenever a thread switches out. A thread which overwrote it is 
+	reported as a stack overflow, and the process is aborted. Growable 
+	stacks always have a guard page, and ignore it */
+	int stack_guard;
+	uthread_context main_context; /* the main thread's uthread_context */
+	/* If non-zero, the runtime is simulated: no timer is created and the 
+	quantum_usecs is ignored, so threads are only preempted by 
+	uthread_sim_tick and by uthread_sim_point, and every run of the same 
+	program with the same sim_seed makes the same scheduling decisions */
+	int sim_mode;
+	/* The seed of the simulation's pseudo-random preemptions */
+	unsigned int sim_seed;
+	/* A uthread_sim_point preempts the running thread with a chance of 1 in
+	sim_preempt_odds (never, if 0) */
+	int sim_preempt_odds;
+	/* Bytes of each region of the threads' arenas (see uthread_alloc), at 
+	least UTHREAD_MIN_ARENA_REGION_SIZE */
+	size_t arena_region_size;
+	/* Number of free arena regions kept for reuse. Regions released beyond
+	it are freed */
+	int arena_pool_max;
+} uthread_options;
+
+/* Statistics of a single thread. All times are in cycles of the library's
+cycle counter (the TSC on Intel archs), see uthread_global_stats for the 
+conversion factor. */
+typedef struct uthread_stats
+{
+	unsigned long long run_cycles; /* time spent in RUNNING state */
+	unsigned long long ready_wait_cycles; /* time spent in the ready queue */
+	unsigned long long sleep_cycles; /* time spent in SLEEPING state */
+	unsigned long long blocked_cycles; /* time spent in BLOCKED state */
+	unsigned long long voluntary_switches; /* switched out by block/sleep */
+	unsigned long long involuntary_switches; /* preempted by the timer */
+	int quantums; /* same value as uthread_get_quantums */
+	/* bytes of the thread's stack currently committed */
+	unsigned long long stack_committed;
+} uthread_stats;
+
+/* Statistics of the whole scheduler since uthread_init */
+typedef struct uthread_global_stats
+{
+	unsigned long long total_switches;
+	unsigned long long voluntary_switches;
+	unsigned long long involuntary_switches;
+	unsigned long long threads_spawned;
+	unsigned long long threads_terminated;
+	unsigned long long cycles_since_init;
+	double cycles_per_usec; /* conversion factor of all cycle counts */
+	int total_quantums;
+	int live_threads;
+	/* Bucket i counts context switches that took [2^i, 2^(i+1)) cycles, 
+	measured from the scheduling decision until the next thread resumes */
+	unsigned long long switch_latency_hist[UTHREAD_LATENCY_BUCKETS];
+} uthread_global_stats;
+
+/* The stack usage of the terminated threads that had the same entry 
+function, measured when stack painting is on */
+typedef struct uthread_entry_stack_usage
+{
+	/* The thread's entry function - f given to the spawn function (for 
+	uthread::spawn, a function instantiated for the callable's type) */
+	void* entry;
+	unsigned long long threads; /* number of terminated threads */
+	unsigned long long max_bytes; /* deepest usage of any of them */
+	unsigned long long total_bytes; /* sum of their usage, for the mean */
+} uthread_entry_stack_usage;
 
 /* External interface */
 
 
 /*
- * Description: This function initializes the thread library. 
- * You may assume that this function is called before any other thread library
- * function, and that it is called exactly once. The input to the function is
- * the length of a quantum in micro-seconds. It is an error to call this
- * function with non-positive quantum_usecs.
+ * Description: This function initializes the thread library for the 
+ * calling kernel thread, which becomes the main thread (ID 0) of a new 
+ * runtime, independent of the runtimes of other kernel threads (see 
+ * uthread_get_runtime). It must be called in a kernel thread before any 
+ * other thread library function, and at most once per kernel thread. The 
+ * input to the function is the length of a quantum in micro-seconds of the
+ * kernel thread's CPU time. It is an error to call this function with 
+ * non-positive quantum_usecs, or a second time in the same kernel thread.
  * Return value: On success, return 0. On failure, return -1.
 */
 int uthread_init(int quantum_usecs);
 
+
+/*
+ * Description: This function fills options with the default options, which
+ * are the ones used by uthread_init (except for quantum_usecs, which is set
+ * to 0 and must be set by the caller).
+*/
+void uthread_default_options(uthread_options* options);
+
+
+/*
+ * Description: This function initializes the thread library with the given
+ * options. It replaces uthread_init, under the same conditions. It is an 
+ * error to call this function with non-positive quantum_usecs (outside of 
+ * simulation mode), with a 
+ * negative pool_warm or pool_max, with pool_warm larger than MAX_THREAD_NUM,
+ * with an unknown stack_mode, or (for growable stacks) with a zero 
+ * stack_commit or a stack_max smaller than stack_commit, with a 
+ * non-positive reap_batch, with an unknown stack_release, with a 
+ * non-positive remote_capacity, with a non-positive stack_colors or a 
+ * stack_color_stride which is misaligned or too large (see uthread_options),
+ * with an unknown main_context, with a negative sim_preempt_odds, or with 
+ * an arena_region_size below UTHREAD_MIN_ARENA_REGION_SIZE or a negative 
+ * arena_pool_max.
+ * Growable stacks are grown by the library's SIGSEGV handler, which runs on
+ * an alternate signal stack. The handler is only installed in this mode, and
+ * passes faults outside of the running thread's stack on to the default 
+ * action.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_init_options(const uthread_options* options);
+
 /*
  * Description: This function creates a new thread, whose entry point is the
  * function f with the signature void f(void). The thread is added to the end
  * of the READY threads list. The uthread_spawn function should fail if it
  * would cause the number of concurrent threads to exceed the limit
  * (MAX_THREAD_NUM). Each thread should be allocated with a stack of size
- * STACK_SIZE bytes.
+ * STACK_SIZE bytes (unless growable stacks were chosen by 
+ * uthread_init_options). When f returns, the thread is terminated as if it
+ * called uthread_terminate with its own id.
  * Return value: On success, return the ID of the created thread.
  * On failure, return -1.
 */
 int uthread_spawn(void (*f)(void));
 
 
+/*
+ * Description: This function creates a new thread like uthread_spawn, whose
+ * entry point is the function f, called with the argument arg.
+ * Return value: On success, return the ID of the created thread.
+ * On failure, return -1.
+*/
+int uthread_spawn_arg(void (*f)(void*), void* arg);
+
+
+/*
+ * Description: This function creates a new thread like uthread_spawn_arg,
+ * but first reserves size bytes at the top of the new thread's stack 
+ * (aligned to 16 bytes). Before the thread is added to the READY threads 
+ * list, init is called with the reserved storage and ctx, and the thread's
+ * entry point f is later called with the storage. This allows the thread's
+ * argument to be constructed in place without allocating memory. init is 
+ * called while the library's signals are masked, so it must not call the 
+ * library. It is an error to reserve more than half of the stack (half of
+ * the initially committed stack, with growable stacks).
+ * Return value: On success, return the ID of the created thread.
+ * On failure, return -1.
+*/
+int uthread_spawn_with_storage(void (*f)(void*), size_t size, 
+                               void (*init)(void* storage, void* ctx), 
+                               void* ctx);
+
+
+/*
+ * Description: This function fills attr with the default attributes of a 
+ * new thread, which are the ones used by uthread_spawn (a 
+ * UTHREAD_CONTEXT_FULL context, on a stack of its own).
+*/
+void uthread_attr_init(uthread_attr* attr);
+
+
+/*
+ * Description: This function creates a new thread like uthread_spawn_arg,
+ * with the given attributes. Threads which only use integer registers may 
+ * be given a UTHREAD_CONTEXT_INTEGER context, which makes their switches 
+ * cheaper. Threads which are mostly idle may be given a shared stack (the 
+ * shared run stack is created by the first of them). A shared thread's 
+ * frames must not be pointed to by other threads while it is switched out,
+ * as they are moved. It is an error to give an unknown context.
+ * Return value: On success, return the ID of the created thread.
+ * On failure, return -1.
+*/
+int uthread_spawn_attr(void (*f)(void*), void* arg, const uthread_attr* attr);
+
+
 /*
  * Description: This function terminates the thread with ID tid and deletes
  * it from all relevant control structures. All the resources allocated by
  * the library for this thread should be released. If no thread with ID tid
  * exists it is considered as an error. Terminating the main thread
  * (tid == 0) will result in the termination of the entire process using
- * exit(0) [after releasing the assigned library memory]. 
+ * exit(0) [after releasing the assigned library memory]. While the key 
+ * destructors of another thread run (see uthread_key_create), that thread 
+ * is BLOCKED and can't be resumed, and terminating it again is an error.
  * Return value: The function returns 0 if the thread was successfully
  * terminated and -1 otherwise. If a thread terminates itself or the main
  * thread is terminated, the function does not return.
@@ -49,6 +360,44 @@ int uthread_spawn(void (*f)(void));
 int uthread_terminate(int tid); 
 
 
+/*
+ * Description: This function creates n threads like uthread_spawn, all with
+ * the entry point f, and writes their ids to tids_out. All threads are 
+ * added to the end of the READY threads list at once, in the order of their
+ * ids in tids_out. The whole batch is created in a single critical section,
+ * with the stacks missing from the thread pool allocated together. The 
+ * function fails, creating no thread, if it would cause the number of 
+ * concurrent threads to exceed MAX_THREAD_NUM. It is an error to call this
+ * function with a non-positive n or a null tids_out.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_spawn_many(void (*f)(void), int n, int* tids_out);
+
+
+/*
+ * Description: This function resumes the n threads whose ids are in tids, 
+ * like uthread_resume, in a single critical section. The resumed threads are
+ * added to the end of the READY threads list at once, in the order of tids.
+ * If any of the ids doesn't exist it is considered as an error, and no 
+ * thread is resumed. It is an error to call this function with a negative n,
+ * or with a null tids and a positive n.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_resume_many(const int* tids, int n);
+
+
+/*
+ * Description: This function blocks the n threads whose ids are in tids, 
+ * like uthread_block, in a single critical section. If the calling thread is
+ * one of them, it is blocked after all others, and a scheduling decision is 
+ * made. If any of the ids doesn't exist or is the main thread's it is 
+ * considered as an error, and no thread is blocked. It is an error to call 
+ * this function with a negative n, or with a null tids and a positive n.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_block_many(const int* tids, int n);
+
+
 /*
  * Description: This function blocks the thread with ID tid. The thread may
  * be resumed later using uthread_resume. If no thread with ID tid exists it
@@ -71,6 +420,15 @@ int uthread_block(int tid);
 int uthread_resume(int tid);
 
 
+/*
+ * Description: This function moves the RUNNING thread to the end of the 
+ * READY threads list, and makes a scheduling decision. If no other thread is
+ * READY, the calling thread continues running in a new quantum.
+ * Return value: Always 0.
+*/
+int uthread_yield();
+
+
 /*
  * Description: This function puts the RUNNING thread to sleep for a period
  * of num_quantums (not including the current quantum) after which it is moved
@@ -122,5 +480,509 @@ int uthread_get_total_quantums();
 int uthread_get_quantums(int tid);
 
 
+/*
+ * Description: This function fills stats with the statistics of the thread
+ * with ID tid. Time spent in the thread's current state is included. If no
+ * thread with ID tid exists, or stats is null, it is considered as an 
+ * error. The statistics are recorded at all times, at the cost of reading 
+ * the cycle counter on each state change.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_get_stats(int tid, uthread_stats* stats);
+
+
+/*
+ * Description: This function fills stats with a snapshot of the statistics
+ * of the entire scheduler. It is an error to pass a null stats.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_get_global_stats(uthread_global_stats* stats);
+
+
+/*
+ * Description: This function returns the stack usage of the thread with ID
+ * tid - the number of bytes from the top of its stack down to the deepest
+ * byte it wrote so far. It is an error to call this function if stack 
+ * painting is off (see uthread_options.stack_paint), or if no thread with ID
+ * tid exists. The main thread, which runs on the process's stack, has a 
+ * usage of 0.
+ * Return value: On success, return the stack usage in bytes. On failure, 
+ * return -1.
+*/
+int uthread_get_stack_usage(int tid);
+
+
+/*
+ * Description: This function reports the stack usage of terminated threads,
+ * aggregated by their entry function: the number of threads, their deepest
+ * usage and their total usage (see uthread_get_stack_usage). The usage of 
+ * at most capacity entry functions is written to usages, in no particular
+ * order. It is an error to call this function if stack painting is off, 
+ * with a negative capacity, or with a null usages and a positive capacity.
+ * Return value: On success, return the number of entry functions recorded,
+ * which may be larger than capacity. On failure, return -1.
+*/
+int uthread_get_entry_stack_usage(uthread_entry_stack_usage* usages, 
+                                  int capacity);
+
+
+/*
+ * Description: This function starts recording scheduler events (spawn, 
+ * switch in and out, block, resume, sleep, wake, terminate and signal 
+ * arrival) into a ring buffer holding the last capacity events. A previously
+ * recorded trace is discarded. It is an error to call this function with a
+ * non-positive capacity.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_trace_start(int capacity);
+
+
+/*
+ * Description: This function stops recording scheduler events. The events
+ * recorded so far are kept, and may still be dumped. Stopping when no trace
+ * is recorded has no effect and is not considered as an error.
+ * Return value: Always 0.
+*/
+int uthread_trace_stop();
+
+
+/*
+ * Description: This function writes the recorded scheduler events to the 
+ * file at path, in the Chrome trace JSON format, which can be opened by
+ * chrome://tracing and by the Perfetto UI. It is an error to call this 
+ * function if no trace was started, or if the file can't be written.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_trace_dump(const char* path);
+
+
+/*
+ * Description: This function starts the sampling profiler: every 
+ * interval_usecs micro-seconds of the calling kernel thread's CPU time, a 
+ * SIGPROF handler (running on an alternate signal stack) records the 
+ * RUNNING thread's id, the entry function it was spawned with and its 
+ * backtrace, into a ring buffer holding the last capacity samples. A 
+ * previously recorded profile is discarded. Samples taken while the library
+ * runs with SIGVTALRM masked aren't unwound. Frames are named when the 
+ * profile is dumped, by the dynamic symbol table, so the executable should 
+ * be linked with -rdynamic. It is an error to call this function with a 
+ * non-positive interval_usecs or capacity. 
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_profile_start(int interval_usecs, int capacity);
+
+
+/*
+ * Description: This function stops the sampling profiler. The samples 
+ * recorded so far are kept, and may still be dumped. Stopping when the 
+ * profiler isn't running has no effect and is not considered as an error.
+ * Return value: Always 0.
+*/
+int uthread_profile_stop();
+
+
+/*
+ * Description: This function writes the recorded samples to the file at 
+ * path as folded stacks (a line per stack, its frames separated by 
+ * semicolons from the outermost, followed by its number of samples), which
+ * flamegraph.pl, inferno and speedscope read. Each stack is rooted at the
+ * thread it was sampled in, or at the thread's entry function, as set by 
+ * group. It is an error to call this function if the profiler was never 
+ * started, with an unknown group, or if the file can't be written.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_profile_dump(const char* path, uthread_profile_group group);
+
+
+/*
+ * Description: This function starts publishing live stats to a POSIX 
+ * shared memory object of the given name (created, or replaced if it 
+ * exists), which uthread-top and other processes can map and read without 
+ * affecting the calling process. Every period scheduling decisions, the 
+ * scheduler writes a record per thread id (the thread's state, quantums, 
+ * voluntary and involuntary switches and running cycles) and the totals 
+ * (live threads, ready queue length, sleepers, the running thread, 
+ * quantums and switches), each record under a sequence lock, so readers 
+ * never see a torn record and never delay the writer. The layout is defined
+ * by stats_segment.h. A previously published segment is unlinked. The name
+ * must start with a '/' and contain no other '/'. It is an error to call 
+ * this function with an invalid name or a non-positive period, or if the 
+ * shared memory object can't be created.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_stats_publish(const char* name, int period);
+
+
+/*
+ * Description: This function stops publishing live stats: the segment is 
+ * marked closed and unlinked (readers which mapped it may still read its 
+ * last publication). Stopping when no segment is published has no effect 
+ * and is not considered as an error.
+ * Return value: Always 0.
+*/
+int uthread_stats_unpublish();
+
+
+/*
+ * Description: This function creates a thread-local key. Each thread 
+ * (including the main thread) holds its own value for the key, which is NULL
+ * until set by uthread_setspecific. When a thread other than the main thread
+ * is terminated, destructor (if not NULL) is called with each of its 
+ * non-NULL values, after the value is reset to NULL - for up to 
+ * UTHREAD_DESTRUCTOR_ITERATIONS rounds, if destructors set values again. The
+ * destructors are run by the thread calling uthread_terminate (or returning
+ * from its entry function), before the thread is terminated - and only if 
+ * it can be, so a failing uthread_terminate leaves the values as they are.
+ * At most UTHREAD_KEYS_MAX keys can be created, and keys are never deleted.
+ * Return value: On success, return the new key. On failure, return -1.
+*/
+int uthread_key_create(void (*destructor)(void*));
+
+
+/*
+ * Description: This function returns the RUNNING thread's value for key.
+ * The value is read through a pointer to the thread's slots, which is 
+ * updated on every context switch, so this function doesn't mask signals. 
+ * It is an error to call this function before uthread_init, or with a key 
+ * which wasn't created.
+ * Return value: The RUNNING thread's value for key, or NULL on failure.
+*/
+void* uthread_getspecific(int key);
+
+
+/*
+ * Description: This function sets the RUNNING thread's value for key, 
+ * without masking signals. It is an error to call this function before 
+ * uthread_init, or with a key which wasn't created.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_setspecific(int key, const void* value);
+
+
+/*
+ * Description: This function allocates size bytes (aligned to 16 bytes) for
+ * the RUNNING thread, from a chain of memory regions held by the thread. The
+ * memory can't be freed on its own: the whole chain is released at once 
+ * when the thread terminates, and its regions are kept by the runtime for 
+ * reuse (up to arena_pool_max). An allocation only bumps a pointer in the 
+ * thread's region, without masking signals. When the region is used up, a 
+ * new one is taken from the runtime's pool (or allocated, and an allocation
+ * larger than a region gets a region of its own). The main thread's regions
+ * are only released when the process exits. If a region can't be 
+ * allocated, the process exits with exit code 1.
+ * Return value: A pointer to the allocated memory.
+*/
+void* uthread_alloc(size_t size);
+
+
+/*
+ * Description: This function creates a generator: fn, called with arg on a
+ * stack of its own (like a new thread's), producing values one at a time 
+ * with uthread_generator_yield for the thread pulling them with 
+ * uthread_generator_next. The generator only runs inside 
+ * uthread_generator_next, as part of the calling thread (its consumer): 
+ * control moves between the two by a direct switch of stacks, without a 
+ * scheduling decision, the ready queue or a system call, so an item costs a
+ * single switch each way. The library functions called by fn act on the 
+ * consumer, which may be preempted, sleep or block while running the 
+ * generator as usual. The generator doesn't take a thread id. Generators 
+ * may nest, and are bound to the runtime that created them. It is an error 
+ * to create a generator of a null fn.
+ * Return value: On success, return the generator. On failure, return NULL.
+*/
+uthread_generator* uthread_generator_create(void (*fn)(void*), void* arg);
+
+
+/*
+ * Description: This function runs the generator until it yields a value, 
+ * which is stored in value, or until its function returns. A finished 
+ * generator returns right away. It is an error to call this function with 
+ * a null generator or value, or with a generator which is running (such as
+ * from inside the generator itself).
+ * Return value: Return 1 if the generator yielded a value, 0 if it has 
+ * finished, and -1 on failure.
+*/
+int uthread_generator_next(uthread_generator* generator, void** value);
+
+
+/*
+ * Description: This function hands value to the consumer of the generator
+ * running it, and returns once the generator is resumed by 
+ * uthread_generator_next. It is an error to call this function outside of 
+ * a generator.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_generator_yield(void* value);
+
+
+/*
+ * Description: This function destroys the generator and frees its stack. A
+ * generator which hasn't finished is abandoned where it yielded last (its 
+ * function never continues). A generator whose consumer was terminated 
+ * while running it is finished. It is an error to call this function with 
+ * a null generator, or with a generator which is running.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_generator_destroy(uthread_generator* generator);
+
+
+
+/*
+ * Description: This function posts a task - a call of fn with the argument
+ * arg - to the library's task runner. The task runner is a thread created
+ * by the library when the first task is posted, which runs posted tasks one
+ * after the other in the order they were posted, and is BLOCKED while there
+ * are none. It is scheduled like any other thread (and counts towards 
+ * MAX_THREAD_NUM). It is an error to post a null fn.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_post(void (*fn)(void*), void* arg);
+
+
+/*
+ * Description: This function posts a task like uthread_post, to be run 
+ * after num_quantums quantums (not including the current quantum), like a
+ * thread that called uthread_sleep. Waiting tasks are kept in a heap, so the
+ * cost of a scheduling decision doesn't grow with their number. It is an
+ * error to post a null fn, or a non-positive num_quantums.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_post_after(int num_quantums, void (*fn)(void*), void* arg);
+
+
+/*
+ * Description: This function makes the RUNNING thread wait until *flag is
+ * non-zero. A thread other than the main thread is BLOCKED while waiting, 
+ * and must be resumed (with uthread_resume) by whoever sets the flag, after
+ * setting it. The main thread, which can't be blocked, yields until the flag
+ * is set. Checking the flag and blocking is atomic with respect to the 
+ * library's threads, so a wakeup can't be lost.
+ * Return value: Always 0.
+*/
+int uthread_wait_flag(volatile int* flag);
+
+
+/*
+ * Description: This function returns the runtime of the calling kernel 
+ * thread. Each kernel thread which called uthread_init runs its own runtime
+ * - its own threads, queues and quantum timer - and all other library 
+ * functions act on the calling kernel thread's runtime. The returned handle
+ * lets other kernel threads send requests to the runtime (see 
+ * uthread_resume_remote_on), and stays valid until the process exits.
+ * Return value: The calling kernel thread's runtime, or NULL if it didn't
+ * call uthread_init.
+*/
+uthread_runtime* uthread_get_runtime();
+
+
+/*
+ * Description: This function asks the given runtime to resume its thread 
+ * with ID tid, like uthread_resume, and may be called from any kernel thread
+ * or signal handler (it doesn't touch the runtime's state). The request is 
+ * pushed to a lock-free queue, which the runtime's scheduler drains on every
+ * scheduling decision, so it takes effect by the next one; requests naming 
+ * a thread which doesn't exist by then are ignored. It is an error to call 
+ * this function with a null runtime, with a tid out of range, or when the 
+ * queue holds remote_capacity requests already. Errors are written with 
+ * write(2), which is safe in signal handlers.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_resume_remote_on(uthread_runtime* runtime, int tid);
+
+
+/*
+ * Description: This function posts a task - a call of fn with the argument
+ * arg - to the given runtime, like uthread_post, and may be called from any
+ * kernel thread or signal handler. The task is pushed to the queue of 
+ * uthread_resume_remote_on, and posted when the runtime's scheduler drains
+ * it. It is an error to call this function with a null runtime or fn, with
+ * a runtime initialized without remote_tasks, or when the queue is full. 
+ * Tasks submitted after the task runner was terminated wait for a 
+ * uthread_post to create it again.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_submit_remote_on(uthread_runtime* runtime, void (*fn)(void*), 
+                             void* arg);
+
+
+/*
+ * Description: This function is uthread_resume_remote_on, for the first 
+ * runtime initialized in the process.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_resume_remote(int tid);
+
+
+/*
+ * Description: This function is uthread_submit_remote_on, for the first 
+ * runtime initialized in the process.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_submit_remote(void (*fn)(void*), void* arg);
+
+
+/*
+ * Description: This function returns an eventfd of the calling kernel 
+ * thread's runtime, which becomes readable when remote requests are pushed
+ * to it, and is reset by the scheduler when it drains them. Library threads
+ * are scheduled by a CPU time timer, which doesn't run while the kernel 
+ * thread waits in the kernel, so a thread waiting for I/O (with poll, select
+ * or epoll) should wait for this fd too, and call uthread_yield when it is 
+ * readable, rather than read it.
+ * Return value: The eventfd, or -1 if the library isn't initialized.
+*/
+int uthread_remote_fd();
+
+
+/*
+ * Description: This function starts the library's executor: workers 
+ * long-lived threads (counting towards MAX_THREAD_NUM), which run the jobs 
+ * submitted by uthread_executor_submit one after the other, and are BLOCKED
+ * while there are none. Up to capacity submitted jobs may wait for a 
+ * worker. It is an error to call this function with a non-positive workers
+ * or capacity, if the executor was started already, or if it would cause 
+ * the number of concurrent threads to exceed MAX_THREAD_NUM.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_executor_start(int workers, int capacity);
+
+
+/*
+ * Description: This function submits a job - a call of fn with the argument
+ * arg - to the executor, and returns a future which is done once a worker 
+ * has run it, holding its return value. If capacity jobs are waiting 
+ * already, the calling thread is BLOCKED until a worker takes one (the main
+ * thread, which can't be blocked, yields until then). The future must be 
+ * given up with uthread_future_release. It is an error to call this 
+ * function before uthread_executor_start, with a null fn, or from a worker
+ * when the queue is full (as all workers could wait for each other).
+ * Return value: On success, return the future. On failure, return NULL.
+*/
+uthread_future* uthread_executor_submit(void* (*fn)(void*), void* arg);
+
+
+/*
+ * Description: This function submits a job like uthread_executor_submit, 
+ * but fails rather than waiting if the queue is full, so that the caller 
+ * may shed or defer the work.
+ * Return value: On success, return the future. On failure (including a 
+ * full queue), return NULL.
+*/
+uthread_future* uthread_executor_try_submit(void* (*fn)(void*), void* arg);
+
+
+/*
+ * Description: This function makes the RUNNING thread wait until the job of
+ * future was run, and returns its return value. A thread other than the 
+ * main thread is BLOCKED while waiting, and the main thread yields until 
+ * then. A worker waiting for a job which is still in the queue may wait 
+ * forever, if all workers wait. It is an error to call this function with a
+ * null future, or while another thread waits for it.
+ * Return value: The return value of the future's job, or NULL on failure.
+*/
+void* uthread_future_wait(uthread_future* future);
+
+
+/*
+ * Description: This function sets a continuation of the future: fn is called
+ * with the return value of its job and with arg, once the job was run - by
+ * the worker which ran it, right after it. If the job was run already, fn 
+ * is called at once by the calling thread. It is an error to call this 
+ * function with a null future or fn, or if the future has a continuation.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_future_then(uthread_future* future, 
+                        void (*fn)(void* result, void* arg), void* arg);
+
+
+/*
+ * Description: This function gives the future up. Its object is reused by
+ * later submissions once its job was run (its continuation, if any, still
+ * runs), so it must not be used anymore. It is an error to call this 
+ * function with a null future.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_future_release(uthread_future* future);
+
+
+/*
+ * Description: This function ends the quantum of the RUNNING thread in 
+ * simulation mode (see uthread_options.sim_mode), as if the timer expired:
+ * the thread is preempted, moved to the end of the READY threads list, and 
+ * a scheduling decision is made. It is an error to call this function 
+ * outside of simulation mode.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_sim_tick();
+
+
+/*
+ * Description: This function marks a point at which the RUNNING thread may
+ * be preempted in simulation mode. The point preempts the thread (like 
+ * uthread_sim_tick) with a chance of 1 in sim_preempt_odds, drawn from a 
+ * pseudo-random sequence seeded by sim_seed, so the same seed replays the 
+ * same schedule. Outside of simulation mode it does nothing.
+ * Return value: 1 if the thread was preempted, and 0 otherwise.
+*/
+int uthread_sim_point();
+
+
+
+#ifdef __cplusplus
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace uthread
+{
+
+/* Runs a callable constructed at the top of the thread's stack, and destroys
+it when it returns */
+template<typename F>
+void runCallable(void* storage)
+{
+	F* callable = static_cast<F*>(storage);
+	(*callable)();
+	callable -> ~F();
+}
+
+/* Move constructs the callable pointed to by ctx into the storage */
+template<typename F>
+void moveCallable(void* storage, void* ctx)
+{
+	new(storage) F(std::move(*static_cast<F*>(ctx)));
+}
+
+/*
+ * Description: This function creates a new thread like uthread_spawn, whose
+ * entry point is the callable f (a function object, e.g. a lambda, which may
+ * be move-only). The callable is moved into storage at the top of the new 
+ * thread's stack, so no memory is allocated, and is destroyed when it 
+ * returns (but not if the thread is terminated before that). The callable's
+ * move constructor must not throw, and the callable must fit in half of the
+ * stack.
+ * Return value: On success, return the ID of the created thread.
+ * On failure, return -1.
+*/
+template<typename F>
+int spawn(F&& f)
+{
+	typedef typename std::decay<F>::type Callable;
+	static_assert(alignof(Callable) <= 16, 
+	              "callable alignment exceeds the stack storage alignment");
+	static_assert(std::is_nothrow_move_constructible<Callable>::value,
+	              "callable must be nothrow move constructible");
+	
+	Callable callable(std::forward<F>(f));
+	return uthread_spawn_with_storage(runCallable<Callable>, sizeof(Callable),
+	                                  moveCallable<Callable>, &callable);
+}
+
+}
+
+#endif
+
+
 #endif
 